@@ -1,14 +1,483 @@
+/**
+ * The Atlas is the central store of position data: every canonical position reachable from a set of roots, grouped into
+ * layers by tile sum, together with its exact value under optimal play. Moves preserve the tile sum and each spawn adds
+ * 2 or 4, so the successors of layer s lie in layers s + 2 and s + 4 only. We enumerate the layers forwards in order of
+ * increasing tile sum, then compute values backwards, each layer only reading the two above it.
+ *
+ * Positions in the Atlas are those with the player to move. The value of a position is the probability of making the
+ * target tile with optimal play; positions already holding the target are terminal (value 1) and aren't expanded, which
+ * keeps the state space finite.
+ *
+ * Because both passes only ever touch three adjacent layers, the Atlas can optionally spill every other layer to disk
+ * (see AtlasOptions::spill_dir), bounding peak memory by the three largest adjacent layers rather than the whole space.
+ *
+ * Once a layer is solved it is only ever probed by position, so it gets a minimal perfect hash (PerfectHash) and its
+ * positions and values are reordered to match: a probe is then a cache miss or two rather than a binary search.
+ * Optionally (AtlasOptions::drop_keys) the positions of solved layers are then freed altogether.
+ */
 #pragma once
 
 #include "position.h"
+#include "enumerate.h"
+#include "parallel.h"
+#include "perf.h"
+#include "perfect_hash.h"
+#include "policy.h"
+#include "search.h"
+#include "wide_position.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <string>
+#include <vector>
 
 namespace Analysis {
-	// Centrally manages position data
+	struct AtlasOptions {
+		uint8_t target = 11;  // representation of the winning tile, e.g. 11 = 2048
+		int threads = 0;   // 0 = all cores
+		// If non-empty, keep at most three layers in memory and stream the others to files in this directory, which
+		// are deleted with the Atlas
+		std::string spill_dir;
+		// Free the positions of each layer once it is solved, keeping only its values and perfect hash, 4.5 rather
+		// than 12.5 bytes per position. lookup() then can't tell positions outside the Atlas, and export_policy() is
+		// unavailable. Not with spill_dir.
+		bool drop_keys = false;
+	};
+
+	// Centrally manages position data. vector_size is the PositionV width successors are canonicalized at; 1 is scalar.
 	template <int vector_size>
 	class Atlas {
+		static_assert(vector_size == 1 || vector_size == 2 || vector_size == 4 || vector_size == 8);
+
+		struct Layer {
+			std::vector<uint64_t> positions;  // canonical and unique; sorted until solved, then in index order
+			std::vector<float> values;  // parallel to positions; empty until solved
+			PerfectHash index;  // built once solved, and rebuilt when a spilled layer is loaded
+
+			size_t count = 0;  // number of positions, kept while the layer is spilled
+			bool resident = true;
+			bool positions_on_disk = false;
+			bool values_on_disk = false;
+			bool hashed = false;  // positions and values are in index order
+
+			// Index of a canonical position in the layer, or -1 if absent. Without positions, any position maps
+			// to some index.
+			int64_t find(uint64_t canonical) const {
+				if (hashed) {
+					uint64_t i = index(canonical);
+					if (positions.empty()) return count ? i : -1;
+
+					return positions[i] == canonical ? i : -1;
+				}
+
+				auto it = std::lower_bound(positions.begin(), positions.end(), canonical);
+				if (it == positions.end() || *it != canonical) return -1;
+
+				return it - positions.begin();
+			}
+
+			size_t bytes() const {
+				return positions.size() * sizeof(uint64_t) + values.size() * sizeof(float) + index.bytes();
+			}
+		};
+
+		AtlasOptions opts;
+		std::vector<Layer> layers;  // indexed by tile sum / 2
+		bool solved = false;
+		size_t peak_bytes = 0;
+
+		bool is_terminal(uint64_t tiles) const {
+			return nibble_max(tiles) >= opts.target;
+		}
+
+		bool windowed() const {
+			return !opts.spill_dir.empty();
+		}
+
+		Layer& layer_for(uint32_t sum) {
+			assert(sum % 2 == 0);
+			if (sum / 2 >= layers.size()) layers.resize(sum / 2 + 1);
+
+			return layers[sum / 2];
+		}
+
+		const Layer* find_layer(uint32_t sum) const {
+			return (sum % 2 == 0 && sum / 2 < layers.size()) ? &layers[sum / 2] : nullptr;
+		}
+
+		void update_peak() {
+			size_t b = 0;
+			for (const Layer& l : layers) b += l.bytes();
+
+			peak_bytes = max(peak_bytes, b);
+		}
+
+		std::string layer_path(size_t li, const char* kind) const {
+			return opts.spill_dir + "/layer_" + std::to_string(li * 2) + "." + kind;
+		}
+
+		template <typename T>
+		void write_file(const std::string& path, const std::vector<T>& v) const {
+			FILE* f = fopen(path.c_str(), "wb");
+
+			if (!f || fwrite(v.data(), sizeof(T), v.size(), f) != v.size() || fclose(f) != 0) {
+				fprintf(stderr, "Failed to write Atlas layer file %s\n", path.c_str());
+				abort();
+			}
+		}
+
+		template <typename T>
+		void read_file(const std::string& path, std::vector<T>& v, size_t count) const {
+			FILE* f = fopen(path.c_str(), "rb");
+			v.resize(count);
+
+			if (!f || fread(v.data(), sizeof(T), count, f) != count) {
+				fprintf(stderr, "Failed to read Atlas layer file %s\n", path.c_str());
+				abort();
+			}
+
+			fclose(f);
+		}
+
+		// Delete every layer file written to the spill directory
+		void remove_spill_files() {
+			if (!windowed()) return;
+
+			std::error_code ec;  // layers never spilled have no files
+			for (size_t li = 0; li < layers.size(); ++li) {
+				std::filesystem::remove(layer_path(li, "pos"), ec);
+				std::filesystem::remove(layer_path(li, "val"), ec);
+			}
+		}
+
+		// Write whatever the layer has that isn't on disk yet, then free it
+		void spill_layer(size_t li) {
+			Layer& l = layers[li];
+			if (!l.resident) return;
+
+			ANALYSIS_PERF_REGION("atlas/spill");
+
+			if (!l.positions_on_disk) {
+				write_file(layer_path(li, "pos"), l.positions);
+				l.positions_on_disk = true;
+			}
+
+			if (!l.values.empty() && !l.values_on_disk) {
+				write_file(layer_path(li, "val"), l.values);
+				l.values_on_disk = true;
+			}
+
+			std::vector<uint64_t>().swap(l.positions);
+			std::vector<float>().swap(l.values);
+			l.index = PerfectHash();
+			l.resident = false;
+		}
+
+		// Build the perfect hash of a solved layer and put its positions and values in index order. When windowed,
+		// the sorted positions already on disk are stale and are written again on spilling.
+		void hash_layer(size_t li) {
+			ANALYSIS_PERF_REGION("atlas/hash");
+
+			Layer& l = layers[li];
+			l.index = PerfectHash(l.positions.data(), l.positions.size(), opts.threads);
+
+			std::vector<uint64_t> positions(l.positions.size());
+			std::vector<float> values(l.values.size());
+
+			parallel_for(l.positions.size(), opts.threads, [&] (int64_t i) {
+				uint64_t j = l.index(l.positions[i]);
+				positions[j] = l.positions[i];
+				values[j] = l.values[i];
+			}, 4096);
+
+			l.values = std::move(values);
+			l.hashed = true;
+			l.positions_on_disk = false;
+
+			if (opts.drop_keys) std::vector<uint64_t>().swap(l.positions);
+			else l.positions = std::move(positions);
+		}
+
+		// Canonicalize count boards in place, vector_size at a time
+		static void canonicalize(uint64_t* tiles, int count) {
+			int i = 0;
+			for (; i + vector_size <= count; i += vector_size) {
+				PositionV<vector_size>::load(tiles + i).canonical().store(tiles + i);
+			}
+
+			for (; i < count; ++i) tiles[i] = canonical_position(tiles[i]);
+		}
+
+		// Value of a canonical successor; the layer above must already be solved
+		float successor_value(uint64_t canonical, uint32_t sum) const {
+			const Layer* l = find_layer(sum);
+			assert(l && l->resident);
+
+			int64_t idx = l->find(canonical);
+			assert(idx >= 0);
+
+			return l->values[idx];
+		}
+
+		// Expected value of moving in the given direction, or -1 if the move is illegal
+		float move_value(uint64_t tiles, uint32_t sum, Direction d) const {
+			uint64_t moved = move_in_direction(tiles, d);
+			if (moved == tiles) return -1;
+
+			Position pp2[16], pp4[16];
+			int pp2c, pp4c;
+			Position{ moved }.gen_new_tiles(pp2, pp4, &pp2c, &pp4c);
+
+			// Spawns of a 2, then of a 4, canonicalized together
+			uint64_t successors[32];
+			for (int i = 0; i < pp2c; ++i) {
+				successors[i] = pp2[i].tiles;
+				successors[pp2c + i] = pp4[i].tiles;
+			}
+
+			canonicalize(successors, 2 * pp2c);
+
+			float ev = 0;
+			for (int i = 0; i < pp2c; ++i) {
+				ev += 0.9f * successor_value(successors[i], sum + 2);
+				ev += 0.1f * successor_value(successors[pp2c + i], sum + 4);
+			}
+
+			return ev / pp2c;
+		}
+
+		float compute_value(uint64_t tiles, uint32_t sum) const {
+			if (is_terminal(tiles)) return 1;
+
+			float best = 0;
+			for (Direction d : { RIGHT, LEFT, UP, DOWN }) {
+				best = max(best, move_value(tiles, sum, d));
+			}
+
+			return best;
+		}
+
+		void solve_layer(size_t li) {
+			ANALYSIS_PERF_REGION_DYNAMIC("atlas/solve layer " + std::to_string(li * 2));
+
+			Layer& l = layers[li];
+			l.values.resize(l.positions.size());
 
+			parallel_for(l.positions.size(), opts.threads, [&] (int64_t i) {
+				l.values[i] = compute_value(l.positions[i], li * 2);
+			}, 256);
+
+			hash_layer(li);
+		}
+
+		// Best move from a position of the layer with the given sum, whose two successor layers are resident. Terminal
+		// positions take their first legal move, and positions without one RIGHT.
+		Direction best_move(uint64_t tiles, uint32_t sum) const {
+			uint8_t legal = move_all(tiles).legal_mask;
+			if (!legal) return RIGHT;
+			if (is_terminal(tiles)) return (Direction)__builtin_ctz(legal);
+
+			Direction best = RIGHT;
+			float best_value = -1;
+			for (Direction d : { RIGHT, LEFT, UP, DOWN }) {
+				if (!(legal & (1 << d))) continue;
+
+				float v = move_value(tiles, sum, d);
+				if (v > best_value) {
+					best = d;
+					best_value = v;
+				}
+			}
+
+			return best;
+		}
+
+		public:
+		Atlas(AtlasOptions opts=AtlasOptions{}) : opts(opts) {
+			if (windowed() && opts.drop_keys) {
+				fprintf(stderr, "Atlas options drop_keys and spill_dir can't be combined\n");
+				abort();
+			}
+
+			if (windowed()) std::filesystem::create_directories(opts.spill_dir);
+		}
+
+		// Spilled layers are only needed by this Atlas, so their files go with it
+		~Atlas() {
+			remove_spill_files();
+		}
+
+		Atlas(const Atlas&) = delete;
+		Atlas& operator=(const Atlas&) = delete;
+
+		// Enumerate everything reachable from the real starting positions
 		void init() {
+			std::vector<Position> roots = starting_roots();
+			init(roots.data(), roots.size());
+		}
+
+		// Enumerate everything reachable from the given positions, with the player to move in each. The enumerator keeps
+		// the two pending layers above the one it hands us, so when windowed we spill each layer as soon as it arrives.
+		void init(const Position* roots, int count) {
+			ANALYSIS_PERF_REGION("atlas/enumerate");
+
+			remove_spill_files();
+			layers.clear();
+			solved = false;
+			peak_bytes = 0;
+
+			EnumerateOptions eo { .threads = opts.threads, .target = opts.target };
+
+			EnumerateStats stats = enumerate_layers(roots, count, eo, [&] (uint32_t sum, std::vector<uint64_t>& positions) {
+				Layer& l = layer_for(sum);
+
+				l.positions = std::move(positions);
+				l.count = l.positions.size();
+
+				update_peak();
+				if (windowed()) spill_layer(sum / 2);
+			});
+
+			peak_bytes = max(peak_bytes, stats.peak_bytes);
+		}
+
+		// Compute the value of every position, from the highest layer downwards. When windowed, layer s is loaded
+		// while s + 2 and s + 4 are resident, and s + 4 is spilled once s is done.
+		void solve() {
+			for (size_t li = layers.size(); li-- > 0;) {
+				if (windowed()) load_layer(li * 2);
+
+				// Roots far apart leave many layers empty, which needn't each get a region
+				if (layers[li].count) solve_layer(li);
+				update_peak();
+
+				if (windowed() && li + 2 < layers.size()) spill_layer(li + 2);
+			}
+
+			solved = true;
+		}
+
+		bool is_solved() const {
+			return solved;
+		}
+
+		// Bring a spilled layer back into memory. Only needed for lookups when windowed; has no effect otherwise.
+		void load_layer(uint32_t tile_sum) {
+			assert(tile_sum % 2 == 0 && tile_sum / 2 < layers.size());
+
+			size_t li = tile_sum / 2;
+			Layer& l = layers[li];
+			if (l.resident) return;
+
+			ANALYSIS_PERF_REGION("atlas/load");
+
+			if (l.positions_on_disk) read_file(layer_path(li, "pos"), l.positions, l.count);
+			if (l.values_on_disk) read_file(layer_path(li, "val"), l.values, l.count);
+			if (l.hashed) l.index = PerfectHash(l.positions.data(), l.positions.size(), opts.threads);
+
+			l.resident = true;
+		}
+
+		// Release a layer's memory, writing it to the spill directory first. Only valid when windowed.
+		void unload_layer(uint32_t tile_sum) {
+			assert(windowed());
+			assert(tile_sum % 2 == 0 && tile_sum / 2 < layers.size());
+
+			spill_layer(tile_sum / 2);
+		}
+
+		bool is_resident(uint32_t tile_sum) const {
+			const Layer* l = find_layer(tile_sum);
+			return l && l->resident;
+		}
+
+		// Look up the value of any symmetric variant of a position in the Atlas. Returns false if it isn't present, or
+		// if its layer isn't resident.
+		bool lookup(Position p, float* value) const {
+			assert(solved);
+
+			const Layer* l = find_layer(p.tile_sum());
+			if (!l || !l->resident) return false;
+
+			int64_t idx = l->find(canonical_position(p.tiles));
+			if (idx < 0) return false;
+
+			*value = l->values[idx];
+			return true;
+		}
+
+		// Exact value of each move from a position in the Atlas; replaces a heuristic search where the Atlas applies.
+		// When windowed, the two layers above the position's must be resident.
+		MoveValues evaluate(Position p) const {
+			assert(solved);
+
+			MoveValues r;
+			r.legal_mask = 0;
+			r.overflow_mask = overflowing_moves(p.tiles);
+
+			for (Direction d : { RIGHT, LEFT, UP, DOWN }) {
+				r.values[d] = (r.overflow_mask >> d) & 1 ? -1 : move_value(p.tiles, p.tile_sum(), d);
+				if (r.values[d] >= 0) r.legal_mask |= 1 << d;
+			}
+
+			return r;
+		}
+
+		// Write the best move of every position, and optionally its value, as a policy file for PolicyReader. Goes down
+		// the layers like solve(), so when windowed only a layer and the two above it are resident at a time.
+		void export_policy(const std::string& path, bool with_values=true) {
+			assert(solved && !opts.drop_keys);
+			ANALYSIS_PERF_REGION("atlas/export_policy");
+
+			PolicyWriter writer{ path, opts.target, with_values };
+			std::vector<Direction> best;
+
+			// Layers loaded for lookups would otherwise stay resident alongside the window
+			if (windowed()) {
+				for (size_t lj = 0; lj + 3 < layers.size(); ++lj) spill_layer(lj);
+			}
+
+			for (size_t li = layers.size(); li-- > 0;) {
+				if (windowed()) {
+					if (li + 3 < layers.size()) spill_layer(li + 3);
+					for (size_t lj = li; lj < std::min(li + 3, layers.size()); ++lj) load_layer(lj * 2);
+				}
+
+				update_peak();
+
+				const Layer& l = layers[li];
+				best.resize(l.positions.size());
+
+				parallel_for(l.positions.size(), opts.threads, [&] (int64_t i) {
+					best[i] = best_move(l.positions[i], li * 2);
+				}, 256);
+
+				writer.add_layer(li * 2, l.positions.data(), best.data(), l.values.data(), l.positions.size());
+			}
+
+			writer.finish();
+		}
+
+		size_t layer_size(uint32_t tile_sum) const {
+			const Layer* l = find_layer(tile_sum);
+			return l ? l->count : 0;
+		}
+
+		// Largest tile sum of any position in the Atlas
+		uint32_t max_tile_sum() const {
+			return layers.empty() ? 0 : (layers.size() - 1) * 2;
+		}
+
+		size_t size() const {
+			size_t s = 0;
+			for (const Layer& l : layers) s += l.count;
+
+			return s;
+		}
 
+		// Most bytes of position and value data held in memory at once during init(), solve() and export_policy()
+		size_t peak_resident_bytes() const {
+			return peak_bytes;
 		}
 	};
 }
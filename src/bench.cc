@@ -0,0 +1,323 @@
+/**
+ * Kernel microbenchmarks. Every kernel runs over the same array of random positions, in scalar and through PositionV at
+ * each width, and the results go to stdout as one JSON object so that runs on different machines or builds can be
+ * compared by script. Widths which can't be vectorized on this build still run, through the scalar fallback, and are
+ * reported with "vectorized": false.
+ *
+ * Usage: bench [kernel name filter] [minimum seconds per measurement, default 0.2]
+ */
+
+#include "cpu_features.h"
+#include "defs.h"
+#include "layer_rank.h"
+#include "move_lut.h"
+#include "position.h"
+#include "shuffle.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using namespace Analysis;
+
+namespace {
+	constexpr int POSITIONS = 1 << 14;  // 128 KB, so the measurements are of the kernels rather than of memory
+	constexpr int REPEATS = 5;
+
+	struct Result {
+		const char* kernel;
+		int width;
+		bool vectorized;
+		double ns_per_position;
+	};
+
+	std::vector<Result> results;
+	const char* filter = nullptr;
+	double min_seconds = 0.2;
+
+	// Where results go so that the kernels aren't optimized out
+	volatile uint64_t sink;
+
+	// Positions with a realistic mix of empty squares and small tiles
+	std::vector<uint64_t> random_positions(uint64_t seed) {
+		Rng rng{ seed };
+		std::vector<uint64_t> p(POSITIONS);
+
+		for (uint64_t& t : p) {
+			t = 0;
+			for (int i = 0; i < 16; ++i) {
+				uint32_t r = rng.next() % 16;
+				t |= (uint64_t)(r < 6 ? 0 : r - 5) << (4 * i);
+			}
+		}
+
+		return p;
+	}
+
+	// Time f, which processes POSITIONS positions, and record the best of REPEATS measurements of at least
+	// min_seconds each
+	template <typename F>
+	void measure(const char* kernel, int width, bool vectorized, F&& f) {
+		if (filter && !strstr(kernel, filter)) return;
+
+		using clock = std::chrono::steady_clock;
+		double best = 1e300;
+
+		for (int r = 0; r < REPEATS; ++r) {
+			uint64_t passes = 0;
+			auto start = clock::now();
+			double elapsed;
+
+			do {
+				sink = f();
+				++passes;
+				elapsed = std::chrono::duration<double>(clock::now() - start).count();
+			} while (elapsed < min_seconds);
+
+			best = std::min(best, elapsed * 1e9 / (passes * POSITIONS));
+		}
+
+		results.push_back(Result { kernel, width, vectorized, best });
+	}
+
+	// Every lane of a result, so that none of the lanes' work can be dropped
+	template <typename PV>
+	uint64_t fold_lanes(const PV& p) {
+		uint64_t lanes[PV::count];
+		p.store(lanes);
+
+		uint64_t x = 0;
+		for (uint64_t l : lanes) x ^= l;
+
+		return x;
+	}
+
+	template <int width>
+	void bench_width(const std::vector<uint64_t>& in) {
+		using PV = PositionV<width>;
+		constexpr bool vec = PV::vectorize;
+
+		measure("shuffle_nibbles", width, vec, [&] () {
+			uint64_t acc = 0;
+			for (int i = 0; i < POSITIONS; i += width) acc += fold_lanes(PV::load(&in[i]).perm(constants::rotate_90));
+			return acc;
+		});
+
+		measure("move_right", width, vec, [&] () {
+			uint64_t acc = 0;
+			for (int i = 0; i < POSITIONS; i += width) acc += fold_lanes(PV::load(&in[i]).move_right());
+			return acc;
+		});
+
+		measure("canonical_position", width, vec, [&] () {
+			uint64_t acc = 0;
+			for (int i = 0; i < POSITIONS; i += width) acc += fold_lanes(PV::load(&in[i]).canonical());
+			return acc;
+		});
+
+		measure("count_empty", width, vec, [&] () {
+			uint64_t acc = 0;
+			for (int i = 0; i < POSITIONS; i += width) acc += fold_lanes(PV{ PV::load(&in[i]).count_empty() });
+			return acc;
+		});
+
+		measure("tile_sum", width, vec, [&] () {
+			uint64_t acc = 0;
+			for (int i = 0; i < POSITIONS; i += width) acc += fold_lanes(PV{ PV::load(&in[i]).tile_sum() });
+			return acc;
+		});
+
+		measure("get_next_random", width, vec, [&] () {
+			Rng rng{ 1 };
+			uint64_t acc = 0;
+			for (int i = 0; i < POSITIONS; i += width) acc += fold_lanes(PV::load(&in[i]).get_next_random(nullptr, &rng));
+			return acc;
+		});
+	}
+
+	void bench_scalar(const std::vector<uint64_t>& in) {
+		measure("shuffle_nibbles", 1, false, [&] () {
+			uint64_t acc = 0;
+			for (uint64_t t : in) acc += shuffle_nibbles(t, constants::rotate_90);
+			return acc;
+		});
+
+		measure("move_right", 1, false, [&] () {
+			uint64_t acc = 0;
+			for (uint64_t t : in) acc += move_right(t);
+			return acc;
+		});
+
+		measure("move_left", 1, false, [&] () {
+			uint64_t acc = 0;
+			for (uint64_t t : in) acc += move_left(t);
+			return acc;
+		});
+
+		measure("move_up", 1, false, [&] () {
+			uint64_t acc = 0;
+			for (uint64_t t : in) acc += move_up(t);
+			return acc;
+		});
+
+		measure("move_all", 1, false, [&] () {
+			uint64_t acc = 0;
+			for (uint64_t t : in) acc += move_all(t).legal_mask;
+			return acc;
+		});
+
+		// Scattered over a working set much larger than L2, as in search with a big transposition table, so that
+		// the move tables have to compete for cache
+		std::vector<uint64_t> big(64 << 20 >> 3);
+		for (size_t i = 0; i < big.size(); ++i) big[i] = in[i % POSITIONS] ^ (i * 0x9e37'79b9'7f4a'7c15);
+
+		measure("move_all_cold", 1, false, [&] () {
+			uint64_t acc = 0, h = 1;
+			for (int i = 0; i < POSITIONS; ++i) {
+				h = h * 6364136223846793005ULL + 1442695040888963407ULL;
+				uint64_t& slot = big[(h >> 20) % big.size()];
+
+				slot += move_all(in[i]).moves[i & 3];
+				acc += slot;
+			}
+			return acc;
+		});
+
+		measure("canonical_position", 1, false, [&] () {
+			uint64_t acc = 0;
+			for (uint64_t t : in) acc += canonical_position(t);
+			return acc;
+		});
+
+		measure("count_empty", 1, false, [&] () {
+			uint64_t acc = 0;
+			for (uint64_t t : in) acc += count_empty(t);
+			return acc;
+		});
+
+		measure("tile_sum", 1, false, [&] () {
+			uint64_t acc = 0;
+			for (uint64_t t : in) acc += tile_sum(t);
+			return acc;
+		});
+
+		measure("get_next_random", 1, false, [&] () {
+			Rng rng{ 1 };
+			uint64_t acc = 0;
+			for (uint64_t t : in) {
+				bool s;
+				acc += Position{ t }.get_next_random(&s, &rng).tiles;
+			}
+			return acc;
+		});
+
+		// Boards with tiles up to 2048 rank below a sum of 16 of them
+		LayerRanking ranking{ 11, 1 << 15 };
+		std::vector<uint64_t> ranks(POSITIONS);
+
+		measure("rank_position", 1, false, [&] () {
+			uint64_t acc = 0;
+			for (uint64_t t : in) acc += ranking.rank(t);
+			return acc;
+		});
+
+		measure("unrank_position", 1, false, [&] () {
+			uint64_t acc = 0;
+			for (uint64_t t : in) acc += ranking.unrank(tile_sum(t), t % ranking.count(tile_sum(t)));
+			return acc;
+		});
+
+		measure("rank_batch", 4, can_vectorize<4>, [&] () {
+			ranking.rank_batch(in.data(), ranks.data(), POSITIONS);
+			return ranks[0];
+		});
+
+		// Only has a scalar implementation. The input has runs of duplicates, as a sorted layer would.
+		std::vector<uint64_t> sorted(in);
+		for (size_t i = 0; i < sorted.size(); ++i) sorted[i] = in[i / 4];
+
+		std::vector<uint64_t> out(POSITIONS);
+		std::vector<int> freqs(POSITIONS);
+
+		measure("dedup_positions_consecutive", 1, false, [&] () {
+			int count;
+			dedup_positions_consecutive(sorted.data(), POSITIONS, out.data(), freqs.data(), &count);
+			return (uint64_t)count;
+		});
+	}
+
+	// The load-time dispatched array kernels, reported as width 8 and vectorized when the CPU has AVX2 or better
+	void bench_dispatch(const std::vector<uint64_t>& in) {
+		bool vec = detect_cpu_level() >= CpuLevel::AVX2;
+		std::vector<uint64_t> out(POSITIONS);
+
+		measure("dispatch::move_positions", 8, vec, [&] () {
+			dispatch::move_positions(in.data(), out.data(), POSITIONS, RIGHT);
+			return out[0];
+		});
+
+		measure("dispatch::canonical_positions", 8, vec, [&] () {
+			out = in;
+			dispatch::canonical_positions(out.data(), POSITIONS);
+			return out[0];
+		});
+
+		// Only the VBMI version is vectorized
+		measure("dispatch::shuffle_positions", 8, detect_cpu_level() >= CpuLevel::VBMI, [&] () {
+			dispatch::shuffle_positions(in.data(), out.data(), POSITIONS, constants::rotate_90);
+			return out[0];
+		});
+	}
+
+	void print_json() {
+		printf("{\n\t\"features\": [");
+
+		[[maybe_unused]] const char* sep = "";  // unused without any of the features
+#define FEATURE(name) printf("%s\"" #name "\"", sep); sep = ", ";
+#ifdef USE_AVX2_VECTORIZE
+		FEATURE(USE_AVX2_VECTORIZE)
+#endif
+#ifdef USE_AVX512_VECTORIZE
+		FEATURE(USE_AVX512_VECTORIZE)
+#endif
+#ifdef USE_VBMI_VECTORIZE
+		FEATURE(USE_VBMI_VECTORIZE)
+#endif
+#ifdef USE_VNNI_VECTORIZE
+		FEATURE(USE_VNNI_VECTORIZE)
+#endif
+#undef FEATURE
+
+		printf("],\n\t\"compiled_cpu_level\": \"%s\",\n\t\"cpu_level\": \"%s\",\n", cpu_level_name(COMPILED_CPU_LEVEL),
+			cpu_level_name(detect_cpu_level()));
+		printf("\t\"move_lut_bytes\": %zu,\n", detail::MOVE_LUT_BYTES);
+		printf("\t\"positions\": %d,\n\t\"results\": [\n", POSITIONS);
+
+		for (size_t i = 0; i < results.size(); ++i) {
+			const Result& r = results[i];
+
+			printf("\t\t{ \"kernel\": \"%s\", \"width\": %d, \"vectorized\": %s, \"ns_per_position\": %.4f, "
+				"\"positions_per_sec\": %.0f }%s\n", r.kernel, r.width, r.vectorized ? "true" : "false",
+				r.ns_per_position, 1e9 / r.ns_per_position, i + 1 < results.size() ? "," : "");
+		}
+
+		printf("\t]\n}\n");
+	}
+}
+
+int main(int argc, char** argv) {
+	if (argc > 1 && strcmp(argv[1], "")) filter = argv[1];
+	if (argc > 2) min_seconds = atof(argv[2]);
+
+	std::vector<uint64_t> in = random_positions(0x2048);
+
+	bench_scalar(in);
+	bench_width<2>(in);
+	bench_width<4>(in);
+	bench_width<8>(in);
+	bench_dispatch(in);
+
+	print_json();
+}
@@ -0,0 +1,51 @@
+#include "cpu_features.h"
+
+#include <cstdlib>
+
+namespace Analysis {
+	// Compiled for the baseline whatever the build flags, so that it can run on any x86-64 CPU
+#if defined(__x86_64__) && defined(__GNUC__)
+	__attribute__((target("arch=x86-64")))
+#endif
+	CpuLevel detect_cpu_level() {
+#if defined(__x86_64__) && defined(__GNUC__)
+		__builtin_cpu_init();
+
+		if (!__builtin_cpu_supports("avx2") || !__builtin_cpu_supports("bmi2")) return CpuLevel::SCALAR;
+		if (!__builtin_cpu_supports("avx512f") || !__builtin_cpu_supports("avx512vl") || !__builtin_cpu_supports("avx512bw"))
+			return CpuLevel::AVX2;
+		if (!__builtin_cpu_supports("avx512vbmi")) return CpuLevel::AVX512;
+
+		return CpuLevel::VBMI;
+#else
+		return CpuLevel::SCALAR;
+#endif
+	}
+
+	const char* cpu_level_name(CpuLevel level) {
+		switch (level) {
+			case CpuLevel::SCALAR: return "scalar";
+			case CpuLevel::AVX2: return "avx2";
+			case CpuLevel::AVX512: return "avx512";
+			case CpuLevel::VBMI: return "vbmi";
+		}
+
+		return "unknown";
+	}
+
+	namespace {
+		// Runs before any other static initializer, which might already use the compiled-in instructions
+#if defined(__x86_64__) && defined(__GNUC__)
+		__attribute__((constructor(101), target("arch=x86-64")))
+		void check_cpu_level() {
+			CpuLevel level = detect_cpu_level();
+
+			if (level < COMPILED_CPU_LEVEL) {
+				fprintf(stderr, "This binary was compiled for %s, but this CPU only supports %s. Rebuild with "
+					"-DPORTABLE=ON for a binary that runs anywhere.\n", cpu_level_name(COMPILED_CPU_LEVEL), cpu_level_name(level));
+				exit(1);
+			}
+		}
+#endif
+	}
+}
@@ -0,0 +1,35 @@
+/**
+ * Which vector instruction sets the running CPU has, against those the build was compiled for. Most of the code picks
+ * its instruction set at compile time (defs.h), so a binary built with -march=native faults with SIGILL on an older
+ * machine; a startup check in cpu_features.cc catches this first and exits with a message naming what is missing.
+ * Builds meant for a mixed fleet should be configured with PORTABLE, which targets the x86-64 baseline and leaves the
+ * choice of instruction set to the MULTIVERSIONED kernels at load time.
+ */
+#pragma once
+
+#include "defs.h"
+
+namespace Analysis {
+	// Ordered: each level includes the ones below
+	enum class CpuLevel : uint8_t {
+		SCALAR = 0,
+		AVX2 = 1,  // with BMI2
+		AVX512 = 2,  // F, VL and BW
+		VBMI = 3  // AVX512 and VBMI
+	};
+
+	constexpr CpuLevel COMPILED_CPU_LEVEL =
+#if defined(USE_VBMI_VECTORIZE)
+		CpuLevel::VBMI;
+#elif defined(USE_AVX512_VECTORIZE)
+		CpuLevel::AVX512;
+#elif defined(USE_X86_VECTORIZE)
+		CpuLevel::AVX2;
+#else
+		CpuLevel::SCALAR;
+#endif
+
+	// Best level the running CPU supports, by cpuid
+	CpuLevel detect_cpu_level();
+	const char* cpu_level_name(CpuLevel level);
+}
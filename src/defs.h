@@ -30,6 +30,28 @@
 
 #endif
 
+/**
+ * Functions marked MULTIVERSIONED are compiled once per instruction set below, and the dynamic loader picks the best
+ * one for the running CPU (GCC target_clones, resolved through an ifunc). This is how a PORTABLE build, which targets
+ * the x86-64 baseline, still gets AVX2 or AVX-512 in its batch kernels. Builds with AVX2 or better compiled in already
+ * target the machine they run on, and get a single version.
+ *
+ * GCC can't clone for VBMI (target_clones rejects it, and its resolver never picks a target("avx512vbmi") overload),
+ * so kernels which only gain from VBMI's byte permutes compile a VBMI_TARGET version next to a plain one, and choose
+ * between them by detect_cpu_level(). ANALYSIS_MULTIVERSIONING says whether a build needs both.
+ */
+#if defined(__x86_64__) && defined(__GNUC__) && defined(__linux__) && !defined(USE_X86_VECTORIZE)
+#define ANALYSIS_MULTIVERSIONING
+#define MULTIVERSIONED __attribute__((target_clones("default", "arch=x86-64-v3", "arch=x86-64-v4")))
+#define VBMI_TARGET __attribute__((target("avx512f,avx512bw,avx512vbmi")))
+#else
+#define MULTIVERSIONED
+#endif
+
+// For helpers called from MULTIVERSIONED functions, which must be inlined into each clone: an out-of-line copy is only
+// compiled for the baseline, and passing wide vectors to it would mix calling conventions.
+#define FORCE_INLINE __attribute__((always_inline)) inline
+
 namespace Analysis {
 	inline void print_features() {
 		const char* features =
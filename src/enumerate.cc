@@ -0,0 +1,222 @@
+#include "enumerate.h"
+#include "parallel.h"
+#include "perf.h"
+#include "radix_sort.h"
+#include "move_lut.h"
+#include "shuffle.h"
+
+#include <algorithm>
+#include <map>
+
+namespace Analysis {
+	namespace {
+		// Positions of the current layer expanded per round, which bounds the thread-local buffers
+		constexpr size_t BLOCK_SIZE = 1 << 14;
+
+		// One hash partition of a pending layer: a sorted, unique prefix followed by an unsorted tail of new arrivals.
+		// The tail is folded in once it outgrows half the prefix, so merging is amortized O(n log n) and a partition
+		// never holds more than 1.5x its distinct positions.
+		struct Partition {
+			std::vector<uint64_t> data;
+			size_t sorted = 0;
+
+			void compact() {
+				std::sort(data.begin() + sorted, data.end());
+				std::inplace_merge(data.begin(), data.begin() + sorted, data.end());
+				data.erase(std::unique(data.begin(), data.end()), data.end());
+
+				sorted = data.size();
+			}
+
+			void maybe_compact() {
+				if (data.size() - sorted > sorted / 2) compact();
+			}
+		};
+
+		struct PendingLayer {
+			std::vector<Partition> parts;
+
+			size_t size() const {
+				size_t s = 0;
+				for (const Partition& p : parts) s += p.data.size();
+
+				return s;
+			}
+		};
+
+		int partition_of(uint64_t tiles, int bits) {
+			return bits ? (int)(hash_tiles(tiles) >> (64 - bits)) : 0;
+		}
+
+		// Compact every partition and concatenate them into one sorted layer
+		std::vector<uint64_t> finalize(PendingLayer& pl, int threads) {
+			ANALYSIS_PERF_REGION("enumerate/finalize");
+
+			int parts = pl.parts.size();
+
+			parallel_for(parts, threads, [&] (int64_t p) {
+				pl.parts[p].compact();
+			});
+
+			std::vector<size_t> offsets(parts + 1, 0);
+			for (int p = 0; p < parts; ++p) offsets[p + 1] = offsets[p] + pl.parts[p].data.size();
+
+			std::vector<uint64_t> layer(offsets[parts]);
+
+			parallel_for(parts, threads, [&] (int64_t p) {
+				std::copy(pl.parts[p].data.begin(), pl.parts[p].data.end(), layer.begin() + offsets[p]);
+				std::vector<uint64_t>().swap(pl.parts[p].data);
+			});
+
+			// Partitions are disjoint, so this is only ordering, not deduplication
+			std::vector<uint64_t> scratch(layer.size());
+			radix_sort_positions(layer.data(), layer.size(), scratch.data(), threads);
+
+			return layer;
+		}
+	}
+
+	EnumerateStats enumerate_layers(const Position* roots, int count, const EnumerateOptions& opts, const LayerCallback& on_layer) {
+		int threads = opts.threads > 0 ? opts.threads : default_thread_count();
+
+		// At least four partitions per thread, so the merge phase balances reasonably
+		int bits = 0;
+		while ((1 << bits) < 4 * threads) ++bits;
+
+		const int parts = 1 << bits;
+
+		std::map<uint32_t, PendingLayer> pending;
+		auto get_pending = [&] (uint32_t sum) -> PendingLayer& {
+			PendingLayer& pl = pending[sum];
+			if (pl.parts.empty()) pl.parts.resize(parts);
+
+			return pl;
+		};
+
+		auto pending_bytes = [&] () {
+			size_t b = 0;
+			for (auto& [sum, pl] : pending) b += pl.size() * sizeof(uint64_t);
+
+			return b;
+		};
+
+		for (int i = 0; i < count; ++i) {
+			uint32_t sum = roots[i].tile_sum();
+			if (sum > opts.max_tile_sum) continue;
+
+			uint64_t c = canonical_position(roots[i].tiles);
+			get_pending(sum).parts[partition_of(c, bits)].data.push_back(c);
+		}
+
+		// buffers[t][which * parts + p] holds thread t's successors for partition p of layer s + 2 (which = 0) or s + 4
+		std::vector<std::vector<std::vector<uint64_t>>> buffers(threads, std::vector<std::vector<uint64_t>>(2 * parts));
+
+		EnumerateStats stats;
+
+		while (!pending.empty()) {
+			uint32_t sum = pending.begin()->first;
+			std::vector<uint64_t> layer = finalize(pending.begin()->second, threads);
+			pending.erase(pending.begin());
+
+			PendingLayer* next[2] = {
+				sum + 2 <= opts.max_tile_sum ? &get_pending(sum + 2) : nullptr,
+				sum + 4 <= opts.max_tile_sum ? &get_pending(sum + 4) : nullptr
+			};
+
+			for (size_t block = 0; block < layer.size(); block += BLOCK_SIZE) {
+				size_t block_end = std::min(layer.size(), block + BLOCK_SIZE);
+				size_t block_len = block_end - block;
+
+				parallel_for(threads, threads, [&] (int64_t t) {
+					ANALYSIS_PERF_REGION("enumerate/expand");
+					auto& buf = buffers[t];
+
+					for (size_t i = block + block_len * t / threads; i < block + block_len * (t + 1) / threads; ++i) {
+						uint64_t tiles = layer[i];
+						if (opts.target && nibble_max(tiles) >= opts.target) continue;
+
+						for (Direction d : { RIGHT, LEFT, UP, DOWN }) {
+							uint64_t moved = move_in_direction(tiles, d);
+							if (moved == tiles) continue;
+
+							Position pp[2][16];
+							int ppc[2];
+							Position{ moved }.gen_new_tiles(pp[0], pp[1], &ppc[0], &ppc[1]);
+
+							for (int which = 0; which < 2; ++which) {
+								if (!next[which]) continue;
+
+								uint64_t succ[16];
+								for (int j = 0; j < ppc[which]; ++j) succ[j] = pp[which][j].tiles;
+
+								canonical_positions(succ, ppc[which]);
+
+								for (int j = 0; j < ppc[which]; ++j) {
+									buf[which * parts + partition_of(succ[j], bits)].push_back(succ[j]);
+								}
+							}
+						}
+					}
+				});
+
+				parallel_for(parts, threads, [&] (int64_t p) {
+					ANALYSIS_PERF_REGION("enumerate/merge");
+
+					for (int which = 0; which < 2; ++which) {
+						if (!next[which]) continue;
+
+						Partition& part = next[which]->parts[p];
+						for (int t = 0; t < threads; ++t) {
+							auto& b = buffers[t][which * parts + p];
+
+							part.data.insert(part.data.end(), b.begin(), b.end());
+							b.clear();
+						}
+
+						part.maybe_compact();
+					}
+				});
+
+				stats.peak_bytes = max(stats.peak_bytes, layer.size() * sizeof(uint64_t) + pending_bytes());
+			}
+
+			// Don't leave empty layers behind, or we'd never run out of pending layers
+			for (uint32_t s : { sum + 2, sum + 4 }) {
+				auto it = pending.find(s);
+				if (it != pending.end() && it->second.size() == 0) pending.erase(it);
+			}
+
+			stats.positions += layer.size();
+			on_layer(sum, layer);
+		}
+
+		return stats;
+	}
+
+	std::vector<Position> starting_roots() {
+		std::vector<Position> roots;
+
+		for (Position p : Position::get_all_starting()) {
+			Position pp2[16], pp4[16];
+			int pp2c, pp4c;
+			p.gen_new_tiles(pp2, pp4, &pp2c, &pp4c);
+
+			roots.insert(roots.end(), pp2, pp2 + pp2c);
+			roots.insert(roots.end(), pp4, pp4 + pp4c);
+		}
+
+		return roots;
+	}
+
+	std::vector<size_t> count_layers(const EnumerateOptions& opts) {
+		std::vector<Position> roots = starting_roots();
+		std::vector<size_t> sizes;
+
+		enumerate_layers(roots.data(), roots.size(), opts, [&] (uint32_t sum, std::vector<uint64_t>& positions) {
+			if (sum / 2 >= sizes.size()) sizes.resize(sum / 2 + 1, 0);
+			sizes[sum / 2] = positions.size();
+		});
+
+		return sizes;
+	}
+}
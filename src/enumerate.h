@@ -0,0 +1,44 @@
+/**
+ * Parallel forward enumeration of reachable positions, one tile-sum layer at a time. Threads expand disjoint slices of
+ * the current layer (every move, then every 2 or 4 spawn, then canonicalization) into thread-local buffers split by a
+ * hash of the successor. Each hash partition of the pending layers is then merged and deduplicated by one thread, so no
+ * lock is ever taken and duplicates can only meet within a partition.
+ */
+#pragma once
+
+#include "defs.h"
+#include "position.h"
+
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+namespace Analysis {
+	struct EnumerateOptions {
+		int threads = 0;  // 0 = all cores
+		// Positions holding a tile at least this representation are emitted but not expanded; 0 expands everything
+		uint8_t target = 0;
+		// Layers above this tile sum are never generated
+		uint32_t max_tile_sum = UINT32_MAX;
+	};
+
+	struct EnumerateStats {
+		size_t positions = 0;  // total emitted across all layers
+		// Most bytes held at once by the current layer and the pending layers above it, not counting the transient
+		// buffers of the per-block successor generation and of the final sort
+		size_t peak_bytes = 0;
+	};
+
+	// Called with each finished layer in increasing order of tile sum. positions is canonical, sorted and unique, and
+	// may be moved from.
+	using LayerCallback = std::function<void(uint32_t tile_sum, std::vector<uint64_t>& positions)>;
+
+	// Enumerate every canonical position reachable from the roots (positions with the player to move)
+	EnumerateStats enumerate_layers(const Position* roots, int count, const EnumerateOptions& opts, const LayerCallback& on_layer);
+
+	// Every position the player can first move from: a base position from Position::get_all_starting() plus one spawn
+	std::vector<Position> starting_roots();
+
+	// Size of each layer reachable from starting_roots(), indexed by tile sum / 2
+	std::vector<size_t> count_layers(const EnumerateOptions& opts);
+}
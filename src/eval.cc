@@ -0,0 +1,141 @@
+#include "eval.h"
+#include "move_lut.h"
+#include "shuffle.h"
+
+#include <cmath>
+
+namespace Analysis {
+	namespace {
+		constexpr int ROWS = 1 << 16;
+
+		// Widest PositionV for evaluate_batch
+		constexpr int EVAL_WIDTH = can_vectorize<8> ? 8 : 4;
+
+		int nonzero_tiles(uint16_t row) {
+			int n = 0;
+			for (int i = 0; i < 4; ++i) n += ((row >> (4 * i)) & 0xf) != 0;
+
+			return n;
+		}
+	}
+
+	RowFeatures row_features(uint16_t row, const EvalWeights& w) {
+		uint8_t r[4];
+		for (int i = 0; i < 4; ++i) r[i] = (row >> (4 * i)) & 0xf;
+
+		RowFeatures f{};
+
+		for (int i = 0; i < 4; ++i) {
+			f.empty += r[i] == 0;
+			f.sum += std::pow((float)r[i], w.sum_power);
+		}
+
+		// Moving along the row merges away exactly the tiles that could merge; the LUT saturates but keeps the count
+		f.merges = nonzero_tiles(row) - nonzero_tiles(detail::move_right_lut16[row]);
+
+		// Rows can be monotonic either way; only the smaller of the two violations counts
+		float inc = 0, dec = 0;
+		for (int i = 0; i < 3; ++i) {
+			float a = std::pow((float)r[i], w.monotonicity_power);
+			float b = std::pow((float)r[i + 1], w.monotonicity_power);
+
+			if (a > b) dec += a - b;
+			else inc += b - a;
+		}
+
+		f.monotonicity = std::min(inc, dec);
+
+		return f;
+	}
+
+	HeuristicEval::HeuristicEval(const EvalWeights& w) : w(w), empty(ROWS), merges(ROWS), monotonicity(ROWS), sum(ROWS), score(ROWS) {
+		for (int row = 0; row < ROWS; ++row) {
+			RowFeatures f = row_features(row, w);
+
+			empty[row] = f.empty;
+			merges[row] = f.merges;
+			monotonicity[row] = f.monotonicity;
+			sum[row] = f.sum;
+
+			score[row] = w.base + w.empty * f.empty + w.merges * f.merges
+				- w.monotonicity * f.monotonicity - w.sum * f.sum;
+		}
+	}
+
+	float HeuristicEval::evaluate(uint64_t tiles) const {
+		uint64_t cols = transpose(tiles);
+
+		// Same order of additions as the vector versions, so that both give the same floats
+		float s = 0;
+		for (int shift = 0; shift < 64; shift += 16) {
+			s += score[(tiles >> shift) & 0xffff];
+			s += score[(cols >> shift) & 0xffff];
+		}
+
+		return std::max(s, 1.0f);
+	}
+
+#ifdef USE_X86_VECTORIZE
+	// Gather one row of every lane at a time, so the row scores of a lane stay in its own float lane
+	void HeuristicEval::evaluate_lanes(__m128i tiles, float* out) const {
+		__m256i t = _mm256_set_m128i(_mm_setzero_si128(), tiles);
+
+		float s[4];
+		evaluate_lanes(t, s);
+
+		out[0] = s[0];
+		out[1] = s[1];
+	}
+
+	void HeuristicEval::evaluate_lanes(__m256i tiles, float* out) const {
+		const __m256i row = _mm256_set1_epi64x(0xffff);
+		__m256i cols = transpose(tiles);
+
+		__m128 s = _mm_setzero_ps();
+		for (int shift = 0; shift < 64; shift += 16) {
+			s = _mm_add_ps(s, _mm256_i64gather_ps(score.data(), _mm256_and_si256(_mm256_srli_epi64(tiles, shift), row), 4));
+			s = _mm_add_ps(s, _mm256_i64gather_ps(score.data(), _mm256_and_si256(_mm256_srli_epi64(cols, shift), row), 4));
+		}
+
+		_mm_storeu_ps(out, _mm_max_ps(s, _mm_set1_ps(1.0f)));
+	}
+
+#ifdef USE_AVX512_VECTORIZE
+	void HeuristicEval::evaluate_lanes(__m512i tiles, float* out) const {
+		const __m512i row = _mm512_set1_epi64(0xffff);
+		__m512i cols = transpose(tiles);
+
+		__m256 s = _mm256_setzero_ps();
+		for (int shift = 0; shift < 64; shift += 16) {
+			s = _mm256_add_ps(s, _mm512_i64gather_ps(_mm512_and_si512(_mm512_srli_epi64(tiles, shift), row), score.data(), 4));
+			s = _mm256_add_ps(s, _mm512_i64gather_ps(_mm512_and_si512(_mm512_srli_epi64(cols, shift), row), score.data(), 4));
+		}
+
+		_mm256_storeu_ps(out, _mm256_max_ps(s, _mm256_set1_ps(1.0f)));
+	}
+#endif
+#endif
+
+	void HeuristicEval::evaluate_batch(const uint64_t* tiles, size_t count, float* out) const {
+		using PV = PositionV<EVAL_WIDTH>;
+
+		size_t i = 0;
+		for (; i + EVAL_WIDTH <= count; i += EVAL_WIDTH) evaluate(PV::load(tiles + i), out + i);
+		for (; i < count; ++i) out[i] = evaluate(tiles[i]);
+	}
+
+	namespace {
+		const HeuristicEval& default_eval() {
+			static const HeuristicEval eval;
+			return eval;
+		}
+	}
+
+	float heuristic_leaf_eval(uint64_t tiles) {
+		return default_eval().evaluate(tiles);
+	}
+
+	void heuristic_leaf_eval_batch(const uint64_t* tiles, int count, float* out) {
+		default_eval().evaluate_batch(tiles, count, out);
+	}
+}
@@ -0,0 +1,84 @@
+/**
+ * Heuristic leaf evaluation from row tables. Every feature is a sum over the four rows and four columns of a board, so
+ * each is precomputed for all 65536 rows, and the weighted sum of them goes into one more table; scoring a board is
+ * then eight lookups, the columns being the rows of its transpose. PositionV lanes are scored at once with gathers.
+ *
+ * The features and default weights follow the usual 2048 expectimax heuristic: reward empty squares and tiles which
+ * could merge, and penalize lines which aren't monotonic and the total weight of large tiles.
+ */
+#pragma once
+
+#include "defs.h"
+#include "position.h"
+
+#include <vector>
+
+namespace Analysis {
+	struct EvalWeights {
+		float empty = 270.0f;
+		float merges = 700.0f;
+		float monotonicity = 47.0f;  // penalty
+		float sum = 11.0f;  // penalty
+		float monotonicity_power = 4.0f;
+		float sum_power = 3.5f;
+		// Added per row and column, so that live positions stay well above a dead one (value 0)
+		float base = 200'000.0f;
+	};
+
+	// Features of one row of four tiles, in the order of the nibbles
+	struct RowFeatures {
+		float empty;  // empty squares
+		float merges;  // tiles a move along the row would merge away
+		float monotonicity;  // how far the row is from monotonic, in powers of the tile representations
+		float sum;  // sum of powers of the tile representations
+	};
+
+	RowFeatures row_features(uint16_t row, const EvalWeights& w);
+
+	class HeuristicEval {
+		EvalWeights w;
+
+		// Feature tables, indexed by row
+		std::vector<float> empty, merges, monotonicity, sum;
+		// Their weighted sum plus the base
+		std::vector<float> score;
+
+#ifdef USE_X86_VECTORIZE
+		void evaluate_lanes(__m128i tiles, float* out) const;
+		void evaluate_lanes(__m256i tiles, float* out) const;
+#ifdef USE_AVX512_VECTORIZE
+		void evaluate_lanes(__m512i tiles, float* out) const;
+#endif
+#endif
+
+		public:
+		HeuristicEval(const EvalWeights& w=EvalWeights{});
+
+		const EvalWeights& weights() const { return w; }
+		RowFeatures features(uint16_t row) const { return { empty[row], merges[row], monotonicity[row], sum[row] }; }
+		float row_score(uint16_t row) const { return score[row]; }
+
+		// At least 1, so that any position at the horizon beats a dead one
+		float evaluate(uint64_t tiles) const;
+
+		// Score every lane of p into out
+		template <int count, bool vectorize>
+		void evaluate(const PositionV<count, vectorize>& p, float* out) const;
+
+		// Score count positions, with the widest PositionV available and scalar for the rest
+		void evaluate_batch(const uint64_t* tiles, size_t count, float* out) const;
+	};
+
+	template <int count, bool vectorize>
+	void HeuristicEval::evaluate(const PositionV<count, vectorize>& p, float* out) const {
+		if constexpr (vectorize) {
+			evaluate_lanes(p.tiles, out);
+		} else {
+			for (int i = 0; i < count; ++i) out[i] = evaluate(p.get_idx(i).tiles);
+		}
+	}
+
+	// Default-weighted HeuristicEval, usable as SearchOptions::leaf_eval and leaf_eval_batch
+	float heuristic_leaf_eval(uint64_t tiles);
+	void heuristic_leaf_eval_batch(const uint64_t* tiles, int count, float* out);
+}
@@ -0,0 +1,140 @@
+#include "layer_rank.h"
+
+namespace Analysis {
+	namespace {
+		// Without a branch, since tiles of random boards make one unpredictable
+		uint32_t tile_weight(int tile) {
+			return (1u << tile) >> (tile == 0);
+		}
+	}
+
+	LayerRanking::LayerRanking(uint8_t max_tile, uint32_t max_sum)
+		: max_tile(max_tile), max_sum(max_sum & ~1u), sums(max_sum / 2 + 1) {
+		assert(max_tile >= 1 && max_tile < TILES);
+
+		// ways[k][r / 2]: boards of k squares summing to r
+		std::vector<std::vector<uint64_t>> ways(TILES + 1, std::vector<uint64_t>(sums));
+		ways[0][0] = 1;
+
+		for (int k = 1; k <= TILES; ++k) {
+			for (uint32_t h = 0; h < sums; ++h) {
+				uint64_t w = 0;
+				for (int t = 0; t <= max_tile; ++t) {
+					uint32_t tw = tile_weight(t) / 2;
+					if (tw <= h) w += ways[k - 1][h - tw];
+				}
+
+				assert(w < (1ULL << 63));
+				ways[k][h] = w;
+			}
+		}
+
+		counts = ways[TILES];
+		prefix.resize((size_t)TILES * sums * TILES);
+
+		for (int square = 0; square < TILES; ++square) {
+			for (uint32_t h = 0; h < sums; ++h) {
+				uint64_t* p = &prefix[((size_t)square * sums + h) * TILES];
+				const std::vector<uint64_t>& below = ways[square];
+
+				uint64_t acc = 0;
+				for (int t = 0; t < TILES; ++t) {
+					p[t] = acc;
+
+					uint32_t tw = tile_weight(t) / 2;
+					if (t <= max_tile && tw <= h) acc += below[h - tw];
+				}
+
+				// A tile that doesn't fit would take the rank past every board of the row
+				for (int t = 1; t < TILES; ++t) {
+					if (t > max_tile || tile_weight(t) / 2 > h) p[t] = acc;
+				}
+			}
+		}
+	}
+
+	uint64_t LayerRanking::count(uint32_t sum) const {
+		return (sum % 2 == 0 && sum <= max_sum) ? counts[sum / 2] : 0;
+	}
+
+	uint64_t LayerRanking::rank(uint64_t tiles) const {
+		uint32_t weights[TILES];
+		uint32_t remaining = 0;
+
+		for (int square = 0; square < TILES; ++square) {
+			weights[square] = tile_weight((tiles >> (4 * square)) & 0xf);
+			remaining += weights[square];
+		}
+
+		assert(remaining <= max_sum);
+
+		uint64_t r = 0;
+		for (int square = TILES - 1; square >= 0; --square) {
+			r += row(square, remaining)[(tiles >> (4 * square)) & 0xf];
+			remaining -= weights[square];
+		}
+
+		return r;
+	}
+
+	uint64_t LayerRanking::unrank(uint32_t sum, uint64_t rank) const {
+		assert(rank < count(sum));
+
+		uint64_t tiles = 0;
+		uint32_t remaining = sum;
+
+		for (int square = TILES - 1; square >= 0; --square) {
+			const uint64_t* p = row(square, remaining);
+
+			// The row is nondecreasing, and the tile here is the last whose prefix doesn't pass the rank
+			int t = 0;
+			for (int u = 1; u < TILES; ++u) t += p[u] <= rank;
+
+			rank -= p[t];
+			remaining -= tile_weight(t);
+			tiles |= (uint64_t)t << (4 * square);
+		}
+
+		assert(rank == 0 && remaining == 0);
+		return tiles;
+	}
+
+	void LayerRanking::rank_batch(const uint64_t* tiles, uint64_t* out, size_t count) const {
+		size_t i = 0;
+
+#ifdef USE_X86_VECTORIZE
+		// Four boards at a time: the tile sums by variable shifts, then one gather per square
+		const __m256i nibble = _mm256_set1_epi64x(0xf);
+		const __m256i one = _mm256_set1_epi64x(1);
+		const __m256i zero = _mm256_setzero_si256();
+		const long long* table = (const long long*)prefix.data();
+
+		for (; i + 4 <= count; i += 4) {
+			__m256i x = _mm256_loadu_si256((const __m256i*)(tiles + i));
+
+			__m256i weights[TILES], t[TILES];
+			__m256i remaining = zero;
+
+			for (int square = 0; square < TILES; ++square) {
+				t[square] = _mm256_and_si256(_mm256_srli_epi64(x, 4 * square), nibble);
+				weights[square] = _mm256_andnot_si256(_mm256_cmpeq_epi64(t[square], zero), _mm256_sllv_epi64(one, t[square]));
+				remaining = _mm256_add_epi64(remaining, weights[square]);
+			}
+
+			__m256i r = zero;
+			for (int square = TILES - 1; square >= 0; --square) {
+				// ((square * sums + remaining / 2) * TILES + tile
+				__m256i idx = _mm256_add_epi64(_mm256_set1_epi64x((int64_t)square * sums), _mm256_srli_epi64(remaining, 1));
+				idx = _mm256_add_epi64(_mm256_slli_epi64(idx, 4), t[square]);
+
+				r = _mm256_add_epi64(r, _mm256_i64gather_epi64(table, idx, 8));
+				remaining = _mm256_sub_epi64(remaining, weights[square]);
+			}
+
+			_mm256_storeu_si256((__m256i*)(out + i), r);
+		}
+#endif
+
+		for (; i < count; ++i) out[i] = rank(tiles[i]);
+	}
+}
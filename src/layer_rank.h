@@ -0,0 +1,57 @@
+/**
+ * Combinatorial ranking of boards within a tile-sum layer: a bijection between the boards with a given tile sum, and
+ * no tile above a maximum, and the integers [0, count(sum)). Ranks follow the numeric order of the tiles, so the sorted
+ * positions of a layer have increasing ranks, and a range of ranks is a contiguous slice of the layer that can be
+ * handed to a thread or a machine by its two ends.
+ *
+ * Squares are taken as digits from the most significant nibble down. With C[k][r] the number of ways to fill k squares
+ * to sum r, a board's rank is the sum over its squares of the boards that agree on the squares above and have a smaller
+ * tile here; those partial sums are precomputed for every square, remaining sum and tile, so rank() is sixteen
+ * independent-ish table loads and unrank() sixteen rows of fifteen comparisons, with no branches on the data.
+ *
+ * These are all boards of the sum, not the reachable canonical ones the Atlas keeps; count() says how far apart the
+ * two are. Every count must be below 2^63, which holds for any maximum tile when sums stay below 2^16.
+ */
+#pragma once
+
+#include "defs.h"
+
+#include <vector>
+
+namespace Analysis {
+	class LayerRanking {
+		static constexpr int TILES = 16;  // row width of the prefix table, one entry per tile representation
+
+		uint8_t max_tile;
+		uint32_t max_sum;
+		uint32_t sums;  // max_sum / 2 + 1; sums are always even
+
+		// prefix[(square * sums + remaining / 2) * TILES + tile]: boards of the squares below square, summing to
+		// remaining less the weight of any smaller tile here. Tiles which don't fit, and those above max_tile, hold the
+		// total, so that unrank() can count comparisons.
+		std::vector<uint64_t> prefix;
+		std::vector<uint64_t> counts;  // by sum / 2
+
+		const uint64_t* row(int square, uint32_t remaining) const {
+			return &prefix[((size_t)square * sums + remaining / 2) * TILES];
+		}
+
+		public:
+		// Boards with tiles up to max_tile (a representation, e.g. 11 = 2048) and tile sums up to max_sum
+		LayerRanking(uint8_t max_tile, uint32_t max_sum);
+
+		uint8_t max_tile_representation() const { return max_tile; }
+		uint32_t max_tile_sum() const { return max_sum; }
+
+		// Number of boards with this tile sum
+		uint64_t count(uint32_t sum) const;
+
+		// Index of a board among those with its tile sum, which must have no tile above max_tile
+		uint64_t rank(uint64_t tiles) const;
+		// The board with this index among those with the given tile sum
+		uint64_t unrank(uint32_t sum, uint64_t rank) const;
+
+		// Rank count boards at once, with gathers where the build has AVX2
+		void rank_batch(const uint64_t* tiles, uint64_t* out, size_t count) const;
+	};
+}
@@ -1,58 +1,10 @@
 #include "defs.h"
 #include "position.h"
+#include "rollout.h"
 
 #include <unordered_set>
 	using namespace Analysis;
 
-int play_dumb_game() {
-	bool s;
-
-	int cnt = 0;
-	Position p = Position::start();
-
-	while (1) {
-		++cnt;
-		int i = 0;
-		for (; i < 4; ++i) {
-			p = p.move_right(&s);
-			if (s) {
-				break;
-			}
-
-			p = p.rotate_90();
-		}
-
-		if (i == 4) // oof!
-			break;
-
-		p = p.get_next_random(&s);
-		// puts(p.to_string());
-	}
-
-	//puts(p.to_string());
-	return cnt;
-}
-
-int play_dumb_game_v() {
-	using PV = PositionV<4>;
-	PV pv = PV::start_all();
-
-	int cnt = 0;
-
-	bool s = false;
-	while (0) {
-		++cnt;
-		PV mu = pv.move_right();
-		if (!s) {
-
-		}
-
-		pv = pv.get_next_random();
-	}
-
-	return 0;
-}
-
 int main() {
 
 	/*std::unordered_set<Position> set;
@@ -70,9 +22,18 @@ int main() {
 		free(s);
 	}*/
 
-	uint64_t total = 0;
+	RolloutOptions opts;
+	opts.games = 10'000'000;
+
+	RolloutStats stats = run_rollouts_simd(opts);
 
-	for (int i = 0; i < 10000000; ++i) total += play_dumb_game();
+	printf("Total moves: %" PRIu64 "\n", stats.total_moves);
+	printf("Moves per game: mean %.2f, min %" PRIu64 ", max %" PRIu64 "\n", stats.mean_moves(), stats.min_moves, stats.max_moves);
+	printf("Score: mean %.2f, max %" PRIu64 "\n", stats.mean_score(), stats.max_score);
+
+	for (int i = 1; i < 16; ++i) {
+		if (stats.max_tile_counts[i]) printf("Max tile %d: %" PRIu64 " games\n", 1 << i, stats.max_tile_counts[i]);
+	}
 
-	printf("Total moves: %" PRIu64 "\n", total);
+	if (stats.overflowed) printf("Stopped before merging two 32768s: %" PRIu64 " games\n", stats.overflowed);
 }
@@ -1,156 +1,223 @@
 #include "move_lut.h"
+#include "cpu_features.h"
 #include "shuffle.h"
+#include "perf.h"
+
+#include <cstring>
 
 namespace Analysis {
 	namespace detail {
-		uint16_t* move_right_lut16 = nullptr;
-		uint32_t* move_right_lut32 = nullptr;
-
-		int generate_move_right_luts() {
-			static bool called = false;
-			if (called) return 0;
-			called = true;
-
-			const int SZ = 1 << 16;
-
-			move_right_lut16 = (uint16_t*)malloc(SZ * sizeof(uint16_t));
-			move_right_lut32 = (uint32_t*)malloc(SZ * sizeof(uint32_t));
-
-			for (uint32_t a = 0; a < (1 << 16); ++a) {
-				uint16_t v16 = 0;
-
-				uint8_t tt[4] = { (uint8_t)(a & 0xf), (uint8_t)((a & 0xf0) >> 4), (uint8_t)((a & 0xf00) >> 8), (uint8_t)((a & 0xf000) >> 12)  };
-
-				auto collapse_right = [&] () -> void {
-					for (int i = 2; i >= 0; --i) {
-						if (tt[i+1] == 0) {
-							tt[i+1] = tt[i];
-							tt[i] = 0;
-						}
-					}
-				};
-
-				collapse_right();
-				collapse_right();
-				collapse_right();
-				for (int i = 2; i >= 0; --i) {
-					if (tt[i] == tt[i+1] && tt[i]) {
-						tt[i+1] = 1 + tt[i];
-						tt[i] = 0;
-					}
-				}
-				collapse_right();
-				collapse_right();
+		namespace {
+			template <uint16_t (*move_row)(uint16_t)>
+			constexpr std::array<uint16_t, 1 << 16> generate_lut() {
+				std::array<uint16_t, 1 << 16> lut{};
+				for (uint32_t row = 0; row < (1 << 16); ++row) lut[row] = move_row(row);
 
-				//v32 = tt[0] + (tt[1] << 8) + (tt[2] << 16) + (tt[3] << 24);
-				v16 = tt[0] + (tt[1] << 4) + (tt[2] << 8) + (tt[3] << 12);
-
-				move_right_lut32[a] = v16;
-				move_right_lut16[a] = v16;
+				return lut;
 			}
+		}
+
+		alignas(4096) constinit const std::array<uint16_t, 1 << 16> move_right_lut16 = generate_lut<move_right_row>();
+#ifndef ANALYSIS_COMPACT_MOVE_LUT
+		alignas(4096) constinit const std::array<uint16_t, 1 << 16> move_left_lut16 = generate_lut<move_left_row>();
+#endif
+	}
 
-			return 0;
+	namespace {
+		inline uint64_t move_rows(uint64_t tiles, const std::array<uint16_t, 1 << 16>& lut) {
+			return (uint64_t)lut[tiles & 0xffff] |
+				((uint64_t)lut[(tiles >> 16) & 0xffff] << 16) |
+				((uint64_t)lut[(tiles >> 32) & 0xffff] << 32) |
+				((uint64_t)lut[(tiles >> 48) & 0xffff] << 48);
+		}
+
+		inline uint64_t move_rows_right(uint64_t tiles) {
+			return move_rows(tiles, detail::move_right_lut16);
+		}
+
+		inline uint64_t move_rows_left(uint64_t tiles) {
+#ifdef ANALYSIS_COMPACT_MOVE_LUT
+			return flip_h(move_rows(flip_h(tiles), detail::move_right_lut16));
+#else
+			return move_rows(tiles, detail::move_left_lut16);
+#endif
 		}
 	}
 
-	uint64_t move_right(uint64_t tiles) {	
-		using namespace detail;
-		uint16_t msk = -1;
+	uint64_t move_right(uint64_t tiles) {
+		return move_rows_right(tiles);
+	}
 
-		tiles = (uint64_t)move_right_lut16[tiles & msk] |
-			((uint64_t)move_right_lut16[(tiles >> 16) & msk] << 16) |
-			((uint64_t)move_right_lut16[(tiles >> 32) & msk] << 32) |
-			((uint64_t)move_right_lut16[(tiles >> 48) & msk] << 48);
+	uint64_t move_left(uint64_t tiles) {
+		return move_rows_left(tiles);
+	}
 
-		return tiles;
+	// In the transposed board up is towards nibble 0 of each row, i.e. left
+	uint64_t move_up(uint64_t tiles) {
+		return transpose(move_rows_left(transpose(tiles)));
+	}
+
+	uint64_t move_down(uint64_t tiles) {
+		return transpose(move_rows_right(transpose(tiles)));
+	}
+
+	AllMoves move_all(uint64_t tiles) {
+		uint64_t t = transpose(tiles);
+
+		AllMoves r;
+		r.moves[RIGHT] = move_rows_right(tiles);
+		r.moves[LEFT] = move_rows_left(tiles);
+		r.moves[UP] = transpose(move_rows_left(t));
+		r.moves[DOWN] = transpose(move_rows_right(t));
+
+		r.legal_mask = 0;
+		for (int d = 0; d < 4; ++d) r.legal_mask |= (r.moves[d] != tiles) << d;
+
+		return r;
 	}
 
-	uint64_t move_perm(uint64_t tiles, uint64_t perm, uint64_t inv_perm) {
-		tiles = shuffle_nibbles(tiles, perm);
-		tiles = move_right(tiles);
-		tiles = shuffle_nibbles(tiles, inv_perm);
+	uint64_t move_in_direction(uint64_t tiles, Direction dir) {
+		switch (dir) {
+			case RIGHT: return move_right(tiles);
+			case LEFT: return move_left(tiles);
+			case UP: return move_up(tiles);
+			case DOWN: return move_down(tiles);
+		}
 
 		return tiles;
 	}
 
-#define DEFINE_MOVE(name, perm, inv_perm) uint64_t name(uint64_t tiles) { \
-	return move_perm(tiles, perm, inv_perm); }
+	// The vector moves work on each 64-bit lane as a SWAR word of 16 nibbles, without any table lookups: tiles slide
+	// right one nibble per step into empty neighbours, equal neighbours merge from the right, then the gaps the merges
+	// left are closed. Flags are kept in the lowest bit of each nibble. Written once against GCC vector types, since
+	// the operations are the same at every width; the dispatched kernels below use them too.
+	namespace {
+		constexpr uint64_t NIBBLE_LSB = 0x1111'1111'1111'1111;
+		constexpr uint64_t NOT_ROW_END = 0x0111'0111'0111'0111;  // every nibble but the rightmost of each row
 
-	DEFINE_MOVE(move_left, constants::rotate_180, constants::rotate_180)
-	DEFINE_MOVE(move_up, constants::rotate_270, constants::rotate_90)
-	DEFINE_MOVE(move_down, constants::rotate_90, constants::rotate_270)
+		template <typename V>
+		FORCE_INLINE V nonzero_flags(V x) {
+			x |= x >> 2;
+			x |= x >> 1;
 
-#ifdef USE_X86_VECTORIZE
-	__m128i move_right(__m128i tiles) {
-		__m128i lo_16_msk = _mm_set1_epi32(0xffff);
-		__m128i lo_16 = _mm_and_si128(lo_16_msk, tiles.v);
-		__m128i hi_16 = _mm_srli_epi32(tiles.v, 16);
+			return x & NIBBLE_LSB;
+		}
 
-		// tp ~4
-		__m128i lo_16_l = _mm_i32gather_epi32((const int*) mr_lut_32, lo_16, 4);
-		__m128i hi_16_l = _mm_i32gather_epi32((const int*) mr_lut_32, hi_16, 4);
+		// Widen flags to whole nibbles
+		template <typename V>
+		FORCE_INLINE V spread_flags(V f) {
+			return (f << 4) - f;
+		}
 
-		return  _mm_slli_epi32(hi_16_l, 16) | lo_16_l;
-	}
+		// Move each tile with an empty right neighbour one step right, steps times. nz holds the nonzero flags of x
+		// and is kept up to date.
+		template <typename V>
+		FORCE_INLINE V slide_right(V x, V& nz, int steps) {
+			for (int s = 0; s < steps; ++s) {
+				V moves = nz & ~(nz >> 4) & NOT_ROW_END;
+				V moving = x & spread_flags(moves);
 
-	__m256i move_right(__m256i tiles) {
-		__m256i lo_16_msk = _mm256_set1_epi32(0xffff);
-		__m256i lo_16 = _mm256_and_si256(lo_16_msk, tiles.v);
-		__m256i hi_16 = _mm256_srli_epi32(tiles.v, 16);
+				x = (x ^ moving) | (moving << 4);
+				nz = (nz ^ moves) | (moves << 4);
+			}
+
+			return x;
+		}
 
-		// 2x vpgatherdd ymm, ymm, ymm -> tp 8 or so on ICL. Maybe consider fancy shuffling techniques, though.
-		__m256i lo_16_l = _mm256_i32gather_epi32((const int*) mr_lut_32, lo_16, 4);
-		__m256i hi_16_l = _mm256_i32gather_epi32((const int*) mr_lut_32, hi_16, 4);
+		template <typename V>
+		FORCE_INLINE V move_right_swar(V x) {
+			V nz = nonzero_flags(x);
+			x = slide_right(x, nz, 3);  // now packed against the right edge
 
-		return  _mm256_slli_epi32(hi_16_l, 16) | lo_16_l;
+			// A tile merges into its right neighbour if they're equal, unless that neighbour already merged rightwards.
+			// The chain is at most three long and the rightmost pair is never blocked, so two rounds settle it.
+			V eq = ~nonzero_flags(x ^ (x >> 4)) & nz & NOT_ROW_END;
+			V merges = eq & ~(eq >> 4);
+			merges = eq & ~(merges >> 4);
+
+			V is_max = x & (x >> 1) & (x >> 2) & (x >> 3) & NIBBLE_LSB;
+			V src = spread_flags(merges);
+			V merged = (x & src) + (merges & ~is_max);  // saturating at 15, like the LUT
+
+			x = (x & ~(src | (src << 4))) | (merged << 4);
+			nz &= ~merges;
+
+			return slide_right(x, nz, 2);
+		}
 	}
 
-#ifdef USE_AVX512_VECTORIZE
-	__m512i move_right(__m512i tiles) {
-		__m512i lo_16_msk = _mm512_set1_epi32(0xffff);
-		__m512i lo_16 = _mm512_and_si512(lo_16_msk, tiles);
-		__m512i hi_16 = _mm512_srli_epi32(tiles.v, 16);
+#ifdef USE_X86_VECTORIZE
+	__m128i move_right(__m128i tiles) {
+		return (__m128i)move_right_swar((detail::u64x2)tiles);
+	}
 
-		__m512i lo_16_l = _mm512_i32gather_epi32(lo_16, (const int*) mr_lut_32, 4);
-		__m512i hi_16_l = _mm512_i32gather_epi32(hi_16, (const int*) mr_lut_32, 4);
+	__m256i move_right(__m256i tiles) {
+		return (__m256i)move_right_swar((detail::u64x4)tiles);
+	}
 
-		return _mm512_slli_epi32(hi_16_l, 16) | lo_16_l;
+#ifdef USE_AVX512_VECTORIZE
+	__m512i move_right(__m512i tiles) {
+		return (__m512i)move_right_swar((detail::u64x8)tiles);
 	}
 #endif
 
+	__m256i move_all_packed(uint64_t tiles, uint8_t* legal_mask) {
+		uint64_t t = transpose(tiles);
+
+		// Left and up are moves right of the flipped board and transpose
+		__m256i m = move_right(_mm256_set_epi64x(t, flip_h(t), flip_h(tiles), tiles));
+
+		m = _mm256_blend_epi32(m, flip_h(m), 0b0011'1100);  // unflip left and up
+		m = _mm256_blend_epi32(m, transpose(m), 0b1111'0000);  // untranspose up and down
+
+		__m256i same = _mm256_cmpeq_epi64(m, _mm256_set1_epi64x(tiles));
+		*legal_mask = ~_mm256_movemask_pd(_mm256_castsi256_pd(same)) & 0xf;
+
+		return m;
+	}
 #endif
 
 	uint64_t set_tile(uint64_t tiles, uint8_t tile, int idx) {
 		assert(idx >= 0 && idx < 16);
 
 		uint64_t msk = 0xfULL << (4 * idx);
-		return (tiles & ~msk) | ((uint64_t)(tiles & 0xf) << (4 * idx));
+		return (tiles & ~msk) | ((uint64_t)(tile & 0xf) << (4 * idx));
 	}
 
 	uint8_t get_tile(uint64_t tiles, int idx) {
 		assert(idx >= 0 && idx < 16);
 
 		idx *= 4;
-		return (tiles & (0xf << idx)) >> idx;
+		return (tiles & (0xfULL << idx)) >> idx;
 	}
 
-	static const int8_t com_x_weights[16] = {
-		-63, -1, 1, 63, -63, -1, 1, 63, -63, -1, 1, 63, -63, -1, 1, 63
-	};
-
-	static const int8_t com_y_weights[16] = {
-		-63, -63, -63, -63, -1, -1, -1, -1, 1, 1, 1, 1, 63, 63, 63, 63
-	};
+	namespace {
+		// Sum of the four 16-bit fields of v
+		uint64_t fold_16(uint64_t v) {
+			return (v * 0x0001'0001'0001'0001) >> 48;
+		}
+	}
 
 	void compute_center_of_mass(uint64_t tiles, int* com_x, int* com_y) {
-		// Dot product
+		// Weights are -63, -1, 1, 63 from the left (top) edge, so only the column and row sums are needed.
+		// Within a row the even columns sit in the low nibble of each byte, the odd columns in the high nibble.
 
-		*com_x = *com_y = 0;
+		uint64_t lo = tiles & LO_NIBBLES;
+		uint64_t hi = (tiles >> 4) & LO_NIBBLES;
 
-		for (int i = 0; i < 16; ++i) {
-			*com_x += (int32_t)get_tile(tiles, i) * com_x_weights[i];
-			*com_y += (int32_t)get_tile(tiles, i) * com_y_weights[i];
-		}
+		int col[4] = {
+			(int)fold_16(lo & 0x00ff'00ff'00ff'00ff), (int)fold_16(hi & 0x00ff'00ff'00ff'00ff),
+			(int)fold_16((lo >> 8) & 0x00ff'00ff'00ff'00ff), (int)fold_16((hi >> 8) & 0x00ff'00ff'00ff'00ff)
+		};
+
+		uint64_t pairs = lo + hi;  // byte sums, at most 30
+		pairs = (pairs & 0x00ff'00ff'00ff'00ff) + ((pairs >> 8) & 0x00ff'00ff'00ff'00ff);
+
+		int row[4];
+		for (int i = 0; i < 4; ++i) row[i] = (pairs >> (16 * i)) & 0xffff;
+
+		*com_x = 63 * (col[3] - col[0]) + (col[2] - col[1]);
+		*com_y = 63 * (row[3] - row[0]) + (row[2] - row[1]);
 	}
 
 	uint64_t canonical_position(uint64_t tiles) {
@@ -161,65 +228,439 @@ namespace Analysis {
 		// 3. If c_x < 0, flip the position horizontally.
 		// 4. If c_x > c_y, flip the position across the top left-bottom right diagonal.
 		//
-		// There are also the following unlikely cases which are dealt with as branches rather than branchlessly:
-		// If c_y = 0 and c_x != 0:
-		// 	take the lexicographic maximum of the current position and the position flipped vertically
+		// After these steps 0 <= c_x <= c_y, but ties leave some symmetries unresolved. We deal with the following unlikely
+		// cases as branches rather than branchlessly, by taking the lexicographic maximum over the remaining symmetries:
 		// If c_x = 0 and c_y != 0:
-		// 	... horizontally
+		// 	the position and the position flipped horizontally
+		// If c_x = c_y != 0:
+		// 	the position and the position flipped across the diagonal
 		// If c_x = 0 and c_y = 0:
-		// 	take the lexicographic maximum of all rotations (very slow but extremely rare)
+		// 	all eight symmetries (slow but extremely rare)
 		
-		using namespace constants;
-	
 		int com_x, com_y;
 		compute_center_of_mass(tiles, &com_x, &com_y);
 
 		if (com_x < 0) {
-			tiles = shuffle_nibbles(tiles, reflect_h);
+			tiles = flip_h(tiles);
 			com_x *= -1;
 		}
 		if (com_y < 0) {
-			tiles = shuffle_nibbles(tiles, reflect_v);
+			tiles = flip_v(tiles);
 			com_y *= -1;
 		}
 		if (com_x > com_y) {
-			tiles = shuffle_nibbles(tiles, reflect_tl);
+			tiles = transpose(tiles);
 
 			int tmp = com_x;
 			com_x = com_y;
 			com_y = tmp;
 		}
 
-		uint64_t cc = tiles;
-		if (__builtin_expect(com_x == 0, 0)) {
-			if (__builtin_expect(com_y == 0, 0)) {
-				// Try all 8 combinations...
-				// TODO: optimize with SSE
-				tiles = shuffle_nibbles(tiles, reflect_v);
-				tiles = max(tiles, cc);
-				tiles = shuffle_nibbles(tiles, reflect_h);
-				tiles = max(tiles, cc);
-				tiles = shuffle_nibbles(tiles, reflect_v);
-				tiles = max(tiles, cc);
-				tiles = shuffle_nibbles(tiles, reflect_tr);
-				tiles = max(tiles, cc);
-				tiles = shuffle_nibbles(tiles, reflect_h);
-				tiles = max(tiles, cc);
-				tiles = shuffle_nibbles(tiles, reflect_v);
-				tiles = max(tiles, cc);
-				tiles = shuffle_nibbles(tiles, reflect_h);
-				tiles = max(tiles, cc);
+		if (unlikely(com_x == 0)) {
+			if (unlikely(com_y == 0)) {
+				uint64_t h = flip_h(tiles), v = flip_v(tiles), hv = flip_v(h);
+				uint64_t best = max(max(tiles, h), max(v, hv));
+
+				for (uint64_t t : { tiles, h, v, hv }) {
+					best = max(best, transpose(t));
+				}
+
+				tiles = best;
 			} else {
-				tiles = shuffle_nibbles(tiles, reflect_h);	
-				tiles = max(tiles, cc);
+				tiles = max(tiles, flip_h(tiles));
 			}
-		} else if (__builtin_expect(com_y == 0, 0)) {
-			tiles = shuffle_nibbles(tiles, reflect_v);
-
-			tiles = max(tiles, cc);
+		} else if (unlikely(com_x == com_y)) {
+			tiles = max(tiles, transpose(tiles));
 		}
 
 		return tiles;
 	}
-}
 
+	uint64_t apply_symmetry(uint64_t tiles, int sym) {
+		if (sym & 1) tiles = flip_h(tiles);
+		if (sym & 2) tiles = flip_v(tiles);
+		if (sym & 4) tiles = transpose(tiles);
+
+		return tiles;
+	}
+
+	int canonical_symmetry(uint64_t tiles, uint64_t* canonical) {
+		*canonical = canonical_position(tiles);
+
+		int sym = 0;
+		while (apply_symmetry(tiles, sym) != *canonical) ++sym;
+
+		assert(sym < 8);
+		return sym;
+	}
+
+	Direction unapply_symmetry(Direction dir, int sym) {
+		// Undo in reverse order: transpose exchanges right with down and left with up, flip_v up with down and
+		// flip_h left with right
+		int d = dir;
+		if (sym & 4) d ^= 3;
+		if ((sym & 2) && d >= 2) d ^= 1;
+		if ((sym & 1) && d < 2) d ^= 1;
+
+		return (Direction)d;
+	}
+
+#ifdef USE_X86_VECTORIZE
+	// Vectorized canonicalization, following the scalar algorithm above lane by lane. The center of mass is done with
+	// byte SADs and each conditional flip is a blend, so the common case has no branches. The tie cases are blended in
+	// too, except for com_x = com_y = 0, which needs the whole symmetry group and is only computed if some lane needs it.
+	namespace {
+		inline __m256i set1_64(uint64_t v) {
+			return _mm256_set1_epi64x((int64_t)v);
+		}
+
+
+		inline __m256i sad_masked(__m256i x, uint64_t msk) {
+			return _mm256_sad_epu8(_mm256_and_si256(x, set1_64(msk)), _mm256_setzero_si256());
+		}
+
+		// 63 * (hi - lo) + (mid_hi - mid_lo), as in compute_center_of_mass
+		inline __m256i weigh_edges(__m256i lo, __m256i mid_lo, __m256i mid_hi, __m256i hi) {
+			__m256i edge = _mm256_sub_epi64(hi, lo);
+			edge = _mm256_sub_epi64(_mm256_slli_epi64(edge, 6), edge);
+
+			return _mm256_add_epi64(edge, _mm256_sub_epi64(mid_hi, mid_lo));
+		}
+
+		inline void compute_center_of_mass(__m256i tiles, __m256i* com_x, __m256i* com_y) {
+			__m256i lo_msk = set1_64(LO_NIBBLES);
+			__m256i lo = _mm256_and_si256(tiles, lo_msk);
+			__m256i hi = _mm256_and_si256(_mm256_srli_epi64(tiles, 4), lo_msk);
+			__m256i pairs = _mm256_add_epi8(lo, hi);
+
+			*com_x = weigh_edges(sad_masked(lo, 0x00ff'00ff'00ff'00ff), sad_masked(hi, 0x00ff'00ff'00ff'00ff),
+				sad_masked(lo, 0xff00'ff00'ff00'ff00), sad_masked(hi, 0xff00'ff00'ff00'ff00));
+			*com_y = weigh_edges(sad_masked(pairs, 0xffff), sad_masked(pairs, 0xffff'0000),
+				sad_masked(pairs, 0xffff'0000'0000), sad_masked(pairs, 0xffff'0000'0000'0000));
+		}
+
+		inline __m256i select(__m256i msk, __m256i if_set, __m256i if_clear) {
+			return _mm256_blendv_epi8(if_clear, if_set, msk);
+		}
+
+		// Unsigned 64-bit max
+		inline __m256i max_u64(__m256i a, __m256i b) {
+			__m256i sign = set1_64(1ULL << 63);
+			__m256i a_gt = _mm256_cmpgt_epi64(_mm256_xor_si256(a, sign), _mm256_xor_si256(b, sign));
+
+			return select(a_gt, a, b);
+		}
+
+		// Lexicographic maximum over all eight symmetries
+		inline __m256i max_symmetry(__m256i x) {
+			__m256i h = flip_h(x);
+			__m256i v = flip_v(x);
+			__m256i hv = flip_v(h);
+
+			__m256i best = max_u64(max_u64(x, h), max_u64(v, hv));
+			best = max_u64(best, max_u64(transpose(x), transpose(h)));
+
+			return max_u64(best, max_u64(transpose(v), transpose(hv)));
+		}
+	}
+
+	__m256i canonical_position(__m256i tiles) {
+		__m256i com_x, com_y;
+		compute_center_of_mass(tiles, &com_x, &com_y);
+
+		__m256i zero = _mm256_setzero_si256();
+
+		__m256i flip = _mm256_cmpgt_epi64(zero, com_x);
+		tiles = select(flip, flip_h(tiles), tiles);
+		com_x = select(flip, _mm256_sub_epi64(zero, com_x), com_x);
+
+		flip = _mm256_cmpgt_epi64(zero, com_y);
+		tiles = select(flip, flip_v(tiles), tiles);
+		com_y = select(flip, _mm256_sub_epi64(zero, com_y), com_y);
+
+		flip = _mm256_cmpgt_epi64(com_x, com_y);
+		tiles = select(flip, transpose(tiles), tiles);
+		__m256i tmp = select(flip, com_y, com_x);
+		com_y = select(flip, com_x, com_y);
+		com_x = tmp;
+
+		__m256i x_zero = _mm256_cmpeq_epi64(com_x, zero);
+		__m256i y_zero = _mm256_cmpeq_epi64(com_y, zero);
+		__m256i diag = _mm256_cmpeq_epi64(com_x, com_y);
+
+		__m256i result = select(diag, max_u64(tiles, transpose(tiles)), tiles);
+		result = select(x_zero, max_u64(tiles, flip_h(tiles)), result);
+
+		__m256i both_zero = _mm256_and_si256(x_zero, y_zero);
+		if (unlikely(!_mm256_testz_si256(both_zero, both_zero))) {
+			result = select(both_zero, max_symmetry(tiles), result);
+		}
+
+		return result;
+	}
+
+	__m128i canonical_position(__m128i tiles) {
+		// Duplicate into both halves rather than zero-extending, since empty boards would take the slow path
+		return _mm256_castsi256_si128(canonical_position(_mm256_set_m128i(tiles, tiles)));
+	}
+
+#ifdef USE_AVX512_VECTORIZE
+	namespace {
+		inline __m512i set1_64_512(uint64_t v) {
+			return _mm512_set1_epi64((int64_t)v);
+		}
+
+
+		inline __m512i sad_masked(__m512i x, uint64_t msk) {
+			return _mm512_sad_epu8(_mm512_and_si512(x, set1_64_512(msk)), _mm512_setzero_si512());
+		}
+
+		inline __m512i weigh_edges(__m512i lo, __m512i mid_lo, __m512i mid_hi, __m512i hi) {
+			__m512i edge = _mm512_sub_epi64(hi, lo);
+			edge = _mm512_sub_epi64(_mm512_slli_epi64(edge, 6), edge);
+
+			return _mm512_add_epi64(edge, _mm512_sub_epi64(mid_hi, mid_lo));
+		}
+
+		inline void compute_center_of_mass(__m512i tiles, __m512i* com_x, __m512i* com_y) {
+			__m512i lo_msk = set1_64_512(LO_NIBBLES);
+			__m512i lo = _mm512_and_si512(tiles, lo_msk);
+			__m512i hi = _mm512_and_si512(_mm512_srli_epi64(tiles, 4), lo_msk);
+			__m512i pairs = _mm512_add_epi8(lo, hi);
+
+			*com_x = weigh_edges(sad_masked(lo, 0x00ff'00ff'00ff'00ff), sad_masked(hi, 0x00ff'00ff'00ff'00ff),
+				sad_masked(lo, 0xff00'ff00'ff00'ff00), sad_masked(hi, 0xff00'ff00'ff00'ff00));
+			*com_y = weigh_edges(sad_masked(pairs, 0xffff), sad_masked(pairs, 0xffff'0000),
+				sad_masked(pairs, 0xffff'0000'0000), sad_masked(pairs, 0xffff'0000'0000'0000));
+		}
+
+		inline __m512i max_symmetry(__m512i x) {
+			__m512i h = flip_h(x);
+			__m512i v = flip_v(x);
+			__m512i hv = flip_v(h);
+
+			__m512i best = _mm512_max_epu64(_mm512_max_epu64(x, h), _mm512_max_epu64(v, hv));
+			best = _mm512_max_epu64(best, _mm512_max_epu64(transpose(x), transpose(h)));
+
+			return _mm512_max_epu64(best, _mm512_max_epu64(transpose(v), transpose(hv)));
+		}
+	}
+
+	__m512i canonical_position(__m512i tiles) {
+		__m512i com_x, com_y;
+		compute_center_of_mass(tiles, &com_x, &com_y);
+
+		__m512i zero = _mm512_setzero_si512();
+
+		__mmask8 flip = _mm512_cmplt_epi64_mask(com_x, zero);
+		tiles = _mm512_mask_blend_epi64(flip, tiles, flip_h(tiles));
+		com_x = _mm512_abs_epi64(com_x);
+
+		flip = _mm512_cmplt_epi64_mask(com_y, zero);
+		tiles = _mm512_mask_blend_epi64(flip, tiles, flip_v(tiles));
+		com_y = _mm512_abs_epi64(com_y);
+
+		flip = _mm512_cmpgt_epi64_mask(com_x, com_y);
+		tiles = _mm512_mask_blend_epi64(flip, tiles, transpose(tiles));
+		__m512i tmp = _mm512_min_epi64(com_x, com_y);
+		com_y = _mm512_max_epi64(com_x, com_y);
+		com_x = tmp;
+
+		__mmask8 x_zero = _mm512_cmpeq_epi64_mask(com_x, zero);
+		__mmask8 y_zero = _mm512_cmpeq_epi64_mask(com_y, zero);
+		__mmask8 diag = _mm512_cmpeq_epi64_mask(com_x, com_y);
+
+		__m512i result = _mm512_mask_max_epu64(tiles, diag, tiles, transpose(tiles));
+		result = _mm512_mask_max_epu64(result, x_zero, tiles, flip_h(tiles));
+
+		__mmask8 both_zero = x_zero & y_zero;
+		if (unlikely(both_zero)) {
+			result = _mm512_mask_blend_epi64(both_zero, result, max_symmetry(tiles));
+		}
+
+		return result;
+	}
+#endif // USE_AVX512_VECTORIZE
+#endif // USE_X86_VECTORIZE
+
+	void canonical_positions(uint64_t* tiles, int count) {
+#ifndef USE_X86_VECTORIZE
+		dispatch::canonical_positions(tiles, count);
+#else
+		int i = 0;
+
+#ifdef USE_AVX512_VECTORIZE
+		for (; i + 8 <= count; i += 8) {
+			__m512i v = _mm512_loadu_si512(tiles + i);
+			_mm512_storeu_si512(tiles + i, canonical_position(v));
+		}
+#endif
+#ifdef USE_X86_VECTORIZE
+		for (; i + 4 <= count; i += 4) {
+			__m256i v = _mm256_loadu_si256((const __m256i*)(tiles + i));
+			_mm256_storeu_si256((__m256i*)(tiles + i), canonical_position(v));
+		}
+#endif
+
+		for (; i < count; ++i) tiles[i] = canonical_position(tiles[i]);
+#endif
+	}
+
+	// The dispatched kernels below go 8 positions at a time through SWAR code on GCC vectors, which each clone lowers to
+	// its own instruction set. Conditional flips are selects. Lanes whose center of mass is (0, 0) need the whole
+	// symmetry group, and are redone in scalar.
+	namespace {
+		using DispatchV = detail::u64x8;
+		constexpr int DISPATCH_LANES = 8;
+
+		// Sum of the four 16-bit fields of each lane, as in fold_16
+		template <typename V>
+		FORCE_INLINE V fold_16_swar(V v) {
+			v += v >> 32;
+			v += v >> 16;
+
+			return v & 0xffff;
+		}
+
+		template <typename V>
+		FORCE_INLINE V canonical_swar(V tiles, V* both_zero) {
+			using S = decltype(tiles < tiles);  // signed lanes
+			constexpr uint64_t EVEN_BYTES = 0x00ff'00ff'00ff'00ff;
+
+			V lo = tiles & LO_NIBBLES;
+			V hi = (tiles >> 4) & LO_NIBBLES;
+			V pairs = lo + hi;
+			pairs = (pairs & EVEN_BYTES) + ((pairs >> 8) & EVEN_BYTES);
+
+			S col_edge = (S)fold_16_swar((hi >> 8) & EVEN_BYTES) - (S)fold_16_swar(lo & EVEN_BYTES);
+			S col_mid = (S)fold_16_swar((lo >> 8) & EVEN_BYTES) - (S)fold_16_swar(hi & EVEN_BYTES);
+			S row_edge = (S)(pairs >> 48) - (S)(pairs & 0xffff);
+			S row_mid = (S)((pairs >> 32) & 0xffff) - (S)((pairs >> 16) & 0xffff);
+
+			S com_x = (col_edge << 6) - col_edge + col_mid;
+			S com_y = (row_edge << 6) - row_edge + row_mid;
+
+			tiles = com_x < 0 ? detail::flip_h(tiles) : tiles;
+			com_x = com_x < 0 ? -com_x : com_x;
+			tiles = com_y < 0 ? detail::flip_v(tiles) : tiles;
+			com_y = com_y < 0 ? -com_y : com_y;
+
+			S swap = com_x > com_y;
+			tiles = swap ? detail::transpose(tiles) : tiles;
+			S lo_com = swap ? com_y : com_x;
+			S hi_com = swap ? com_x : com_y;
+
+			V t = detail::transpose(tiles), h = detail::flip_h(tiles);
+			V result = lo_com == hi_com ? (t > tiles ? t : tiles) : tiles;
+			result = lo_com == 0 ? (h > tiles ? h : tiles) : result;
+
+			*both_zero = (V)((lo_com == 0) & (hi_com == 0));
+			return result;
+		}
+
+		template <Direction dir>
+		FORCE_INLINE DispatchV move_swar(DispatchV x) {
+			if constexpr (dir == RIGHT) return move_right_swar(x);
+			if constexpr (dir == LEFT) return detail::flip_h(move_right_swar(detail::flip_h(x)));
+			if constexpr (dir == UP) return detail::transpose(detail::flip_h(move_right_swar(detail::flip_h(detail::transpose(x)))));
+			if constexpr (dir == DOWN) return detail::transpose(move_right_swar(detail::transpose(x)));
+		}
+
+		template <Direction dir>
+		FORCE_INLINE void move_positions_swar(const uint64_t* in, uint64_t* out, size_t count) {
+			size_t i = 0;
+			for (; i + DISPATCH_LANES <= count; i += DISPATCH_LANES) {
+				DispatchV x;
+				memcpy(&x, in + i, sizeof(x));
+				x = move_swar<dir>(x);
+				memcpy(out + i, &x, sizeof(x));
+			}
+
+			for (; i < count; ++i) out[i] = move_in_direction(in[i], dir);
+		}
+
+		// Eight boards at a time: output nibble j of a board is in byte j / 2 of either the low or the high nibbles of
+		// the input, so the low and high nibbles of the output are each one two-source byte permute (vpermt2b). Without
+		// VBMI, GCC lowers the permutes byte by byte.
+		FORCE_INLINE void shuffle_positions_permute(const uint64_t* in, uint64_t* out, size_t count, uint64_t idx) {
+			typedef uint8_t u8x64 __attribute__((vector_size(64)));
+
+			u8x64 lo_src, hi_src;
+			for (int j = 0; j < 64; ++j) {
+				int board = j / 8, byte = j % 8;
+				int lo = (idx >> (8 * byte)) & 0xf, hi = (idx >> (8 * byte + 4)) & 0xf;
+
+				lo_src[j] = 8 * board + lo / 2 + 64 * (lo & 1);
+				hi_src[j] = 8 * board + hi / 2 + 64 * (hi & 1);
+			}
+
+			size_t i = 0;
+			for (; i + DISPATCH_LANES <= count; i += DISPATCH_LANES) {
+				DispatchV x;
+				memcpy(&x, in + i, sizeof(x));
+
+				u8x64 lo = (u8x64)(x & LO_NIBBLES), hi = (u8x64)((x >> 4) & LO_NIBBLES);
+				x = (DispatchV)__builtin_shuffle(lo, hi, lo_src) | ((DispatchV)__builtin_shuffle(lo, hi, hi_src) << 4);
+
+				memcpy(out + i, &x, sizeof(x));
+			}
+
+			for (; i < count; ++i) out[i] = shuffle_nibbles(in[i], idx);
+		}
+
+		FORCE_INLINE void shuffle_positions_scalar(const uint64_t* in, uint64_t* out, size_t count, uint64_t idx) {
+			for (size_t i = 0; i < count; ++i) out[i] = shuffle_nibbles(in[i], idx);
+		}
+
+#if defined(ANALYSIS_MULTIVERSIONING)
+		VBMI_TARGET void shuffle_positions_vbmi(const uint64_t* in, uint64_t* out, size_t count, uint64_t idx) {
+			shuffle_positions_permute(in, out, count, idx);
+		}
+#endif
+	}
+
+	namespace dispatch {
+		MULTIVERSIONED void move_positions(const uint64_t* in, uint64_t* out, size_t count, Direction dir) {
+			ANALYSIS_PERF_REGION("dispatch/move_positions");
+
+			switch (dir) {
+				case RIGHT: move_positions_swar<RIGHT>(in, out, count); break;
+				case LEFT: move_positions_swar<LEFT>(in, out, count); break;
+				case UP: move_positions_swar<UP>(in, out, count); break;
+				case DOWN: move_positions_swar<DOWN>(in, out, count); break;
+			}
+		}
+
+		MULTIVERSIONED void canonical_positions(uint64_t* tiles, size_t count) {
+			ANALYSIS_PERF_REGION("dispatch/canonical_positions");
+
+			size_t i = 0;
+			for (; i + DISPATCH_LANES <= count; i += DISPATCH_LANES) {
+				DispatchV x, both_zero;
+				memcpy(&x, tiles + i, sizeof(x));
+				x = canonical_swar(x, &both_zero);
+				memcpy(tiles + i, &x, sizeof(x));
+
+				for (int j = 0; j < DISPATCH_LANES; ++j) {
+					if (unlikely(both_zero[j])) tiles[i + j] = canonical_position(tiles[i + j]);
+				}
+			}
+
+			for (; i < count; ++i) tiles[i] = canonical_position(tiles[i]);
+		}
+
+		void shuffle_positions(const uint64_t* in, uint64_t* out, size_t count, uint64_t idx) {
+			ANALYSIS_PERF_REGION("dispatch/shuffle_positions");
+
+#if defined(ANALYSIS_MULTIVERSIONING)
+			static const bool has_vbmi = detect_cpu_level() >= CpuLevel::VBMI;
+			if (has_vbmi) shuffle_positions_vbmi(in, out, count, idx);
+			else shuffle_positions_scalar(in, out, count, idx);
+#elif defined(USE_VBMI_VECTORIZE)
+			shuffle_positions_permute(in, out, count, idx);
+#else
+			shuffle_positions_scalar(in, out, count, idx);
+#endif
+		}
+	}
+}
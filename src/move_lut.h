@@ -1,33 +1,104 @@
 /**
- * LUTs for moving right. We use two LUTs: One intended for 32-bit vpgatherdd, and one for 16-bit scalar loads.
+ * Moves and canonicalization. Scalar moves go through LUTs of 16-bit rows; the vector overloads compute moves
+ * arithmetically, which beats gathering from the LUT and keeps it out of the cache.
  */
 #pragma once
 
 #include "defs.h"
 #include "shuffle.h"
 
+#include <array>
+
 namespace Analysis {
 	// By convention, the lowest significant nibble is index 0 and corresponds to the top left corner.
 	uint8_t get_tile(uint64_t tiles, int idx);
 	uint64_t set_tile(uint64_t tiles, uint8_t tile, int idx);
 
 	namespace detail {
-		extern uint16_t* move_right_lut16;
-		extern uint32_t* move_right_lut32;
+		// A single row of four nibbles moved right; two 32768s saturate at 32768 rather than carry into the next tile
+		constexpr uint16_t move_right_row(uint16_t row) {
+			uint8_t tt[4] = { (uint8_t)(row & 0xf), (uint8_t)((row >> 4) & 0xf), (uint8_t)((row >> 8) & 0xf), (uint8_t)(row >> 12) };
+			uint8_t out[4] = {};
+
+			// Walk from the right edge, merging each tile with the next one if they match and it hasn't merged yet
+			int w = 3;
+			uint8_t pending = 0;
+
+			for (int i = 3; i >= 0; --i) {
+				if (!tt[i]) continue;
 
-		int generate_move_right_luts();
-		namespace {
-			static int _ = generate_move_right_luts();
+				if (tt[i] == pending) {
+					out[w--] = pending == 15 ? 15 : pending + 1;
+					pending = 0;
+				} else {
+					if (pending) out[w--] = pending;
+					pending = tt[i];
+				}
+			}
+
+			if (pending) out[w] = pending;
+
+			return out[0] | (out[1] << 4) | (out[2] << 8) | (out[3] << 12);
 		}
+
+		// Reverse the order of the four nibbles of a row
+		constexpr uint16_t reverse_row(uint16_t row) {
+			return (row >> 12) | ((row >> 4) & 0xf0) | ((row << 4) & 0xf00) | (row << 12);
+		}
+
+		constexpr uint16_t move_left_row(uint16_t row) {
+			return reverse_row(move_right_row(reverse_row(row)));
+		}
+
+		// Built at compile time into read-only data, page aligned; no startup cost and no pointer to chase.
+		//
+		// With ANALYSIS_COMPACT_MOVE_LUT (CMake option COMPACT_MOVE_LUT) there is no left table: a move left is a move
+		// right of the mirrored rows, costing two flip_h per move but halving the footprint, for when the tables
+		// compete for L2 with a transposition table or a sibling hyperthread.
+		alignas(4096) extern const std::array<uint16_t, 1 << 16> move_right_lut16;
+#ifndef ANALYSIS_COMPACT_MOVE_LUT
+		alignas(4096) extern const std::array<uint16_t, 1 << 16> move_left_lut16;
+#endif
+
+		constexpr size_t MOVE_LUT_BYTES =
+#ifdef ANALYSIS_COMPACT_MOVE_LUT
+			sizeof(uint16_t) << 16;
+#else
+			2 * sizeof(uint16_t) << 16;
+#endif
 	}
 
-	uint64_t move_right(uint64_t tiles);  // All movements reduce to this
+	// Right and left look up each row; up and down are the same lookups on the transposed board, whose rows are the
+	// columns, so no direction needs a nibble shuffle
+	uint64_t move_right(uint64_t tiles);
 	uint64_t move_up(uint64_t tiles);
 	uint64_t move_down(uint64_t tiles);
 	uint64_t move_left(uint64_t tiles);
 
+	// Move directions, in the order used by per-direction result arrays
+	enum Direction : uint8_t {
+		RIGHT = 0, LEFT = 1, UP = 2, DOWN = 3
+	};
+
+	// Two 32768s merge into one 32768, so the only move which changes the tile sum is one such merge, which loses
+	// 32768 of it. Use move_checked (wide_position.h) where that matters.
+	uint64_t move_in_direction(uint64_t tiles, Direction dir);
+
+	// All four moves of a board, indexed by Direction, and the directions which change it as bits of legal_mask
+	struct AllMoves {
+		uint64_t moves[4];
+		uint8_t legal_mask;
+	};
+
+	// Transposes the board once for both up and down
+	AllMoves move_all(uint64_t tiles);
+
 
 #ifdef USE_X86_VECTORIZE
+	// The four moves in the lanes of one vector, in Direction order, by a single vector move right of the four
+	// suitably mirrored boards
+	__m256i move_all_packed(uint64_t tiles, uint8_t* legal_mask);
+
 	__m128i move_right(__m128i tiles);
 	__m256i move_right(__m256i tiles);
 #ifdef USE_AVX512_VECTORIZE
@@ -46,5 +117,25 @@ namespace Analysis {
 
 	// See impl for details
 	uint64_t canonical_position(uint64_t tiles);
+	// Canonicalize count positions in place, with the widest vectors available
+	void canonical_positions(uint64_t* tiles, int count);
+
+	// The eight symmetries of the board, numbered by which of flip_h (bit 0), flip_v (bit 1) and transpose (bit 2) are
+	// applied, in that order
+	uint64_t apply_symmetry(uint64_t tiles, int sym);
+	// A symmetry taking tiles to canonical_position(tiles), which is written to *canonical
+	int canonical_symmetry(uint64_t tiles, uint64_t* canonical);
+	// The move on the original board corresponding to dir on the board after applying sym
+	Direction unapply_symmetry(Direction dir, int sym);
+
+	// Array kernels compiled for several instruction sets, of which the best the CPU supports is picked at load time
+	// (see MULTIVERSIONED). Builds without vector instructions (PORTABLE) use them for batch work; native builds have
+	// the intrinsic versions instead. Results are the same as the scalar functions'.
+	namespace dispatch {
+		void move_positions(const uint64_t* in, uint64_t* out, size_t count, Direction dir);
+		void canonical_positions(uint64_t* tiles, size_t count);
+		// out[i] = shuffle_nibbles(in[i], idx), with a VBMI version
+		void shuffle_positions(const uint64_t* in, uint64_t* out, size_t count, uint64_t idx);
+	}
 	void compute_center_of_mass(uint64_t tiles, int* com_x, int* com_y);
 }
@@ -0,0 +1,168 @@
+/**
+ * Small threading helpers shared by the search and enumeration code.
+ */
+#pragma once
+
+#include "perf.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Analysis {
+	// Number of threads to use when the caller passes 0
+	inline int default_thread_count() {
+		int n = (int)std::thread::hardware_concurrency();
+		return n > 0 ? n : 1;
+	}
+
+	namespace detail {
+		// A thread's entry point, which counts the thread toward the perf regions the caller of spawn_worker is in
+		template <typename W>
+		auto spawn_worker(W& worker) {
+#ifdef ANALYSIS_PERF
+			return [&worker, regions = perf_open_regions()] (auto... args) {
+				PerfWorkerScope scope{ regions };
+				worker(args...);
+			};
+#else
+			return [&worker] (auto... args) { worker(args...); };
+#endif
+		}
+	}
+
+	// Call f(i) for every i in [0, count) using up to threads threads (0 = all cores). Indices are handed out chunk at
+	// a time through a shared atomic counter, so uneven task costs balance themselves. f must be safe to call concurrently.
+	template <typename F>
+	void parallel_for(int64_t count, int threads, F&& f, int64_t chunk=1) {
+		if (threads <= 0) threads = default_thread_count();
+		if (chunk < 1) chunk = 1;
+
+		int64_t chunks = (count + chunk - 1) / chunk;
+		if (threads > chunks) threads = (int)chunks;
+
+		if (threads <= 1) {
+			for (int64_t i = 0; i < count; ++i) f(i);
+			return;
+		}
+
+		std::atomic<int64_t> next{0};
+
+		auto worker = [&] () {
+			while (true) {
+				int64_t start = next.fetch_add(chunk, std::memory_order_relaxed);
+				if (start >= count) break;
+
+				int64_t end = start + chunk < count ? start + chunk : count;
+				for (int64_t i = start; i < end; ++i) f(i);
+			}
+		};
+
+		std::vector<std::thread> pool;
+		pool.reserve(threads - 1);
+
+		for (int t = 1; t < threads; ++t) pool.emplace_back(detail::spawn_worker(worker));
+		worker();
+
+		for (auto& th : pool) th.join();
+	}
+
+	// Call f(worker, i) for every i in [0, count) using up to threads threads (0 = all cores). Each worker starts with
+	// an equal contiguous range and takes chunks from its front; a worker that runs dry steals the back half of the
+	// largest remaining range. worker is in [0, threads), so f can keep per-worker state without locking.
+	template <typename F>
+	void work_stealing_for(int64_t count, int threads, F&& f, int64_t chunk=1) {
+		if (threads <= 0) threads = default_thread_count();
+		if (chunk < 1) chunk = 1;
+
+		int64_t chunks = (count + chunk - 1) / chunk;
+		if (threads > chunks) threads = chunks > 0 ? (int)chunks : 1;
+
+		if (threads <= 1) {
+			for (int64_t i = 0; i < count; ++i) f(0, i);
+			return;
+		}
+
+		struct alignas(64) Range {
+			std::mutex m;
+			int64_t begin, end;
+		};
+
+		std::unique_ptr<Range[]> ranges(new Range[threads]);
+		for (int t = 0; t < threads; ++t) {
+			ranges[t].begin = count * t / threads;
+			ranges[t].end = count * (t + 1) / threads;
+		}
+
+		auto take_own = [&] (int t, int64_t* start, int64_t* end) {
+			std::lock_guard<std::mutex> lock(ranges[t].m);
+			Range& r = ranges[t];
+			if (r.begin >= r.end) return false;
+
+			*start = r.begin;
+			*end = r.begin + chunk < r.end ? r.begin + chunk : r.end;
+			r.begin = *end;
+
+			return true;
+		};
+
+		auto steal = [&] (int t) {
+			// Pick the victim with the most left, then recheck under its lock since it may have moved on
+			int victim = -1;
+			int64_t most = 0;
+			for (int v = 0; v < threads; ++v) {
+				if (v == t) continue;
+
+				std::lock_guard<std::mutex> lock(ranges[v].m);
+				int64_t left = ranges[v].end - ranges[v].begin;
+				if (left > most) {
+					most = left;
+					victim = v;
+				}
+			}
+
+			if (victim < 0) return false;
+
+			int64_t b, e;
+			{
+				std::lock_guard<std::mutex> lock(ranges[victim].m);
+				Range& r = ranges[victim];
+				if (r.begin >= r.end) return true;  // raced; look again
+
+				int64_t mid = r.end - (r.end - r.begin + 1) / 2;
+				b = mid;
+				e = r.end;
+				r.end = mid;
+			}
+
+			std::lock_guard<std::mutex> lock(ranges[t].m);
+			ranges[t].begin = b;
+			ranges[t].end = e;
+
+			return true;
+		};
+
+		auto worker = [&] (int t) {
+			int64_t start, end;
+
+			while (true) {
+				while (take_own(t, &start, &end)) {
+					for (int64_t i = start; i < end; ++i) f(t, i);
+				}
+
+				if (!steal(t)) break;
+			}
+		};
+
+		std::vector<std::thread> pool;
+		pool.reserve(threads - 1);
+
+		for (int t = 1; t < threads; ++t) pool.emplace_back(detail::spawn_worker(worker), t);
+		worker(0);
+
+		for (auto& th : pool) th.join();
+	}
+}
@@ -0,0 +1,314 @@
+#include "perf.h"
+
+#ifdef ANALYSIS_PERF
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace Analysis {
+	const char* perf_counter_name(PerfCounter c) {
+		switch (c) {
+			case PERF_CYCLES: return "cycles";
+			case PERF_INSTRUCTIONS: return "instructions";
+			case PERF_L1D_MISSES: return "l1d_misses";
+			case PERF_L2_MISSES: return "l2_misses";
+			case PERF_LLC_MISSES: return "llc_misses";
+			case PERF_BRANCH_MISSES: return "branch_misses";
+			case PERF_TASK_CLOCK: return "task_clock_ns";
+			default: return "unknown";
+		}
+	}
+
+#ifdef ANALYSIS_PERF
+	namespace {
+		// Totals are allocated a block of regions at a time, so they never move while other threads count into them
+		constexpr int BLOCK_REGIONS = 256;
+		constexpr int MAX_BLOCKS = 4096;
+		constexpr int MAX_REGIONS = BLOCK_REGIONS * MAX_BLOCKS;
+
+		// Takes the counts of every region past the last, rather than failing in the middle of a run
+		const char* const OVERFLOW_REGION = "(other regions)";
+
+		struct RegionTotals {
+			std::atomic<uint64_t> calls{ 0 };
+			std::atomic<uint64_t> counters[PERF_COUNTER_COUNT] = {};
+		};
+
+		std::atomic<RegionTotals*> blocks[MAX_BLOCKS];
+
+		RegionTotals& totals_of(int id) {
+			return blocks[id / BLOCK_REGIONS].load(std::memory_order_acquire)[id % BLOCK_REGIONS];
+		}
+
+		std::mutex registry_mutex;
+		std::vector<std::string> region_names;
+		std::unordered_map<std::string, int> region_ids;
+
+		// Bit c is set once some thread has opened counter c
+		std::atomic<uint32_t> available_mask{ 0 };
+
+		perf_event_attr counter_attr(PerfCounter c) {
+			perf_event_attr a;
+			memset(&a, 0, sizeof(a));
+
+			a.size = sizeof(a);
+			a.type = PERF_TYPE_HARDWARE;
+			a.exclude_kernel = 1;
+			a.exclude_hv = 1;
+			a.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+			auto cache_miss = [] (uint64_t cache) {
+				return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+			};
+
+			switch (c) {
+				case PERF_CYCLES: a.config = PERF_COUNT_HW_CPU_CYCLES; break;
+				case PERF_INSTRUCTIONS: a.config = PERF_COUNT_HW_INSTRUCTIONS; break;
+				case PERF_L1D_MISSES:
+					a.type = PERF_TYPE_HW_CACHE;
+					a.config = cache_miss(PERF_COUNT_HW_CACHE_L1D);
+					break;
+				case PERF_L2_MISSES:
+					a.type = PERF_TYPE_RAW;
+					a.config = 0x3f24;  // L2_RQSTS.MISS on Intel since Skylake
+					break;
+				case PERF_LLC_MISSES:
+					a.type = PERF_TYPE_HW_CACHE;
+					a.config = cache_miss(PERF_COUNT_HW_CACHE_LL);
+					break;
+				case PERF_BRANCH_MISSES: a.config = PERF_COUNT_HW_BRANCH_MISSES; break;
+				case PERF_TASK_CLOCK:
+					a.type = PERF_TYPE_SOFTWARE;
+					a.config = PERF_COUNT_SW_TASK_CLOCK;
+					break;
+				default: break;
+			}
+
+			return a;
+		}
+
+		bool raw_l2_event_valid() {
+#if defined(__x86_64__) && defined(__GNUC__)
+			return __builtin_cpu_is("intel");
+#else
+			return false;
+#endif
+		}
+
+		// One group of counters for the calling thread, read all at once
+		class CounterGroup {
+			int leader = -1;
+			int fds[PERF_COUNTER_COUNT];
+			int slot[PERF_COUNTER_COUNT];  // position in the group's read, or -1 if unavailable
+			int members = 0;
+
+			public:
+			CounterGroup() {
+				for (int c = 0; c < PERF_COUNTER_COUNT; ++c) {
+					fds[c] = slot[c] = -1;
+					if (c == PERF_L2_MISSES && !raw_l2_event_valid()) continue;
+
+					perf_event_attr a = counter_attr((PerfCounter)c);
+					int fd = syscall(SYS_perf_event_open, &a, 0 /* this thread */, -1, leader, 0);
+					if (fd < 0) continue;
+
+					if (leader < 0) leader = fd;
+					fds[c] = fd;
+					slot[c] = members++;
+
+					available_mask.fetch_or(1u << c, std::memory_order_relaxed);
+				}
+			}
+
+			~CounterGroup() {
+				for (int fd : fds) {
+					if (fd >= 0) close(fd);
+				}
+			}
+
+			// Current counts, scaled up if the kernel had to multiplex the group. Unavailable counters read 0.
+			void read_counts(uint64_t* out) const {
+				memset(out, 0, sizeof(uint64_t) * PERF_COUNTER_COUNT);
+				if (leader < 0) return;
+
+				uint64_t buf[3 + PERF_COUNTER_COUNT];
+				if (read(leader, buf, sizeof(buf)) < (ssize_t)(sizeof(uint64_t) * (3 + members))) return;
+
+				uint64_t enabled = buf[1], running = buf[2];
+
+				for (int c = 0; c < PERF_COUNTER_COUNT; ++c) {
+					if (slot[c] < 0) continue;
+
+					uint64_t v = buf[3 + slot[c]];
+					out[c] = (running && running < enabled) ? (uint64_t)((double)v * enabled / running) : v;
+				}
+			}
+		};
+
+		CounterGroup& thread_counters() {
+			thread_local CounterGroup g;
+			return g;
+		}
+
+		// Ids of the regions this thread is in, innermost last
+		thread_local std::vector<int> open_regions;
+
+		void add_counts(int region, const uint64_t* start, const uint64_t* end) {
+			RegionTotals& t = totals_of(region);
+			for (int c = 0; c < PERF_COUNTER_COUNT; ++c) {
+				t.counters[c].fetch_add(end[c] - start[c], std::memory_order_relaxed);
+			}
+		}
+
+		void write_at_exit() {
+			const char* path = getenv("ANALYSIS_PERF_JSON");
+			if (!path) return;
+
+			FILE* f = fopen(path, "w");
+			if (!f) {
+				fprintf(stderr, "Could not write performance counters to %s\n", path);
+				return;
+			}
+
+			write_perf_json(f);
+			fclose(f);
+		}
+
+		struct RegisterAtExit {
+			RegisterAtExit() {
+				if (getenv("ANALYSIS_PERF_JSON")) atexit(write_at_exit);
+			}
+		} register_at_exit;
+	}
+
+	int perf_region_id(const std::string& name) {
+		std::lock_guard lock{ registry_mutex };
+
+		auto it = region_ids.find(name);
+		if (it != region_ids.end()) return it->second;
+
+		int id = region_names.size();
+		if (id >= MAX_REGIONS) return MAX_REGIONS - 1;
+
+		if (id % BLOCK_REGIONS == 0) {
+			blocks[id / BLOCK_REGIONS].store(new RegionTotals[BLOCK_REGIONS], std::memory_order_release);
+		}
+
+		if (id == MAX_REGIONS - 1) {
+			fprintf(stderr, "Over %d performance counter regions; counting the rest as %s\n", id, OVERFLOW_REGION);
+			region_names.push_back(OVERFLOW_REGION);
+			return id;
+		}
+
+		region_names.push_back(name);
+		region_ids.emplace(name, id);
+
+		return id;
+	}
+
+	PerfScope::PerfScope(int region) : region(region) {
+		open_regions.push_back(region);
+		thread_counters().read_counts(start);
+	}
+
+	PerfScope::~PerfScope() {
+		uint64_t end[PERF_COUNTER_COUNT];
+		thread_counters().read_counts(end);
+
+		totals_of(region).calls.fetch_add(1, std::memory_order_relaxed);
+		add_counts(region, start, end);
+
+		open_regions.pop_back();
+	}
+
+	std::vector<int> perf_open_regions() {
+		return open_regions;
+	}
+
+	PerfWorkerScope::PerfWorkerScope(std::vector<int> regions) : regions(std::move(regions)) {
+		// Outside every region, a worker needn't open counters at all
+		if (this->regions.empty()) return;
+
+		open_regions.insert(open_regions.end(), this->regions.begin(), this->regions.end());
+		thread_counters().read_counts(start);
+	}
+
+	PerfWorkerScope::~PerfWorkerScope() {
+		if (regions.empty()) return;
+
+		uint64_t end[PERF_COUNTER_COUNT];
+		thread_counters().read_counts(end);
+
+		for (int region : regions) add_counts(region, start, end);
+
+		open_regions.resize(open_regions.size() - regions.size());
+	}
+
+	PerfTotals perf_region_totals(const std::string& name) {
+		PerfTotals r;
+		int id;
+
+		{
+			std::lock_guard lock{ registry_mutex };
+
+			auto it = region_ids.find(name);
+			if (it == region_ids.end()) return r;
+			id = it->second;
+		}
+
+		const RegionTotals& t = totals_of(id);
+		r.calls = t.calls.load(std::memory_order_relaxed);
+		for (int c = 0; c < PERF_COUNTER_COUNT; ++c) r.counters[c] = t.counters[c].load(std::memory_order_relaxed);
+
+		return r;
+	}
+
+	bool perf_counter_available(PerfCounter c) {
+		thread_counters();  // open this thread's counters, if not already
+		return (available_mask.load(std::memory_order_relaxed) >> c) & 1;
+	}
+
+	void perf_reset() {
+		std::lock_guard lock{ registry_mutex };
+
+		for (size_t id = 0; id < region_names.size(); ++id) {
+			RegionTotals& t = totals_of(id);
+			t.calls = 0;
+			for (auto& c : t.counters) c = 0;
+		}
+	}
+
+	void write_perf_json(FILE* f) {
+		std::lock_guard lock{ registry_mutex };
+		uint32_t available = available_mask.load(std::memory_order_relaxed);
+
+		fprintf(f, "{\n\t\"regions\": [\n");
+
+		for (size_t id = 0; id < region_names.size(); ++id) {
+			const RegionTotals& t = totals_of(id);
+
+			// Region names are ours, and never need escaping
+			fprintf(f, "\t\t{ \"name\": \"%s\", \"calls\": %" PRIu64, region_names[id].c_str(), t.calls.load());
+
+			for (int c = 0; c < PERF_COUNTER_COUNT; ++c) {
+				fprintf(f, ", \"%s\": ", perf_counter_name((PerfCounter)c));
+
+				if ((available >> c) & 1) fprintf(f, "%" PRIu64, t.counters[c].load());
+				else fprintf(f, "null");
+			}
+
+			fprintf(f, " }%s\n", id + 1 < region_names.size() ? "," : "");
+		}
+
+		fprintf(f, "\t]\n}\n");
+	}
+#endif
+}
@@ -0,0 +1,97 @@
+/**
+ * Hardware performance counters per named region, from perf_event_open. Each thread opens one group of counters the
+ * first time it enters a region; a region reads the group on entry and exit and adds the difference to its totals,
+ * which are shared by all threads. Nested regions each count everything inside them, including the threads which
+ * parallel_for and work_stealing_for start inside them: a worker thread counts toward every region its caller is in
+ * for as long as it runs (PerfWorkerScope), so cycles and the task clock are summed over threads. Only the thread
+ * which entered a region adds to its calls.
+ *
+ * A read costs a system call, around a microsecond, so regions belong around batches and phases, not single calls of
+ * kernels which take nanoseconds. Counters the kernel or the machine doesn't provide (virtual machines often have no
+ * PMU at all) are reported as null; the task clock is a software counter and is always there.
+ *
+ * Only compiled in with ANALYSIS_PERF defined (CMake option PERF_COUNTERS); otherwise ANALYSIS_PERF_REGION expands to
+ * nothing. With ANALYSIS_PERF_JSON=path in the environment, the totals are written there as JSON at exit.
+ */
+#pragma once
+
+#include "defs.h"
+
+#include <cinttypes>
+#include <string>
+#include <vector>
+
+namespace Analysis {
+	enum PerfCounter {
+		PERF_CYCLES,
+		PERF_INSTRUCTIONS,
+		PERF_L1D_MISSES,
+		PERF_L2_MISSES,  // no generic event; raw Intel L2_RQSTS.MISS only
+		PERF_LLC_MISSES,
+		PERF_BRANCH_MISSES,
+		PERF_TASK_CLOCK,  // nanoseconds on the CPU
+		PERF_COUNTER_COUNT
+	};
+
+	const char* perf_counter_name(PerfCounter c);
+
+#ifdef ANALYSIS_PERF
+	// Id of the region with this name, registering it on first use
+	int perf_region_id(const std::string& name);
+
+	class PerfScope {
+		int region;
+		uint64_t start[PERF_COUNTER_COUNT];
+
+		public:
+		explicit PerfScope(int region);
+		~PerfScope();
+
+		PerfScope(const PerfScope&) = delete;
+		PerfScope& operator=(const PerfScope&) = delete;
+	};
+
+	// Regions the calling thread is in, its own and those it inherited as a worker, innermost last
+	std::vector<int> perf_open_regions();
+
+	// Counts the rest of a worker thread toward regions its caller is in, without adding calls
+	class PerfWorkerScope {
+		std::vector<int> regions;
+		uint64_t start[PERF_COUNTER_COUNT];
+
+		public:
+		explicit PerfWorkerScope(std::vector<int> regions);
+		~PerfWorkerScope();
+
+		PerfWorkerScope(const PerfWorkerScope&) = delete;
+		PerfWorkerScope& operator=(const PerfWorkerScope&) = delete;
+	};
+
+	struct PerfTotals {
+		uint64_t calls = 0;
+		uint64_t counters[PERF_COUNTER_COUNT] = {};
+	};
+
+	// Totals of a region so far, and whether this thread could open each counter
+	PerfTotals perf_region_totals(const std::string& name);
+	bool perf_counter_available(PerfCounter c);
+
+	void perf_reset();
+	void write_perf_json(FILE* f);
+
+#define ANALYSIS_PERF_CONCAT_(a, b) a##b
+#define ANALYSIS_PERF_CONCAT(a, b) ANALYSIS_PERF_CONCAT_(a, b)
+
+	// Count the rest of the enclosing block under name, a string literal
+#define ANALYSIS_PERF_REGION(name) \
+	static const int ANALYSIS_PERF_CONCAT(_perf_region_, __LINE__) = ::Analysis::perf_region_id(name); \
+	::Analysis::PerfScope ANALYSIS_PERF_CONCAT(_perf_scope_, __LINE__) { ANALYSIS_PERF_CONCAT(_perf_region_, __LINE__) }
+
+	// The same, with a name computed at run time, e.g. per layer
+#define ANALYSIS_PERF_REGION_DYNAMIC(name) \
+	::Analysis::PerfScope ANALYSIS_PERF_CONCAT(_perf_scope_, __LINE__) { ::Analysis::perf_region_id(name) }
+#else
+#define ANALYSIS_PERF_REGION(name)
+#define ANALYSIS_PERF_REGION_DYNAMIC(name)
+#endif
+}
@@ -0,0 +1,106 @@
+#include "perfect_hash.h"
+#include "parallel.h"
+#include "position.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace Analysis {
+	namespace {
+		// Bit of a level's array a hash lands on, by multiplying into the range rather than by modulus
+		uint64_t bit_of(uint64_t hash, uint64_t bits) {
+			return ((unsigned __int128)hash * bits) >> 64;
+		}
+	}
+
+	uint64_t PerfectHash::level_hash(uint64_t key, int level) {
+		return hash_tiles(key + 0x9e37'79b9'7f4a'7c15 * (level + 1));
+	}
+
+	PerfectHash::PerfectHash(const uint64_t* keys, size_t count, int threads, double gamma) {
+		if (threads <= 0) threads = default_thread_count();
+		level_start.push_back(0);
+
+		std::vector<uint64_t> remaining(keys, keys + count);
+		std::vector<uint64_t> seen, collided;
+
+		for (int level = 0; level < MAX_LEVELS && !remaining.empty(); ++level) {
+			uint64_t level_blocks = std::max<uint64_t>(std::ceil(gamma * remaining.size() / BLOCK_BITS), 1);
+			uint64_t level_bits = level_blocks * BLOCK_BITS;
+
+			// Words of the level in order, BLOCK_WORDS to a block; the first bit set by two keys is marked in collided
+			seen.assign(level_blocks * BLOCK_WORDS, 0);
+			collided.assign(level_blocks * BLOCK_WORDS, 0);
+
+			parallel_for(remaining.size(), threads, [&] (int64_t i) {
+				uint64_t b = bit_of(level_hash(remaining[i], level), level_bits);
+				uint64_t bit = 1ULL << (b % 64);
+
+				if (__atomic_fetch_or(&seen[b / 64], bit, __ATOMIC_RELAXED) & bit) {
+					__atomic_fetch_or(&collided[b / 64], bit, __ATOMIC_RELAXED);
+				}
+			}, 4096);
+
+			size_t first = blocks.size();
+			blocks.resize(first + level_blocks);
+
+			for (uint64_t w = 0; w < seen.size(); ++w) {
+				blocks[first + w / BLOCK_WORDS].bits[w % BLOCK_WORDS] = seen[w] & ~collided[w];
+			}
+
+			level_start.push_back(blocks.size());
+
+			// Keys which collided go on, each thread compacting its own contiguous slice
+			std::vector<std::vector<uint64_t>> next(threads);
+			parallel_for(threads, threads, [&] (int64_t t) {
+				size_t begin = remaining.size() * t / threads, end = remaining.size() * (t + 1) / threads;
+
+				for (size_t i = begin; i < end; ++i) {
+					uint64_t b = bit_of(level_hash(remaining[i], level), level_bits);
+					if ((collided[b / 64] >> (b % 64)) & 1) next[t].push_back(remaining[i]);
+				}
+			});
+
+			remaining.clear();
+			for (auto& n : next) remaining.insert(remaining.end(), n.begin(), n.end());
+		}
+
+		for (Block& b : blocks) {
+			b.rank = placed;
+			for (uint64_t w : b.bits) placed += __builtin_popcountll(w);
+		}
+
+		fallback = std::move(remaining);
+		std::sort(fallback.begin(), fallback.end());
+
+		assert(size() == count);
+	}
+
+	size_t PerfectHash::bytes() const {
+		return blocks.size() * sizeof(Block) + (level_start.size() + fallback.size()) * sizeof(uint64_t);
+	}
+
+	uint64_t PerfectHash::operator()(uint64_t key) const {
+		for (size_t level = 0; level + 1 < level_start.size(); ++level) {
+			uint64_t level_bits = (level_start[level + 1] - level_start[level]) * BLOCK_BITS;
+			uint64_t b = bit_of(level_hash(key, level), level_bits);
+
+			const Block& block = blocks[level_start[level] + b / BLOCK_BITS];
+			int word = (b % BLOCK_BITS) / 64;
+			uint64_t bit = 1ULL << (b % 64);
+
+			if (block.bits[word] & bit) {
+				uint64_t rank = block.rank + __builtin_popcountll(block.bits[word] & (bit - 1));
+				for (int w = 0; w < word; ++w) rank += __builtin_popcountll(block.bits[w]);
+
+				return rank;
+			}
+		}
+
+		// Only keys outside the set can miss the fallback too
+		auto it = std::lower_bound(fallback.begin(), fallback.end(), key);
+		if (it == fallback.end()) return 0;
+
+		return placed + (it - fallback.begin());
+	}
+}
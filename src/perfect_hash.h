@@ -0,0 +1,51 @@
+/**
+ * Minimal perfect hashing of a fixed set of 64-bit keys (BBHash: Limasset et al., "Fast and scalable minimal perfect
+ * hashing for massive key sets"). Each level is a bit array gamma times the size of the keys still unplaced; a key
+ * whose hash lands on a bit no other key shares is placed there, and the rest go on to the next level. The index of a
+ * key is the number of placed bits before its own, counted across all levels, so the keys map one to one onto
+ * [0, size()). The few keys left after the last level are kept sorted in a small fallback array.
+ *
+ * The bit arrays are stored in 64-byte blocks of a running count and 448 bits, so the rank of a bit comes from the
+ * one cache line holding it: a lookup costs one cache miss per level it visits, and with gamma = 2 about 80% of keys
+ * are placed in the first two levels. The whole structure is about 3.7 bits per key.
+ *
+ * The index depends only on the set of keys, not their order or the number of threads building it. Keys outside the
+ * set map to arbitrary indices.
+ */
+#pragma once
+
+#include "defs.h"
+
+#include <vector>
+
+namespace Analysis {
+	class PerfectHash {
+		static constexpr int BLOCK_WORDS = 7;
+		static constexpr int BLOCK_BITS = BLOCK_WORDS * 64;
+		static constexpr int MAX_LEVELS = 32;
+
+		struct alignas(64) Block {
+			uint64_t rank;  // placed bits in all earlier blocks
+			uint64_t bits[BLOCK_WORDS];
+		};
+
+		std::vector<Block> blocks;
+		std::vector<uint64_t> level_start;  // first block of each level, and the end of the last
+		std::vector<uint64_t> fallback;  // sorted keys no level placed, indexed after all placed keys
+		uint64_t placed = 0;
+
+		static uint64_t level_hash(uint64_t key, int level);
+
+		public:
+		PerfectHash() = default;
+		// Build over count distinct keys, using up to threads threads (0 = all cores)
+		PerfectHash(const uint64_t* keys, size_t count, int threads=0, double gamma=2.0);
+
+		size_t size() const { return placed + fallback.size(); }
+		size_t bytes() const;
+		bool empty() const { return size() == 0; }
+
+		// Index of a key of the set, in [0, size())
+		uint64_t operator()(uint64_t key) const;
+	};
+}
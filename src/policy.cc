@@ -0,0 +1,244 @@
+#include "policy.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace Analysis {
+	namespace {
+		constexpr char POLICY_MAGIC[8] = { '2', '0', '4', '8', 'P', 'O', 'L', 'Y' };
+		constexpr uint32_t POLICY_VERSION = 1;
+		constexpr uint32_t FLAG_VALUES = 1;
+		constexpr uint64_t ALIGN = 64;
+		constexpr uint64_t SLOTS_PER_KEY = 2;
+		constexpr uint32_t MAX_TILE_SUM = 16 << 15;  // sixteen 32768s
+
+		struct Header {
+			char magic[8];
+			uint32_t version;
+			uint32_t flags;
+			uint32_t layer_count;
+			uint8_t target;
+			uint8_t reserved[3];
+			uint64_t table_offset;
+			uint64_t position_count;
+		};
+
+		// Home slot of a key, by multiplying the hash into the range rather than masking, so the table needn't be a
+		// power of two
+		uint64_t index_slot(uint64_t key, uint64_t slots) {
+			return ((unsigned __int128)hash_tiles(key) * slots) >> 64;
+		}
+
+		// Whether count elements of size bytes from offset lie within a file of file_bytes, without overflowing
+		bool within(uint64_t offset, uint64_t count, uint64_t size, uint64_t file_bytes) {
+			return offset <= file_bytes && count <= (file_bytes - offset) / size;
+		}
+
+		[[noreturn]] void policy_error(const char* what, const std::string& path) {
+			fprintf(stderr, "%s policy file %s\n", what, path.c_str());
+			abort();
+		}
+	}
+
+	PolicyWriter::PolicyWriter(const std::string& path, uint8_t target, bool with_values)
+		: path(path), f(fopen(path.c_str(), "wb")), target(target), with_values(with_values), offset(0) {
+		if (!f) policy_error("Failed to create", path);
+
+		// Placeholder until finish() knows where the table is
+		Header h{};
+		write(&h, sizeof(h));
+		align();
+	}
+
+	PolicyWriter::~PolicyWriter() {
+		if (f) fclose(f);
+	}
+
+	void PolicyWriter::write(const void* data, size_t bytes) {
+		if (fwrite(data, 1, bytes, f) != bytes) policy_error("Failed to write", path);
+		offset += bytes;
+	}
+
+	void PolicyWriter::align() {
+		static const char zeros[ALIGN] = {};
+		write(zeros, (ALIGN - offset % ALIGN) % ALIGN);
+	}
+
+	void PolicyWriter::add_layer(uint32_t tile_sum, const uint64_t* positions, const Direction* best, const float* values, size_t count) {
+		assert(f);
+		if (count == 0) return;
+
+		detail::PolicyLayerEntry e{};
+		e.tile_sum = tile_sum;
+		e.count = count;
+
+		e.keys = offset;
+		write(positions, count * sizeof(uint64_t));
+		align();
+
+		if (count >= UINT32_MAX) {
+			fprintf(stderr, "Layer %u has too many positions for a policy file\n", tile_sum);
+			abort();
+		}
+
+		e.index_slots = count * SLOTS_PER_KEY;
+		std::vector<uint32_t> index(e.index_slots);
+
+		for (size_t i = 0; i < count; ++i) {
+			uint64_t slot = index_slot(positions[i], e.index_slots);
+			while (index[slot]) slot = (slot + 1 == e.index_slots) ? 0 : slot + 1;
+
+			index[slot] = i + 1;
+		}
+
+		e.index = offset;
+		write(index.data(), index.size() * sizeof(uint32_t));
+		align();
+
+		std::vector<uint8_t> packed((count + 3) / 4);
+		for (size_t i = 0; i < count; ++i) packed[i / 4] |= (best[i] & 3) << (2 * (i % 4));
+
+		e.directions = offset;
+		write(packed.data(), packed.size());
+		align();
+
+		if (with_values) {
+			std::vector<uint16_t> quantized(count);
+			for (size_t i = 0; i < count; ++i) {
+				assert(values[i] >= 0 && values[i] <= 1);
+				quantized[i] = (uint16_t)std::lround(values[i] * 65535.0f);
+			}
+
+			e.values = offset;
+			write(quantized.data(), count * sizeof(uint16_t));
+			align();
+		}
+
+		table.push_back(e);
+	}
+
+	void PolicyWriter::finish() {
+		assert(f);
+
+		Header h{};
+		memcpy(h.magic, POLICY_MAGIC, sizeof(h.magic));
+		h.version = POLICY_VERSION;
+		h.flags = with_values ? FLAG_VALUES : 0;
+		h.layer_count = table.size();
+		h.target = target;
+		h.table_offset = offset;
+
+		for (const detail::PolicyLayerEntry& e : table) h.position_count += e.count;
+
+		write(table.data(), table.size() * sizeof(detail::PolicyLayerEntry));
+
+		if (fseek(f, 0, SEEK_SET) != 0 || fwrite(&h, sizeof(h), 1, f) != 1 || fclose(f) != 0) {
+			policy_error("Failed to write", path);
+		}
+
+		f = nullptr;
+	}
+
+	PolicyReader::PolicyReader(const std::string& path, bool populate) {
+		int fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0) policy_error("Failed to open", path);
+
+		struct stat st;
+		if (fstat(fd, &st) != 0) policy_error("Failed to stat", path);
+
+		map_bytes = st.st_size;
+		if (map_bytes < sizeof(Header)) policy_error("Truncated", path);
+
+		map = mmap(nullptr, map_bytes, PROT_READ, MAP_SHARED | (populate ? MAP_POPULATE : 0), fd, 0);
+		close(fd);
+
+		if (map == MAP_FAILED) policy_error("Failed to map", path);
+
+		// Lookups touch a handful of scattered cache lines, for which readahead is wasted
+		if (!populate) madvise(map, map_bytes, MADV_RANDOM);
+
+		const char* base = (const char*)map;
+		Header h;
+		memcpy(&h, base, sizeof(h));
+
+		if (memcmp(h.magic, POLICY_MAGIC, sizeof(h.magic)) != 0 || h.version != POLICY_VERSION) {
+			policy_error("Unrecognized", path);
+		}
+
+		if (!within(h.table_offset, h.layer_count, sizeof(detail::PolicyLayerEntry), map_bytes)) {
+			policy_error("Truncated", path);
+		}
+
+		target_ = h.target;
+		with_values = h.flags & FLAG_VALUES;
+		total = h.position_count;
+
+		const detail::PolicyLayerEntry* table = (const detail::PolicyLayerEntry*)(base + h.table_offset);
+		for (uint32_t i = 0; i < h.layer_count; ++i) {
+			const detail::PolicyLayerEntry& e = table[i];
+			// The index needs an empty slot to end every probe sequence
+			bool valid = e.tile_sum % 2 == 0 && e.tile_sum <= MAX_TILE_SUM && (e.count == 0 || e.index_slots > e.count)
+				&& within(e.keys, e.count, sizeof(uint64_t), map_bytes)
+				&& within(e.index, e.index_slots, sizeof(uint32_t), map_bytes)
+				&& within(e.directions, (e.count + 3) / 4, 1, map_bytes)
+				&& (!with_values || within(e.values, e.count, sizeof(uint16_t), map_bytes));
+
+			if (!valid) policy_error("Corrupt", path);
+
+			size_t li = e.tile_sum / 2;
+			if (li >= layers.size()) layers.resize(li + 1);
+
+			layers[li] = LayerView {
+				.keys = (const uint64_t*)(base + e.keys),
+				.index = (const uint32_t*)(base + e.index),
+				.directions = (const uint8_t*)(base + e.directions),
+				.values = with_values ? (const uint16_t*)(base + e.values) : nullptr,
+				.count = e.count,
+				.index_slots = e.index_slots
+			};
+		}
+	}
+
+	PolicyReader::~PolicyReader() {
+		if (map) munmap(map, map_bytes);
+	}
+
+	bool PolicyReader::lookup(Position p, Direction* best, float* value) const {
+		assert(!value || with_values);
+
+		uint32_t sum = p.tile_sum();
+		if (sum % 2 != 0 || sum / 2 >= layers.size()) return false;
+
+		const LayerView& l = layers[sum / 2];
+		if (l.count == 0) return false;
+
+		uint64_t canonical;
+		int sym = canonical_symmetry(p.tiles, &canonical);
+
+		uint64_t slot = index_slot(canonical, l.index_slots);
+
+		// Only a corrupt index has entries past the keys, or no empty slot to stop at
+		for (uint64_t probe = 0; probe < l.index_slots; ++probe) {
+			uint32_t entry = l.index[slot];
+			if (!entry || entry > l.count) return false;
+
+			size_t idx = entry - 1;
+			if (l.keys[idx] == canonical) {
+				*best = unapply_symmetry((Direction)((l.directions[idx / 4] >> (2 * (idx % 4))) & 3), sym);
+				if (value) *value = l.values[idx] / 65535.0f;
+
+				return true;
+			}
+
+			slot = (slot + 1 == l.index_slots) ? 0 : slot + 1;
+		}
+
+		return false;
+	}
+}
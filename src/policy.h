@@ -0,0 +1,100 @@
+/**
+ * Best-move policy files: the optimal direction of every canonical position of a solved Atlas, two bits each, with an
+ * optional value quantized to 16 bits. PolicyWriter writes one layer at a time in any order, so that a windowed Atlas
+ * can export without holding everything; PolicyReader maps the file read-only, so processes serving from the same file
+ * share one copy in the page cache and there is nothing to load before the first lookup.
+ *
+ * Lookups take any orientation of a position: it is canonicalized, found among the keys of its layer, and the
+ * stored direction is mapped back through the symmetry. A binary search over a whole layer would be a cache miss per
+ * step, and canonical positions are far too clustered to bucket by their leading bits, so each layer also has an
+ * open-addressed hash index of its keys (linear probing, two slots per key). A lookup then touches about one line of
+ * the index, one of keys, and the direction and value.
+ *
+ * The format is native-endian, and laid out as
+ *
+ *   header | per layer: keys (uint64) | index (uint32 key index + 1, or 0 if empty)
+ *          | directions (2 bits, four per byte) | values (uint16) | layer table
+ *
+ * with every array 64-byte aligned. The header points at the layer table, which is written last.
+ */
+#pragma once
+
+#include "defs.h"
+#include "move_lut.h"
+#include "position.h"
+
+#include <string>
+#include <vector>
+
+namespace Analysis {
+	namespace detail {
+		// An entry of the layer table
+		struct PolicyLayerEntry {
+			uint32_t tile_sum;
+			uint32_t reserved;
+			uint64_t count;
+			uint64_t index_slots;
+			uint64_t keys, index, directions, values;  // file offsets; values is 0 without values
+		};
+	}
+
+	class PolicyWriter {
+		std::string path;
+		FILE* f;
+		uint8_t target;
+		bool with_values;
+		std::vector<detail::PolicyLayerEntry> table;
+		uint64_t offset;
+
+		void write(const void* data, size_t bytes);
+		void align();
+
+		public:
+		PolicyWriter(const std::string& path, uint8_t target, bool with_values);
+		~PolicyWriter();
+
+		PolicyWriter(const PolicyWriter&) = delete;
+		PolicyWriter& operator=(const PolicyWriter&) = delete;
+
+		// A layer's canonical positions, in any order, with the best direction of each, and their values (ignored without
+		// values), which must lie in [0, 1]
+		void add_layer(uint32_t tile_sum, const uint64_t* positions, const Direction* best, const float* values, size_t count);
+
+		// Write the layer table and header, and close the file
+		void finish();
+	};
+
+	class PolicyReader {
+		struct LayerView {
+			const uint64_t* keys = nullptr;
+			const uint32_t* index = nullptr;
+			const uint8_t* directions = nullptr;
+			const uint16_t* values = nullptr;
+			size_t count = 0;
+			uint64_t index_slots = 0;
+		};
+
+		void* map = nullptr;
+		size_t map_bytes = 0;
+		uint8_t target_ = 0;
+		bool with_values = false;
+		size_t total = 0;
+		std::vector<LayerView> layers;  // indexed by tile sum / 2
+
+		public:
+		// With populate, read the whole file in while mapping it rather than on first touch of each page
+		explicit PolicyReader(const std::string& path, bool populate=false);
+		~PolicyReader();
+
+		PolicyReader(const PolicyReader&) = delete;
+		PolicyReader& operator=(const PolicyReader&) = delete;
+
+		// Best move from any symmetric variant of a position, and its value if value is given, which needs
+		// has_values(). Returns false if the position isn't in the file. Positions without a legal move store RIGHT.
+		bool lookup(Position p, Direction* best, float* value=nullptr) const;
+
+		bool has_values() const { return with_values; }
+		uint8_t target() const { return target_; }
+		size_t size() const { return total; }
+	};
+}
@@ -23,9 +23,14 @@ namespace Analysis {
 		tiles = 0;
 
 		for (uint32_t i : l) {
-			tiles |= (tile_to_repr(i));
-			tiles = ((tiles & 0xf) << 60) | (tiles >> 4);
+			uint8_t repr = tile_to_repr(i, true);
+			if (repr > 15) {
+				fprintf(stderr, "Tile %u doesn't fit in a Position; use WidePosition\n", i);
+				abort();
+			}
 
+			tiles |= repr;
+			tiles = ((tiles & 0xf) << 60) | (tiles >> 4);
 		}
 	}
 
@@ -102,6 +107,17 @@ namespace Analysis {
 	}
 #endif
 
+#ifdef USE_X86_VECTORIZE
+	__m128i Position::to_sse_bytes() const {
+		return _mm_set_epi64x(_pdep_u64(tiles >> 32, LO_NIBBLES), _pdep_u64(tiles, LO_NIBBLES));
+	}
+
+	Position Position::from_sse_bytes(__m128i a) {
+		return Position{ _pext_u64(_mm_cvtsi128_si64(a), LO_NIBBLES) |
+			(_pext_u64(_mm_extract_epi64(a, 1), LO_NIBBLES) << 32) };
+	}
+#endif
+
 	Position Position::perm(uint64_t nibble_shuffle) {
 		return Position{ shuffle_nibbles(tiles, nibble_shuffle) };
 	}
@@ -140,21 +156,24 @@ namespace Analysis {
 	}
 
 	Position Position::move_left(bool* successful) const {
-		Position p = rotate_180();
-		p = p.move_right(successful);
-		return p.rotate_180();
+		uint64_t new_tiles = ::Analysis::move_left(tiles);
+		*successful = new_tiles != tiles;
+
+		return Position{ new_tiles };
 	}
 
 	Position Position::move_up(bool* successful) const {
-		Position p = rotate_270();
-		p = p.move_right(successful);
-		return p.rotate_90();
+		uint64_t new_tiles = ::Analysis::move_up(tiles);
+		*successful = new_tiles != tiles;
+
+		return Position{ new_tiles };
 	}
 
 	Position Position::move_down(bool* successful) const {
-		Position p = rotate_90();
-		p = p.move_right(successful);
-		return p.rotate_270();
+		uint64_t new_tiles = ::Analysis::move_down(tiles);
+		*successful = new_tiles != tiles;
+
+		return Position{ new_tiles };
 	}
 
 
@@ -214,7 +233,7 @@ namespace Analysis {
 		Position q = identity();
 
 #ifndef __BMI2__
-		uint8_t idxs[15];
+		uint8_t idxs[16];
 		int count;
 		grab_empty_idxs(tiles, idxs, &count);
 
@@ -229,14 +248,14 @@ namespace Analysis {
 		*successful = true;
 #else
 		// BMI2 enjoyer
-		uint64_t m = ~zero_mask_zero_nibbles(tiles);
+		uint64_t m = mask_zero_nibbles(tiles);
 		uint64_t empty_idxs = _pext_u64(0xfedcba9876543210, m);
-		int count = _popcnt_u64(m) >> 2;
+		int count = __builtin_popcountll(m) >> 2;
 
 		if (unlikely(!count)) {
 			*successful = false;
 		} else {
-			int random_zero_idx = empty_idxs >> (4 * (r->next() % count));
+			int random_zero_idx = (empty_idxs >> (4 * (r->next() % count))) & 0xf;
 
 			q.set_tile(random_zero_idx, tile);
 			*successful = true;
@@ -265,6 +284,18 @@ namespace Analysis {
 		return Position{}.set_tile(idx, tile);
 	}
 
+	uint64_t spawn_tile(uint64_t tiles, uint64_t random) {
+		uint64_t m = mask_zero_nibbles(tiles);
+		int count = __builtin_popcountll(m) >> 2;
+		if (!count) return tiles;
+
+		// Peel off the empty squares before the chosen one
+		for (uint64_t k = ((random >> 32) * count) >> 32; k; --k) m &= ~(0xfULL * (m & -m));
+
+		uint64_t lsb = m & -m;
+		return tiles | ((uint32_t)random < SPAWN_FOUR_THRESHOLD ? lsb << 1 : lsb);
+	}
+
 	void Position::gen_next(Position* pp2, Position* pp4,
 				int* pp2p, int* pp4p, int* pp2c, int* pp4c,
 				int* pp2allowed, int*pp4allowed, int* pp2disallowed, int* pp4disallowed) {
@@ -5,9 +5,9 @@
  * in this file. The scalar implementation for Position is found in position.cc. The vector implementation
  * for PositionV is found in position_v.cc.
  *
- * For now, we don't try to handle >32768 tiles. Conceivably we could support some "extended format", or even
- * store things as eight bytes and compress to, say, 80 bits, but that's nontrivial. It also means that
- * positions would have to be processed in 128-bit chunks, halving throughput in some cases. Perhaps later.
+ * Tiles above 32768 live in WidePosition (wide_position.h), one byte per square. The nibble moves saturate at 32768
+ * rather than carrying into the next square; move_checked reports the merges which would overflow, so that the board
+ * can be promoted instead.
  */
 
 #pragma once
@@ -17,11 +17,25 @@
 #include "move_lut.h"
 #include "rng.h"
 #include <array>
+#include <cstring>
+#include <functional>
 
 namespace Analysis {
 	uint32_t repr_to_tile(uint8_t repr);
 	uint8_t tile_to_repr(uint32_t tile, bool validate=false);
 
+	// Mix all 64 bits of a position (murmur3 finalizer). The raw tiles make a poor hash, since most positions only
+	// differ in a few low nibbles and power-of-two tables would just index by the top-left corner.
+	inline uint64_t hash_tiles(uint64_t tiles) {
+		tiles ^= tiles >> 33;
+		tiles *= 0xff51afd7ed558ccdULL;
+		tiles ^= tiles >> 33;
+		tiles *= 0xc4ceb9fe1a85ec53ULL;
+		tiles ^= tiles >> 33;
+
+		return tiles;
+	}
+
 	/**
 	 * Position class containing a single 64-bit entry. Not terribly optimized compared to the vector
 	 * implementation; the latter should be preferred if usable in context. This is more of a reference
@@ -63,8 +77,9 @@ namespace Analysis {
 		Position move_down(bool* successful) const;
 
 #ifdef USE_X86_VECTORIZE
-		__m128i to_sse_bytes();	
-		static from_sse_bytes(__m128i bytes);
+		// One tile per byte
+		__m128i to_sse_bytes() const;
+		static Position from_sse_bytes(__m128i bytes);
 #endif
 
 		char* to_string() const;
@@ -87,6 +102,14 @@ namespace Analysis {
 		static std::array<Position, 32> get_all_starting();	
 	};
 
+	// Spawns are 4s with probability 1/10: low halves of random below this, i.e. 2^32 / 10
+	constexpr uint32_t SPAWN_FOUR_THRESHOLD = 429'496'730;
+
+	// Spawn a tile into one of the empty squares, both chosen by the 64 bits of random: the high half picks the
+	// square uniformly among the empty ones, in index order, and the low half makes it a 4 with probability 1/10.
+	// A full position is returned unchanged.
+	uint64_t spawn_tile(uint64_t tiles, uint64_t random);
+
 	template <int count>
 	constexpr bool can_vectorize = 
 #ifdef USE_X86_VECTORIZE
@@ -100,35 +123,73 @@ namespace Analysis {
 #endif		
 		;
 
+	namespace detail {
+		// Storage of a PositionV: a native vector if vectorizing, otherwise an array
+		template <int count, bool vectorize>
+		struct PositionVTiles {
+			using type = std::array<uint64_t, count>;
+		};
+
+#ifdef USE_X86_VECTORIZE
+		template <> struct PositionVTiles<2, true> { using type = __m128i; };
+		template <> struct PositionVTiles<4, true> { using type = __m256i; };
+#ifdef USE_AVX512_VECTORIZE
+		template <> struct PositionVTiles<8, true> { using type = __m512i; };
+#endif
+#endif
+	}
+
 	/**
 	 * Vector of positions with a given count. 2, 4, or 8 positions may be included if vectorization
 	 * is desired (and the target processor has the requisite instructions).
 	 * 
-	 * We implement both vector and scalar methods in this file.
+	 * Methods come in pairs: the scalar fallback is implemented here, and the vectorized version is declared here and
+	 * implemented in position_v.cc, which instantiates the vectorized widths. Operations which may fail in some
+	 * positions (moves, spawns) report a bitmask with bit i set if position i succeeded.
 	 */
 	template <int _count, bool _vectorize=can_vectorize<_count> >
 	class PositionV {
+		public:
 		constexpr static int count = _count;
 		constexpr static bool vectorize = _vectorize;
 
-		static_assert(_count > 0);
+		static_assert(_count > 0 && _count <= 64);
 		static_assert(!(vectorize && !can_vectorize<count>));
 		
 		private:
 
 		using _VEC_TYPE = std::array<uint64_t, count>;
 
+		template <typename F>
+		PositionV map(F f) const requires (!_vectorize) {
+			PositionV v;
+			for (int i = 0; i < count; ++i) v.tiles[i] = f(tiles[i]);
+
+			return v;
+		}
+
+		// Mask of the positions that differ between a and b
+		static uint64_t changed_mask(const PositionV& a, const PositionV& b) {
+			return ~cmp_mask(a, b) & ALL;
+		}
+
 		public:
 
-#ifdef USE_X86_VECTORIZE
-		using VEC_TYPE = vectorize ? ((count == 2) ? __m128i : ((count == 4) ? __m256i : __m512i)) : _VEC_TYPE;
-#else
-		using VEC_TYPE = _VEC_TYPE;
-#endif
+		using VEC_TYPE = typename detail::PositionVTiles<count, vectorize>::type;
+
+		constexpr static uint64_t ALL = (count == 64) ? ~0ULL : (1ULL << count) - 1;
 
 		VEC_TYPE tiles;
 
-		PositionV();
+		/**
+		 * Implementations used for both scalar and vector
+		 */
+
+		// All empty
+		PositionV() : tiles{} {}
+
+		PositionV(VEC_TYPE tiles) : tiles(tiles) {}
+
 		PositionV(const PositionV& p) {
 			tiles = p.tiles;
 		}
@@ -138,130 +199,247 @@ namespace Analysis {
 			return *this;
 		}
 
-		// Defined below
-#if 0
-		char* to_string() const;
-#endif
+		static PositionV load(const uint64_t* positions) {
+			PositionV p;
+			memcpy(&p.tiles, positions, sizeof(VEC_TYPE));
 
-		// These functions have corresponding vectorized versions
-		PositionV perm(uint64_t nibble_shuffle);
+			return p;
+		}
 
-		VEC_TYPE tile_sum() const;
-		PositionV move_right() const;
-		PositionV canonical() const;
-		Position get_idx(int idx) const;
-		void set_idx(int idx, Position p);
+		static PositionV broadcast(Position p) {
+			PositionV v;
+			for (int i = 0; i < count; ++i) v.set_idx(i, p);
+
+			return v;
+		}
+
+		void store(uint64_t* positions) const {
+			memcpy(positions, &tiles, sizeof(VEC_TYPE));
+		}
+
+		_VEC_TYPE as_array() const {
+			_VEC_TYPE a;
+			store(&a[0]);
+
+			return a;
+		}
+
+		Position get_idx(int idx) const {
+			assert(0 <= idx && idx < count);
+
+			uint64_t t;
+			memcpy(&t, (const char*) &tiles + idx * sizeof(uint64_t), sizeof(uint64_t));
+
+			return Position{ t };
+		}
+
+		void set_idx(int idx, Position p) {
+			assert(0 <= idx && idx < count);
+			memcpy((char*) &tiles + idx * sizeof(uint64_t), &p.tiles, sizeof(uint64_t));
+		}
 
-		/**
-		 * Implementations used for both scalar and vector
-		 */
 		PositionV identity() const {
 			return PositionV { tiles };
 		}
 
-		/**
-		 * Scalar-only implementations
-		 */
+		char* to_string() const {
+			char* ss = (char*)malloc(count * 200);
+			char* w = ss;
+			*w = '\0';
+
+			for (uint64_t t : as_array()) {
+				char* ps = Position{ t }.to_string();
+
+				w = stpcpy(stpcpy(w, ps), "\n");
+
+				free(ps);
+			}
+
+			return ss;
+		}
 
-		PositionV(VEC_TYPE tiles) {
-			this->tiles = tiles;
+		bool operator==(const PositionV& b) const {
+			return cmp_mask(*this, b) == ALL;
 		}
 
-		const _VEC_TYPE as_array() const requires (!vectorize) {
-			return tiles;	
+		bool operator!=(const PositionV& b) const {
+			return !(*this == b);
 		}
 
-		PositionV() requires (!vectorize) {
-			memset(&tiles[0], 0, _count * sizeof(uint64_t));
+		static PositionV start_all() {
+			PositionV p;
+			for (int i = 0; i < count; ++i) {
+				p.set_idx(i, Position::start());
+			}
+			return p;
 		}
 
+		/**
+		 * Vectorized implementations, in position_v.cc
+		 */
+
+		PositionV perm(uint64_t nibble_shuffle) const requires (_vectorize);
+
+		PositionV rotate_90() const requires (_vectorize);
+		PositionV rotate_180() const requires (_vectorize);
+		PositionV rotate_270() const requires (_vectorize);
+		PositionV reflect_h() const requires (_vectorize);
+		PositionV reflect_v() const requires (_vectorize);
+		PositionV reflect_tl() const requires (_vectorize);
+		PositionV reflect_tr() const requires (_vectorize);
+
+		// Each writes the mask of positions which changed to moved, if given
+		PositionV move_right(uint64_t* moved=nullptr) const requires (_vectorize);
+		PositionV move_left(uint64_t* moved=nullptr) const requires (_vectorize);
+		PositionV move_up(uint64_t* moved=nullptr) const requires (_vectorize);
+		PositionV move_down(uint64_t* moved=nullptr) const requires (_vectorize);
+		// All four moves into out, in Direction order, sharing one transpose. moved[d] gets the mask of positions
+		// which direction d changed; returns the mask of positions with any legal move.
+		uint64_t move_all(PositionV* out, uint64_t* moved) const requires (_vectorize);
+
+		PositionV canonical() const requires (_vectorize);
+
+		VEC_TYPE tile_sum() const requires (_vectorize);
+		VEC_TYPE count_empty() const requires (_vectorize);
+
+		// Insert a random 2 or 4 into each position; positions without an empty square are left unchanged
+		PositionV get_next_random(uint64_t* successful=nullptr, Rng* rng=&thread_rng) const requires (_vectorize);
+		// The same, with the spawn in position i chosen by random lane i as in spawn_tile
+		PositionV spawn(VEC_TYPE random, uint64_t* successful=nullptr) const requires (_vectorize);
 
-		PositionV perm(uint64_t nibble_shuffle) const requires (!vectorize) {
+		// Compare positions into mask
+		static uint64_t cmp_mask(const PositionV& p1, const PositionV& p2) requires (_vectorize);
+
+		// Position i from a if bit i of mask is set, otherwise from b
+		static PositionV blend(uint64_t mask, const PositionV& a, const PositionV& b) requires (_vectorize);
+		// Replace the positions in mask by consecutive entries of src, in lane order
+		PositionV expand(uint64_t mask, const uint64_t* src) const requires (_vectorize);
+		// Write the positions in mask consecutively to dst, in lane order. Returns the number written.
+		int compress(uint64_t mask, uint64_t* dst) const requires (_vectorize);
+
+		/**
+		 * Scalar-only implementations
+		 */
+
+		PositionV perm(uint64_t nibble_shuffle) const requires (!_vectorize) {
 			PositionV v;
 
-			fallback::shuffle_nibbles_arr_same(&v.tiles[0], &tiles[0], count, nibble_shuffle);
+			fallback::shuffle_nibbles_arr_same(&tiles[0], nibble_shuffle, &v.tiles[0], count);
 			return v;
 		}
 
-		VEC_TYPE tile_sum() const requires (!vectorize) {
-			VEC_TYPE r;
-
-			for (int i = 0; i < count; ++i)
-				r[i] = tiles[i].tile_sum();	
+#define SCALAR_IMPL_SYM(name, expr)  \
+		PositionV name() const requires (!_vectorize) { \
+			return map([] (uint64_t x) { return expr; }); \
 		}
 
-#define SCALAR_IMPL_PERM(name, constant)  \
-		PositionV name() const requires (!vectorize) { \
-			return perm(constant); \
+		SCALAR_IMPL_SYM(rotate_90, transpose(flip_h(x)))
+		SCALAR_IMPL_SYM(rotate_180, flip_h(flip_v(x)))
+		SCALAR_IMPL_SYM(rotate_270, flip_h(transpose(x)))
+		SCALAR_IMPL_SYM(reflect_h, flip_h(x))
+		SCALAR_IMPL_SYM(reflect_v, flip_v(x))
+		SCALAR_IMPL_SYM(reflect_tl, transpose(x))
+		SCALAR_IMPL_SYM(reflect_tr, transpose(flip_h(flip_v(x))))
+
+#undef SCALAR_IMPL_SYM
+
+#define SCALAR_IMPL_MOVE(name)  \
+		PositionV name(uint64_t* moved=nullptr) const requires (!_vectorize) { \
+			PositionV v = map([] (uint64_t x) { return Analysis::name(x); }); \
+			if (moved) *moved = changed_mask(*this, v); \
+			return v; \
 		}
 
-		SCALAR_IMPL_PERM(rotate_90, constants::rotate_90)
-		SCALAR_IMPL_PERM(rotate_180, constants::rotate_180)
-		SCALAR_IMPL_PERM(rotate_270, constants::rotate_270)
-		SCALAR_IMPL_PERM(reflect_h, constants::reflect_h)
-		SCALAR_IMPL_PERM(reflect_v, constants::reflect_v)
-		SCALAR_IMPL_PERM(reflect_tr, constants::reflect_tr)
-		SCALAR_IMPL_PERM(reflect_tl, constants::reflect_tl)
+		SCALAR_IMPL_MOVE(move_right)
+		SCALAR_IMPL_MOVE(move_left)
+		SCALAR_IMPL_MOVE(move_up)
+		SCALAR_IMPL_MOVE(move_down)
 
-#undef SCALAR_IMPL_PERM
+#undef SCALAR_IMPL_MOVE
 
-		PositionV move_right() const requires (!vectorize) {
-			VEC_TYPE a;
+		uint64_t move_all(PositionV* out, uint64_t* moved) const requires (!_vectorize) {
+			uint64_t any = 0;
+			for (int d = 0; d < 4; ++d) moved[d] = 0;
 
-			for (int i = 0; i < count; ++i)
-				a[i] = Analysis::move_right(tiles[i]);
+			for (int i = 0; i < count; ++i) {
+				AllMoves m = Analysis::move_all(tiles[i]);
 
-			return a;
+				for (int d = 0; d < 4; ++d) {
+					out[d].tiles[i] = m.moves[d];
+					moved[d] |= (uint64_t)((m.legal_mask >> d) & 1) << i;
+				}
+
+				any |= (uint64_t)(m.legal_mask != 0) << i;
+			}
+
+			return any;
 		}
 
-		Position get_idx(int idx) const requires (!vectorize) {
-			assert(0 <= idx && idx < count);
-			return tiles[idx];
+		PositionV canonical() const requires (!_vectorize) {
+			return map([] (uint64_t x) { return canonical_position(x); });
 		}
 
-		void set_idx(int idx, Position p) requires (!vectorize) {
-			assert(0 <= idx && idx < count);
+		VEC_TYPE tile_sum() const requires (!_vectorize) {
+			return map([] (uint64_t x) -> uint64_t { return Analysis::tile_sum(x); }).tiles;
+		}
 
-			tiles[idx] = p.tiles;
+		VEC_TYPE count_empty() const requires (!_vectorize) {
+			return map([] (uint64_t x) -> uint64_t { return Analysis::count_empty(x); }).tiles;
 		}
 
-		char* to_string() const {
-			char* ss = (char*)malloc(count * 200);
-			char* w = ss;
+		PositionV get_next_random(uint64_t* successful=nullptr, Rng* rng=&thread_rng) const requires (!_vectorize) {
+			PositionV v;
+			uint64_t ok = 0;
 
-			for (const Position& p : as_array()) {
-				char* ps = p.to_string();
+			for (int i = 0; i < count; ++i) {
+				bool s;
+				v.tiles[i] = Position{ tiles[i] }.get_next_random(&s, rng).tiles;
+				ok |= (uint64_t)s << i;
+			}
 
-				w = stpcpy(stpcpy(w, ps), "\n");
+			if (successful) *successful = ok;
+			return v;
+		}
 
-				free(ps);
-			}
+		static uint64_t cmp_mask(const PositionV& p1, const PositionV& p2) requires (!_vectorize) {
+			uint64_t m = 0;
+			for (int i = 0; i < count; ++i) m |= (uint64_t)(p1.tiles[i] == p2.tiles[i]) << i;
 
-			return ss;
+			return m;
 		}
 
-		PositionV get_next_random(Rng* rng=nullptr) requires (!vectorize) {
-			return *this;
+		PositionV spawn(VEC_TYPE random, uint64_t* successful=nullptr) const requires (!_vectorize) {
+			PositionV v;
+			for (int i = 0; i < count; ++i) v.tiles[i] = spawn_tile(tiles[i], random[i]);
+
+			if (successful) *successful = changed_mask(*this, v);
+			return v;
 		}
 
-		static PositionV start_all() requires (!vectorize) {
-			PositionV p;
+		static PositionV blend(uint64_t mask, const PositionV& a, const PositionV& b) requires (!_vectorize) {
+			PositionV v;
+			for (int i = 0; i < count; ++i) v.tiles[i] = ((mask >> i) & 1) ? a.tiles[i] : b.tiles[i];
+
+			return v;
+		}
+
+		PositionV expand(uint64_t mask, const uint64_t* src) const requires (!_vectorize) {
+			PositionV v = *this;
 			for (int i = 0; i < count; ++i) {
-				p.tiles[i] = Position::start().tiles;
+				if ((mask >> i) & 1) v.tiles[i] = *src++;
 			}
-			return p;
-		}
 
-		// Compare positions into mask
-		static uint64_t cmp_mask(const PositionV& p1, const PositionV& p2) requires (count <= 64) {
-			return 0;
+			return v;
 		}
 
-#ifdef USE_X86_VECTORIZE
-		static uint64_t cmp_mask(const PositionV& p1, const PositionV& p2) requires (vectorize) {
-			return cmp64_to_mask(p1.tiles, p2.tiles);
+		int compress(uint64_t mask, uint64_t* dst) const requires (!_vectorize) {
+			int w = 0;
+			for (int i = 0; i < count; ++i) {
+				if ((mask >> i) & 1) dst[w++] = tiles[i];
+			}
+
+			return w;
 		}
-#endif
 
 #if 0
 #ifdef USE_X86_VECTORIZE
@@ -323,13 +501,17 @@ namespace Analysis {
 #endif
 	};
 
+	// Instantiated in position_v.cc
+	extern template class PositionV<2>;
+	extern template class PositionV<4>;
+	extern template class PositionV<8>;
 }
 
 		namespace std {
 		    template <>
 		    struct hash<Analysis::Position> {
 			size_t operator ()(Analysis::Position p) const {
-			    return p.tiles;
+			    return Analysis::hash_tiles(p.tiles);
 			}
 		    };
 		}
@@ -0,0 +1,147 @@
+#include "position_batch.h"
+#include "perf.h"
+
+#include <cstring>
+
+namespace Analysis {
+	namespace {
+		using PV = PositionV<BATCH_WIDTH>;
+
+		// Call vec(i) on each full block of BATCH_WIDTH positions starting at i, then scalar(i) on the leftovers
+		template <typename Vec, typename Scalar>
+		void for_each_block(size_t count, Vec&& vec, Scalar&& scalar) {
+			size_t i = 0;
+			for (; i + BATCH_WIDTH <= count; i += BATCH_WIDTH) vec(i);
+			for (; i < count; ++i) scalar(i);
+		}
+
+		std::array<uint64_t, BATCH_WIDTH> lanes(const PV::VEC_TYPE& v) {
+			std::array<uint64_t, BATCH_WIDTH> a;
+			memcpy(&a[0], &v, sizeof(a));
+
+			return a;
+		}
+
+		template <Direction dir>
+		PV move_v(const PV& v, uint64_t* moved) {
+			if constexpr (dir == RIGHT) return v.move_right(moved);
+			if constexpr (dir == LEFT) return v.move_left(moved);
+			if constexpr (dir == UP) return v.move_up(moved);
+			if constexpr (dir == DOWN) return v.move_down(moved);
+		}
+
+		// BATCH_WIDTH divides 64 and blocks start at multiples of it, so a block's mask never straddles two words
+		template <Direction dir>
+		void move_batch(const uint64_t* in, uint64_t* out, size_t count, uint64_t* moved) {
+			if constexpr (!PV::vectorize) {
+				// No vector instructions compiled in, but the CPU may still have some
+				dispatch::move_positions(in, out, count, dir);
+
+				if (moved) {
+					for (size_t i = 0; i < count; ++i) moved[i / 64] |= (uint64_t)(out[i] != in[i]) << (i % 64);
+				}
+
+				return;
+			}
+
+			for_each_block(count, [&] (size_t i) {
+				uint64_t m;
+				move_v<dir>(PV::load(in + i), &m).store(out + i);
+
+				if (moved) moved[i / 64] |= m << (i % 64);
+			}, [&] (size_t i) {
+				out[i] = move_in_direction(in[i], dir);
+
+				if (moved) moved[i / 64] |= (uint64_t)(out[i] != in[i]) << (i % 64);
+			});
+		}
+	}
+
+	PositionBatch PositionBatch::move(Direction dir, std::vector<uint64_t>* moved) const {
+		ANALYSIS_PERF_REGION("batch/move");
+		PositionBatch out(size());
+		uint64_t* m = nullptr;
+
+		if (moved) {
+			moved->assign(batch_mask_words(size()), 0);
+			m = moved->data();
+		}
+
+		switch (dir) {
+			case RIGHT: move_batch<RIGHT>(data(), out.data(), size(), m); break;
+			case LEFT: move_batch<LEFT>(data(), out.data(), size(), m); break;
+			case UP: move_batch<UP>(data(), out.data(), size(), m); break;
+			case DOWN: move_batch<DOWN>(data(), out.data(), size(), m); break;
+		}
+
+		return out;
+	}
+
+	void PositionBatch::canonicalize() {
+		ANALYSIS_PERF_REGION("batch/canonicalize");
+		uint64_t* t = data();
+
+		if constexpr (!PV::vectorize) {
+			dispatch::canonical_positions(t, size());
+			return;
+		}
+
+		for_each_block(size(), [&] (size_t i) {
+			PV::load(t + i).canonical().store(t + i);
+		}, [&] (size_t i) {
+			t[i] = canonical_position(t[i]);
+		});
+	}
+
+	void PositionBatch::tile_sums(uint32_t* out) const {
+		const uint64_t* t = data();
+
+		for_each_block(size(), [&] (size_t i) {
+			auto s = lanes(PV::load(t + i).tile_sum());
+			for (int j = 0; j < BATCH_WIDTH; ++j) out[i + j] = s[j];
+		}, [&] (size_t i) {
+			out[i] = tile_sum(t[i]);
+		});
+	}
+
+	void PositionBatch::count_empty(uint8_t* out) const {
+		const uint64_t* t = data();
+
+		for_each_block(size(), [&] (size_t i) {
+			auto c = lanes(PV::load(t + i).count_empty());
+			for (int j = 0; j < BATCH_WIDTH; ++j) out[i + j] = c[j];
+		}, [&] (size_t i) {
+			out[i] = Analysis::count_empty(t[i]);
+		});
+	}
+
+	void PositionBatch::spawns(PositionBatch& twos, PositionBatch& fours, std::vector<size_t>& offsets) const {
+		ANALYSIS_PERF_REGION("batch/spawns");
+		size_t n = size();
+
+		std::vector<uint8_t> empty(n);
+		count_empty(empty.data());
+
+		offsets.resize(n + 1);
+		offsets[0] = 0;
+		for (size_t i = 0; i < n; ++i) offsets[i + 1] = offsets[i] + empty[i];
+
+		twos.tiles.resize(offsets[n]);
+		fours.tiles.resize(offsets[n]);
+
+		uint64_t* w2 = twos.data();
+		uint64_t* w4 = fours.data();
+
+		for (size_t i = 0; i < n; ++i) {
+			uint64_t t = tiles[i];
+
+			// Four bits per empty square; peel them off from the top left
+			for (uint64_t m = mask_zero_nibbles(t); m; m &= ~(0xfULL * (m & -m))) {
+				uint64_t lsb = m & -m;
+
+				*w2++ = t | lsb;
+				*w4++ = t | (lsb << 1);
+			}
+		}
+	}
+}
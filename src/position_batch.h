@@ -0,0 +1,96 @@
+/**
+ * Structure-of-arrays container for bulk operations on many positions at once. The tiles live in one contiguous,
+ * cache-line aligned array; each operation runs the widest PositionV the target supports over the bulk of it and
+ * finishes the tail lanes with the scalar functions. Results which may fail per position (moves) come back as
+ * bitmasks with one bit per position, packed into 64-bit words, instead of one bool out-param per call.
+ */
+#pragma once
+
+#include "defs.h"
+#include "position.h"
+#include "move_lut.h"
+
+#include <new>
+#include <vector>
+
+namespace Analysis {
+	template <typename T, size_t Align = 64>
+	struct AlignedAllocator {
+		using value_type = T;
+
+		template <typename U>
+		struct rebind { using other = AlignedAllocator<U, Align>; };
+
+		AlignedAllocator() = default;
+
+		template <typename U>
+		AlignedAllocator(const AlignedAllocator<U, Align>&) {}
+
+		T* allocate(size_t n) {
+			return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(Align)));
+		}
+
+		void deallocate(T* p, size_t) {
+			::operator delete(p, std::align_val_t(Align));
+		}
+
+		template <typename U>
+		bool operator==(const AlignedAllocator<U, Align>&) const { return true; }
+		template <typename U>
+		bool operator!=(const AlignedAllocator<U, Align>&) const { return false; }
+	};
+
+	// Widest PositionV used by the batch kernels
+	constexpr int BATCH_WIDTH = can_vectorize<8> ? 8 : 4;
+
+	// Words needed for a mask with one bit per position
+	inline size_t batch_mask_words(size_t count) {
+		return (count + 63) / 64;
+	}
+
+	inline bool batch_mask_test(const uint64_t* mask, size_t i) {
+		return (mask[i / 64] >> (i % 64)) & 1;
+	}
+
+	class PositionBatch {
+	public:
+		using Storage = std::vector<uint64_t, AlignedAllocator<uint64_t>>;
+
+	private:
+		Storage tiles;
+
+	public:
+		PositionBatch() = default;
+		explicit PositionBatch(size_t count) : tiles(count, 0) {}
+		PositionBatch(const uint64_t* positions, size_t count) : tiles(positions, positions + count) {}
+
+		size_t size() const { return tiles.size(); }
+		bool empty() const { return tiles.empty(); }
+
+		uint64_t* data() { return tiles.data(); }
+		const uint64_t* data() const { return tiles.data(); }
+
+		Position get_idx(size_t idx) const { return Position{ tiles[idx] }; }
+		void set_idx(size_t idx, Position p) { tiles[idx] = p.tiles; }
+
+		void push_back(Position p) { tiles.push_back(p.tiles); }
+		void reserve(size_t count) { tiles.reserve(count); }
+		void resize(size_t count) { tiles.resize(count, 0); }
+		void clear() { tiles.clear(); }
+
+		// Every position moved in the given direction. If moved is given, it is resized to batch_mask_words(size())
+		// and bit i is set if position i changed.
+		PositionBatch move(Direction dir, std::vector<uint64_t>* moved=nullptr) const;
+
+		// Canonicalize every position in place
+		void canonicalize();
+
+		// out must hold size() entries
+		void tile_sums(uint32_t* out) const;
+		void count_empty(uint8_t* out) const;
+
+		// Every way to spawn a 2 (into twos) or a 4 (into fours) in each position, in the order of
+		// Position::gen_new_tiles. The spawns of position i are [offsets[i], offsets[i + 1]) in both outputs.
+		void spawns(PositionBatch& twos, PositionBatch& fours, std::vector<size_t>& offsets) const;
+	};
+}
@@ -1,13 +1,273 @@
-
 #include "position.h"
 
-// Implementation of the vectorized versions of position for 2, 4, and 8 elements
+// Implementation of the vectorized versions of position for 2, 4, and 8 elements. Each method is written once
+// against the __m128i/__m256i/__m512i overloads in shuffle.h and move_lut.h, and instantiated for whichever widths the
+// target supports.
 
 namespace Analysis {
+	namespace {
+		template <int N> struct Swar;
 
-}
+#ifdef USE_X86_VECTORIZE
+		template <> struct Swar<2> { using type = detail::u64x2; };
+		template <> struct Swar<4> { using type = detail::u64x4; };
+#ifdef USE_AVX512_VECTORIZE
+		template <> struct Swar<8> { using type = detail::u64x8; };
+#endif
+
+		constexpr uint64_t NIBBLE_LSB = 0x1111'1111'1111'1111;
+
+		// spawn_tile, without branches. Counting the empty squares up to and including each nibble gives every empty
+		// square a distinct number 1 to 16 (mod 16, so a full 16 wraps to 0 and carries out of the word); the chosen
+		// square is the empty one whose count is k + 1.
+		template <typename V>
+		V spawn_swar(V tiles, V random) {
+			V full = (tiles | (tiles >> 1) | (tiles >> 2) | (tiles >> 3)) & NIBBLE_LSB;
+			V empty = full ^ NIBBLE_LSB;
+
+			V prefix = empty + (empty << 4);
+			prefix += prefix << 8;
+			prefix += prefix << 16;
+			prefix += prefix << 32;
+
+			V count = prefix >> 60;
+			count += (V)((empty != 0) & (count == 0)) & 16;
+
+			V target = ((((random >> 32) * count) >> 32) + 1) & 0xf;
+			target |= target << 4;
+			target |= target << 8;
+			target |= target << 16;
+			target |= target << 32;
+
+			V diff = prefix ^ target;
+			V chosen = ~(diff | (diff >> 1) | (diff >> 2) | (diff >> 3)) & empty;
+
+			V four = (V)((random & 0xffff'ffff) < SPAWN_FOUR_THRESHOLD);
+			return tiles | (chosen + (chosen & four));
+		}
+
+		__m128i blend_lanes(uint64_t mask, __m128i a, __m128i b) {
+#ifdef USE_AVX512_VECTORIZE
+			return _mm_mask_blend_epi64(mask, b, a);
+#else
+			__m128i bits = _mm_set_epi64x(2, 1);
+			__m128i sel = _mm_cmpeq_epi64(_mm_and_si128(_mm_set1_epi64x(mask), bits), bits);
+
+			return _mm_blendv_epi8(b, a, sel);
+#endif
+		}
+
+		__m256i blend_lanes(uint64_t mask, __m256i a, __m256i b) {
+#ifdef USE_AVX512_VECTORIZE
+			return _mm256_mask_blend_epi64(mask, b, a);
+#else
+			__m256i bits = _mm256_set_epi64x(8, 4, 2, 1);
+			__m256i sel = _mm256_cmpeq_epi64(_mm256_and_si256(_mm256_set1_epi64x(mask), bits), bits);
+
+			return _mm256_blendv_epi8(b, a, sel);
+#endif
+		}
+
+#ifdef USE_AVX512_VECTORIZE
+		__m512i blend_lanes(uint64_t mask, __m512i a, __m512i b) {
+			return _mm512_mask_blend_epi64(mask, b, a);
+		}
+
+		__m128i expand_lanes(uint64_t mask, __m128i a, const uint64_t* src) {
+			return _mm_mask_expandloadu_epi64(a, mask, src);
+		}
+
+		__m256i expand_lanes(uint64_t mask, __m256i a, const uint64_t* src) {
+			return _mm256_mask_expandloadu_epi64(a, mask, src);
+		}
+
+		__m512i expand_lanes(uint64_t mask, __m512i a, const uint64_t* src) {
+			return _mm512_mask_expandloadu_epi64(a, mask, src);
+		}
+
+		void compress_lanes(uint64_t mask, __m128i a, uint64_t* dst) {
+			_mm_mask_compressstoreu_epi64(dst, mask, a);
+		}
+
+		void compress_lanes(uint64_t mask, __m256i a, uint64_t* dst) {
+			_mm256_mask_compressstoreu_epi64(dst, mask, a);
+		}
+
+		void compress_lanes(uint64_t mask, __m512i a, uint64_t* dst) {
+			_mm512_mask_compressstoreu_epi64(dst, mask, a);
+		}
+#else // USE_AVX512_VECTORIZE
+		// Without AVX-512 there's no compress or expand; refills are rare enough that going lane by lane is fine
+		template <typename V>
+		V expand_lanes(uint64_t mask, V a, const uint64_t* src) {
+			uint64_t lanes[sizeof(V) / 8];
+			memcpy(lanes, &a, sizeof(V));
+
+			for (int i = 0; i < (int)(sizeof(V) / 8); ++i) {
+				if ((mask >> i) & 1) lanes[i] = *src++;
+			}
+
+			memcpy(&a, lanes, sizeof(V));
+			return a;
+		}
+
+		template <typename V>
+		void compress_lanes(uint64_t mask, V a, uint64_t* dst) {
+			uint64_t lanes[sizeof(V) / 8];
+			memcpy(lanes, &a, sizeof(V));
+
+			for (int i = 0; i < (int)(sizeof(V) / 8); ++i) {
+				if ((mask >> i) & 1) *dst++ = lanes[i];
+			}
+		}
+#endif // USE_AVX512_VECTORIZE
+#endif // USE_X86_VECTORIZE
+	}
+
+	template <int N, bool vec>
+	PositionV<N, vec> PositionV<N, vec>::perm(uint64_t nibble_shuffle) const requires (vec) {
+		return PositionV{ shuffle_nibbles_same(tiles, nibble_shuffle) };
+	}
+
+	// Every symmetry is a composition of the three cheap generators; see shuffle.h
+	template <int N, bool vec>
+	PositionV<N, vec> PositionV<N, vec>::rotate_90() const requires (vec) {
+		return PositionV{ transpose(flip_h(tiles)) };
+	}
+
+	template <int N, bool vec>
+	PositionV<N, vec> PositionV<N, vec>::rotate_180() const requires (vec) {
+		return PositionV{ flip_h(flip_v(tiles)) };
+	}
+
+	template <int N, bool vec>
+	PositionV<N, vec> PositionV<N, vec>::rotate_270() const requires (vec) {
+		return PositionV{ flip_h(transpose(tiles)) };
+	}
 
-// Explicitly instantiate allowed vectorized templates
-template class PositionV<2>;
-template class PositionV<4>;
-template class PositionV<8>;
+	template <int N, bool vec>
+	PositionV<N, vec> PositionV<N, vec>::reflect_h() const requires (vec) {
+		return PositionV{ flip_h(tiles) };
+	}
+
+	template <int N, bool vec>
+	PositionV<N, vec> PositionV<N, vec>::reflect_v() const requires (vec) {
+		return PositionV{ flip_v(tiles) };
+	}
+
+	template <int N, bool vec>
+	PositionV<N, vec> PositionV<N, vec>::reflect_tl() const requires (vec) {
+		return PositionV{ transpose(tiles) };
+	}
+
+	template <int N, bool vec>
+	PositionV<N, vec> PositionV<N, vec>::reflect_tr() const requires (vec) {
+		return PositionV{ transpose(flip_h(flip_v(tiles))) };
+	}
+
+	// Moves in other directions conjugate a move right by a symmetry that is its own inverse
+	template <int N, bool vec>
+	PositionV<N, vec> PositionV<N, vec>::move_right(uint64_t* moved) const requires (vec) {
+		PositionV v{ Analysis::move_right(tiles) };
+		if (moved) *moved = changed_mask(*this, v);
+
+		return v;
+	}
+
+	template <int N, bool vec>
+	PositionV<N, vec> PositionV<N, vec>::move_left(uint64_t* moved) const requires (vec) {
+		PositionV v{ flip_h(Analysis::move_right(flip_h(tiles))) };
+		if (moved) *moved = changed_mask(*this, v);
+
+		return v;
+	}
+
+	template <int N, bool vec>
+	PositionV<N, vec> PositionV<N, vec>::move_up(uint64_t* moved) const requires (vec) {
+		PositionV v{ transpose(flip_h(Analysis::move_right(flip_h(transpose(tiles))))) };
+		if (moved) *moved = changed_mask(*this, v);
+
+		return v;
+	}
+
+	template <int N, bool vec>
+	PositionV<N, vec> PositionV<N, vec>::move_down(uint64_t* moved) const requires (vec) {
+		PositionV v{ transpose(Analysis::move_right(transpose(tiles))) };
+		if (moved) *moved = changed_mask(*this, v);
+
+		return v;
+	}
+
+	template <int N, bool vec>
+	uint64_t PositionV<N, vec>::move_all(PositionV* out, uint64_t* moved) const requires (vec) {
+		VEC_TYPE t = transpose(tiles);
+
+		out[RIGHT] = PositionV{ Analysis::move_right(tiles) };
+		out[LEFT] = PositionV{ flip_h(Analysis::move_right(flip_h(tiles))) };
+		out[UP] = PositionV{ transpose(flip_h(Analysis::move_right(flip_h(t)))) };
+		out[DOWN] = PositionV{ transpose(Analysis::move_right(t)) };
+
+		uint64_t any = 0;
+		for (int d = 0; d < 4; ++d) any |= moved[d] = changed_mask(*this, out[d]);
+
+		return any;
+	}
+
+	template <int N, bool vec>
+	PositionV<N, vec> PositionV<N, vec>::canonical() const requires (vec) {
+		return PositionV{ canonical_position(tiles) };
+	}
+
+	template <int N, bool vec>
+	typename PositionV<N, vec>::VEC_TYPE PositionV<N, vec>::tile_sum() const requires (vec) {
+		return Analysis::tile_sum(tiles);
+	}
+
+	template <int N, bool vec>
+	typename PositionV<N, vec>::VEC_TYPE PositionV<N, vec>::count_empty() const requires (vec) {
+		return Analysis::count_empty(tiles);
+	}
+
+	template <int N, bool vec>
+	PositionV<N, vec> PositionV<N, vec>::get_next_random(uint64_t* successful, Rng* rng) const requires (vec) {
+		_VEC_TYPE r;
+		for (uint64_t& x : r) x = ((uint64_t)rng->next() << 32) | rng->next();
+
+		return spawn(load(&r[0]).tiles, successful);
+	}
+
+	template <int N, bool vec>
+	PositionV<N, vec> PositionV<N, vec>::spawn(VEC_TYPE random, uint64_t* successful) const requires (vec) {
+		using V = typename Swar<N>::type;
+		PositionV v{ (VEC_TYPE) spawn_swar((V) tiles, (V) random) };
+
+		if (successful) *successful = changed_mask(*this, v);
+		return v;
+	}
+
+	template <int N, bool vec>
+	PositionV<N, vec> PositionV<N, vec>::blend(uint64_t mask, const PositionV& a, const PositionV& b) requires (vec) {
+		return PositionV{ blend_lanes(mask, a.tiles, b.tiles) };
+	}
+
+	template <int N, bool vec>
+	PositionV<N, vec> PositionV<N, vec>::expand(uint64_t mask, const uint64_t* src) const requires (vec) {
+		return PositionV{ expand_lanes(mask & ALL, tiles, src) };
+	}
+
+	template <int N, bool vec>
+	int PositionV<N, vec>::compress(uint64_t mask, uint64_t* dst) const requires (vec) {
+		compress_lanes(mask & ALL, tiles, dst);
+		return __builtin_popcountll(mask & ALL);
+	}
+
+	template <int N, bool vec>
+	uint64_t PositionV<N, vec>::cmp_mask(const PositionV& p1, const PositionV& p2) requires (vec) {
+		return cmp64_to_mask(p1.tiles, p2.tiles);
+	}
+
+	// Explicitly instantiate allowed vectorized templates
+	template class PositionV<2>;
+	template class PositionV<4>;
+	template class PositionV<8>;
+}
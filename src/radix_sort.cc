@@ -0,0 +1,171 @@
+#include "radix_sort.h"
+#include "parallel.h"
+#include "perf.h"
+
+#include <algorithm>
+#include <array>
+
+namespace Analysis {
+	namespace {
+		// Below this many entries (per thread), std::sort beats the radix passes
+		constexpr size_t SMALL_SORT = 1 << 16;
+
+		int pick_threads(size_t count, int threads) {
+			if (threads <= 0) threads = default_thread_count();
+
+			return (int)std::max<size_t>(1, std::min<size_t>(threads, count / SMALL_SORT));
+		}
+
+		size_t slice_begin(size_t count, int threads, int t) {
+			return count * t / threads;
+		}
+
+		// Sort data, ping-ponging with scratch. Returns whichever of the two buffers ends up holding the result.
+		uint64_t* radix_sort_impl(uint64_t* data, size_t count, uint64_t* scratch, int threads) {
+			if (count < SMALL_SORT) {
+				std::sort(data, data + count);
+				return data;
+			}
+
+			threads = pick_threads(count, threads);
+
+			// Bytes which vary anywhere in the input; the others don't need a pass
+			std::vector<uint64_t> varying_per_thread(threads, 0);
+			parallel_for(threads, threads, [&] (int64_t t) {
+				uint64_t v = 0;
+				for (size_t i = slice_begin(count, threads, t); i < slice_begin(count, threads, t + 1); ++i) {
+					v |= data[i] ^ data[0];
+				}
+
+				varying_per_thread[t] = v;
+			});
+
+			uint64_t varying = 0;
+			for (uint64_t v : varying_per_thread) varying |= v;
+
+			std::vector<std::array<size_t, 256>> offsets(threads);
+			uint64_t* src = data;
+			uint64_t* dst = scratch;
+
+			for (int shift = 0; shift < 64; shift += 8) {
+				if (!((varying >> shift) & 0xff)) continue;
+
+				parallel_for(threads, threads, [&] (int64_t t) {
+					auto& hist = offsets[t];
+					hist.fill(0);
+
+					for (size_t i = slice_begin(count, threads, t); i < slice_begin(count, threads, t + 1); ++i) {
+						hist[(src[i] >> shift) & 0xff]++;
+					}
+				});
+
+				// Exclusive prefix sum in (digit, thread) order, so each thread scatters into its own stable ranges
+				size_t sum = 0;
+				for (int d = 0; d < 256; ++d) {
+					for (int t = 0; t < threads; ++t) {
+						size_t c = offsets[t][d];
+						offsets[t][d] = sum;
+						sum += c;
+					}
+				}
+
+				parallel_for(threads, threads, [&] (int64_t t) {
+					auto& off = offsets[t];
+
+					for (size_t i = slice_begin(count, threads, t); i < slice_begin(count, threads, t + 1); ++i) {
+						uint64_t v = src[i];
+						dst[off[(v >> shift) & 0xff]++] = v;
+					}
+				});
+
+				std::swap(src, dst);
+			}
+
+			return src;
+		}
+
+		// Collapse runs of the sorted array src into dst and freqs. Returns the number of distinct entries.
+		size_t dedup_sorted(const uint64_t* src, size_t count, uint64_t* dst, uint32_t* freqs, int threads) {
+			ANALYSIS_PERF_REGION("radix/dedup");
+			if (count == 0) return 0;
+
+			threads = pick_threads(count, threads);
+
+			// Move each slice boundary forward to the start of a run, so no run straddles two threads
+			std::vector<size_t> starts(threads + 1);
+			for (int t = 0; t < threads; ++t) {
+				size_t s = std::max(slice_begin(count, threads, t), t > 0 ? starts[t - 1] : 0);
+				while (s > 0 && s < count && src[s] == src[s - 1]) ++s;
+
+				starts[t] = s;
+			}
+
+			starts[threads] = count;
+
+			std::vector<size_t> out_offsets(threads + 1, 0);
+			parallel_for(threads, threads, [&] (int64_t t) {
+				size_t distinct = 0;
+				for (size_t i = starts[t]; i < starts[t + 1]; ++i) {
+					distinct += (i == starts[t] || src[i] != src[i - 1]);
+				}
+
+				out_offsets[t + 1] = distinct;
+			});
+
+			for (int t = 0; t < threads; ++t) out_offsets[t + 1] += out_offsets[t];
+
+			parallel_for(threads, threads, [&] (int64_t t) {
+				size_t w = out_offsets[t];
+
+				for (size_t i = starts[t]; i < starts[t + 1]; ++i) {
+					if (i == starts[t] || src[i] != src[i - 1]) {
+						dst[w] = src[i];
+						freqs[w] = 1;
+						++w;
+					} else {
+						freqs[w - 1]++;
+					}
+				}
+			});
+
+			return out_offsets[threads];
+		}
+	}
+
+	void radix_sort_positions(uint64_t* positions, size_t count, uint64_t* scratch, int threads) {
+		uint64_t* sorted = radix_sort_impl(positions, count, scratch, threads);
+
+		if (sorted != positions) {
+			parallel_for(count, threads, [&] (int64_t i) {
+				positions[i] = sorted[i];
+			}, SMALL_SORT);
+		}
+	}
+
+	size_t sort_dedup_positions(uint64_t* positions, size_t count, uint64_t* scratch, uint32_t* freqs, int threads) {
+		uint64_t* sorted = radix_sort_impl(positions, count, scratch, threads);
+
+		if (sorted == scratch) {
+			// Dedup straight back into positions
+			return dedup_sorted(scratch, count, positions, freqs, threads);
+		}
+
+		size_t distinct = dedup_sorted(positions, count, scratch, freqs, threads);
+
+		parallel_for(distinct, threads, [&] (int64_t i) {
+			positions[i] = scratch[i];
+		}, SMALL_SORT);
+
+		return distinct;
+	}
+
+	void sort_unique_positions(std::vector<uint64_t>& positions, int threads) {
+		std::vector<uint64_t> scratch(positions.size());
+		uint64_t* sorted = radix_sort_impl(positions.data(), positions.size(), scratch.data(), threads);
+
+		if (sorted != positions.data()) positions.swap(scratch);
+
+		ANALYSIS_PERF_REGION("radix/dedup");
+		positions.erase(std::unique(positions.begin(), positions.end()), positions.end());
+	}
+}
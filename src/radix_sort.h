@@ -0,0 +1,27 @@
+/**
+ * Parallel radix sorting and deduplication of large position arrays. The sort is LSD with 8-bit digits, skipping any
+ * byte which is the same across the whole input. Each thread keeps the same contiguous slice of the source for every
+ * pass and histograms and scatters from it, so on NUMA machines its reads stay on the node that first touched the
+ * slice. The scatter writes land all over the destination, from every thread, so only the read side is node-local.
+ * Deduplication splits the sorted array at run boundaries and compacts the slices in parallel.
+ */
+#pragma once
+
+#include "defs.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace Analysis {
+	// Sort count positions in place. scratch must have room for count entries; its contents are clobbered.
+	void radix_sort_positions(uint64_t* positions, size_t count, uint64_t* scratch, int threads=0);
+
+	// Sort positions and collapse duplicates, leaving each distinct position once at the front of positions and its
+	// number of occurrences in the same index of freqs. scratch and freqs must have room for count entries. Returns the
+	// number of distinct positions.
+	size_t sort_dedup_positions(uint64_t* positions, size_t count, uint64_t* scratch, uint32_t* freqs, int threads=0);
+
+	// Sort and remove duplicates, discarding the counts
+	void sort_unique_positions(std::vector<uint64_t>& positions, int threads=0);
+}
@@ -1,14 +1,24 @@
 #pragma once
 
+#include "defs.h"
+
 #include <cstdint>
+#include <cstring>
 #include <ctime>
 
 namespace Analysis {
+	inline uint64_t splitmix64(uint64_t x) {
+		x += 0x9e37'79b9'7f4a'7c15ULL;
+		x = (x ^ (x >> 30)) * 0xbf58'476d'1ce4'e5b9ULL;
+		x = (x ^ (x >> 27)) * 0x94d0'49bb'1331'11ebULL;
+
+		return x ^ (x >> 31);
+	}
 
 	inline uint64_t seed_to_seed(uint64_t seed) {
-		if (seed == -1) {
+		if (seed == (uint64_t)-1) {
 #ifdef USE_X86_VECTORIZE
-			uint64_t r = 0;
+			unsigned long long r = 0;
 			_rdrand64_step(&r);
 			return r;
 #else
@@ -31,8 +41,115 @@ namespace Analysis {
 			return (uint32_t)(_state >> 19);
 		}
 
-		inline void skip(int cnt) {
-			for (int i = 0; i < cnt; ++i) next();
+		// Advance by cnt outputs in O(log cnt), by squaring the affine map x -> a x + c
+		inline void skip(uint64_t cnt) {
+			uint64_t a = 1203818221052081ULL, c = 4018501;
+			uint64_t acc_a = 1, acc_c = 0;
+
+			for (; cnt; cnt >>= 1) {
+				if (cnt & 1) {
+					acc_a *= a;
+					acc_c = acc_c * a + c;
+				}
+
+				c *= a + 1;
+				a *= a;
+			}
+
+			_state = _state * acc_a + acc_c;
+		}
+	};
+
+	namespace detail {
+		// GCC vectors of 64-bit lanes; compiled to whatever vectors the target has, or to scalar code
+		template <int lanes> struct U64Vec;
+		template <> struct U64Vec<2> { typedef uint64_t type __attribute__((vector_size(16))); };
+		template <> struct U64Vec<4> { typedef uint64_t type __attribute__((vector_size(32))); };
+		template <> struct U64Vec<8> { typedef uint64_t type __attribute__((vector_size(64))); };
+
+		// Product of the low 32 bits of each lane of a with b. GCC can't tell that the high halves are zero and would
+		// emulate a full 64-bit multiply, so use pmuludq where we have it.
+		inline uint64_t mul_lo32(uint64_t a, uint32_t b) {
+			return (a & 0xffff'ffff) * b;
+		}
+
+		template <typename V>
+		inline V mul_lo32(V a, uint32_t b) {
+#ifdef USE_X86_VECTORIZE
+			if constexpr (sizeof(V) == 16) {
+				return (V) _mm_mul_epu32((__m128i) a, _mm_set1_epi64x(b));
+			} else if constexpr (sizeof(V) == 32) {
+				return (V) _mm256_mul_epu32((__m256i) a, _mm256_set1_epi64x(b));
+			}
+#ifdef USE_AVX512_VECTORIZE
+			else if constexpr (sizeof(V) == 64) {
+				return (V) _mm512_mul_epu32((__m512i) a, _mm512_set1_epi64(b));
+			}
+#endif
+#endif
+			return (a & 0xffff'ffff) * (uint64_t)b;
+		}
+
+		// Ten rounds of Philox4x32 (Salmon et al., "Parallel random numbers: as easy as 1, 2, 3"). Works on uint64_t or
+		// on GCC vectors of them, with each 32-bit word of the counter in the low half of its own 64-bit lane, so the
+		// products are plain 32x32 -> 64-bit multiplies.
+		template <typename V>
+		inline void philox4x32(V& c0, V& c1, V& c2, V& c3, uint32_t k0, uint32_t k1) {
+			for (int round = 0; round < 10; ++round) {
+				V p0 = mul_lo32(c0, 0xd251'1f53);
+				V p1 = mul_lo32(c2, 0xcd9e'8d57);
+
+				c0 = (p1 >> 32) ^ c1 ^ (uint64_t)k0;
+				c1 = p1 & 0xffff'ffff;
+				c2 = (p0 >> 32) ^ c3 ^ (uint64_t)k1;
+				c3 = p0 & 0xffff'ffff;
+
+				k0 += 0x9e37'79b9;
+				k1 += 0xbb67'ae85;
+			}
+		}
+	}
+
+	// Counter-based generator: the output for (game, ply, stream) is a keyed bijection of that triple, so any game
+	// can start anywhere with no state to carry or skip through. Runs with the same seed see the same numbers for
+	// the same game and ply however the games are spread over threads or lanes.
+	class CounterRng {
+		uint32_t k0, k1;
+
+		public:
+		CounterRng(uint64_t seed=-1) {
+			uint64_t s = seed_to_seed(seed);
+
+			k0 = (uint32_t)s;
+			k1 = (uint32_t)(s >> 32);
+		}
+
+		// 64 random bits
+		inline uint64_t operator()(uint64_t game, uint32_t ply, uint32_t stream=0) const noexcept {
+			uint64_t c0 = ply, c1 = stream, c2 = game & 0xffff'ffff, c3 = game >> 32;
+			detail::philox4x32(c0, c1, c2, c3, k0, k1);
+
+			return c0 | (c1 << 32);
+		}
+
+		// The same for each lane of games and plies, as any type of the right size (a native vector or an array of
+		// uint64_t). Meant for PositionV::spawn, which bounds the draws to the empty squares itself.
+		template <typename T>
+		inline T operator()(const uint64_t* games, const uint64_t* plies, uint32_t stream=0) const noexcept {
+			using V = typename detail::U64Vec<sizeof(T) / 8>::type;
+
+			V g, p;
+			memcpy(&g, games, sizeof(V));
+			memcpy(&p, plies, sizeof(V));
+
+			V c0 = p & 0xffff'ffff, c1 = (V){} + (uint64_t)stream, c2 = g & 0xffff'ffff, c3 = g >> 32;
+			detail::philox4x32(c0, c1, c2, c3, k0, k1);
+
+			V r = c0 | (c1 << 32);
+			T t;
+			memcpy(&t, &r, sizeof(T));
+
+			return t;
 		}
 	};
 
@@ -43,12 +160,13 @@ namespace Analysis {
 
 		__m128i real_state = _mm_setzero_si128();
 
+		public:
 		FastRng(uint64_t seed=-1) {
 			real_state = _mm_set1_epi64x(seed_to_seed(seed));
 		}
 
 		inline __m128i next_v() noexcept {
-			real_state = _mm_aesenc_si128(_mm_set_epi64(5765458678434087244ULL, 3188412809159398971ULL));	
+			real_state = _mm_aesenc_si128(real_state, _mm_set_epi64x(5765458678434087244ULL, 3188412809159398971ULL));
 
 #ifdef USE_AVX512_VECTORIZE
 			real_state = _mm_rol_epi32(real_state, 12);
@@ -0,0 +1,256 @@
+#include "rollout.h"
+#include "parallel.h"
+#include "perf.h"
+#include "position.h"
+#include "wide_position.h"
+
+#include <algorithm>
+#include <memory>
+
+namespace Analysis {
+	namespace {
+		constexpr Direction POLICY_ORDER[4] = { RIGHT, DOWN, LEFT, UP };
+
+		// Games handed out to a worker at a time; small enough to balance, large enough that the ranges aren't contended
+		constexpr int64_t GAMES_PER_CHUNK = 64;
+
+		// Games per work item of the SIMD mode. Each ends with a drain where lanes go idle, so not too small.
+		constexpr int64_t SIMD_GAMES_PER_ITEM = 4096;
+
+		// A board holds two 32768s only once its tiles sum to 65536; the start is at most 8 and each ply adds at most
+		// 4, so no game can overflow before this ply
+		constexpr uint64_t MIN_OVERFLOW_PLY = (65536 - 8) / 4;
+
+		// The two tiles a game starts with, from rng(game, 0) and rng(game, 0, 2)
+		uint64_t starting_board(const CounterRng& rng, uint64_t game) {
+			return spawn_tile(spawn_tile(0, rng(game, 0)), rng(game, 0, 2));
+		}
+
+		void record_game(RolloutStats& stats, uint64_t tiles, uint64_t moves) {
+			// Every move spawned one tile and the start two, so the tile sum tells how many were 4s. Games stop short of
+			// merging two 32768s, so no move lost any of the sum.
+			uint64_t spawned = 2 * (moves + 2), sum = tile_sum(tiles);
+			assert(sum >= spawned);
+			uint64_t fours = (sum - spawned) / 2;
+
+			stats.add_game(moves, game_score(tiles, fours), nibble_max(tiles));
+		}
+
+		// Play games first_game, first_game + 1, ... up to count of them, ROLLOUT_LANES at a time, with the first-legal
+		// policy. Lane i holds game games[i], which has made plies[i] moves.
+		void play_rollouts_simd(const CounterRng& rng, uint64_t first_game, uint64_t count, RolloutStats& stats) {
+			using PV = PositionV<ROLLOUT_LANES>;
+
+			uint64_t games[ROLLOUT_LANES], plies[ROLLOUT_LANES] = {};
+			uint64_t started = 0;
+
+			// Start fresh games in the lowest lanes of mask while there are games left; returns the lanes filled
+			auto refill = [&] (PV& p, uint64_t mask) {
+				uint64_t filled = 0, fresh[ROLLOUT_LANES];
+				int f = 0;
+
+				for (uint64_t b = mask; b && started < count; b &= b - 1, ++started) {
+					int lane = __builtin_ctzll(b);
+
+					games[lane] = first_game + started;
+					plies[lane] = 0;
+					fresh[f++] = starting_board(rng, games[lane]);
+					filled |= b & -b;
+				}
+
+				p = p.expand(filled, fresh);
+				return filled;
+			};
+
+			PV p;
+			uint64_t active = refill(p, PV::ALL);
+			uint64_t max_ply = 0;  // of any lane, as of the last ply
+
+			while (active) {
+				PV moves[4];
+				uint64_t m[4];
+				uint64_t dead = active & ~p.move_all(moves, m);
+
+				// Lanes whose first legal move would merge two 32768s stop before it, like run_rollouts' games
+				uint64_t overflowed = 0;
+				for (uint64_t b = unlikely(max_ply >= MIN_OVERFLOW_PLY) ? active & ~dead : 0; b; b &= b - 1) {
+					int lane = __builtin_ctzll(b);
+					if (plies[lane] < MIN_OVERFLOW_PLY) continue;
+
+					uint64_t tiles = p.get_idx(lane).tiles;
+					if (likely(!may_overflow(tiles))) continue;
+
+					for (Direction d : POLICY_ORDER) {
+						if (!((m[d] >> lane) & 1)) continue;
+
+						if ((overflowing_moves(tiles) >> d) & 1) overflowed |= b & -b;
+						break;
+					}
+				}
+
+				uint64_t ended = dead | overflowed;
+
+				if (unlikely(ended)) {
+					uint64_t finished[ROLLOUT_LANES];
+					p.compress(ended, finished);
+
+					int f = 0;
+					for (uint64_t b = ended; b; b &= b - 1) {
+						record_game(stats, finished[f++], plies[__builtin_ctzll(b)]);
+					}
+
+					stats.overflowed += __builtin_popcountll(overflowed);
+
+					// Lanes left without a game go idle
+					active = (active & ~ended) | refill(p, ended);
+
+					continue;  // the refilled lanes need their moves
+				}
+
+				// The first legal of right, down, left, up: apply in reverse so earlier directions win. Lanes with no
+				// legal move, which are idle, keep their position.
+				PV moved = PV::blend(m[LEFT], moves[LEFT], moves[UP]);
+				moved = PV::blend(m[DOWN], moves[DOWN], moved);
+				moved = PV::blend(m[RIGHT], moves[RIGHT], moved);
+
+				max_ply = 0;
+				for (uint64_t& ply : plies) max_ply = std::max(max_ply, ++ply);
+				p = moved.spawn(rng.operator()<PV::VEC_TYPE>(games, plies));
+			}
+		}
+	}
+
+	RolloutPolicy first_legal_policy() {
+		return [] (uint64_t, uint8_t legal_mask, uint64_t) {
+			for (Direction d : POLICY_ORDER) {
+				if ((legal_mask >> d) & 1) return d;
+			}
+
+			assert(false && "no legal move");
+			return RIGHT;
+		};
+	}
+
+	RolloutPolicy random_policy() {
+		return [] (uint64_t, uint8_t legal_mask, uint64_t random) {
+			Direction legal[4];
+			int count = 0;
+
+			for (Direction d : POLICY_ORDER) {
+				if ((legal_mask >> d) & 1) legal[count++] = d;
+			}
+
+			assert(count > 0 && "no legal move");
+			return legal[((random >> 32) * count) >> 32];
+		};
+	}
+
+	void RolloutStats::add_game(uint64_t moves, uint64_t score, uint8_t max_tile) {
+		games++;
+
+		total_moves += moves;
+		min_moves = std::min(min_moves, moves);
+		max_moves = std::max(max_moves, moves);
+
+		total_score += score;
+		max_score = std::max(max_score, score);
+
+		max_tile_counts[max_tile & 0xf]++;
+	}
+
+	void RolloutStats::merge(const RolloutStats& s) {
+		games += s.games;
+
+		total_moves += s.total_moves;
+		min_moves = std::min(min_moves, s.min_moves);
+		max_moves = std::max(max_moves, s.max_moves);
+
+		total_score += s.total_score;
+		max_score = std::max(max_score, s.max_score);
+
+		for (int i = 0; i < 16; ++i) max_tile_counts[i] += s.max_tile_counts[i];
+
+		overflowed += s.overflowed;
+	}
+
+	uint64_t game_score(uint64_t tiles, uint64_t fours_spawned) {
+		// Making a tile 2^n takes merges worth (n - 1) * 2^n in total, if every tile came from spawned 2s
+		uint64_t score = 0;
+		for (int i = 0; i < 16; ++i) {
+			uint64_t n = (tiles >> (4 * i)) & 0xf;
+			if (n >= 2) score += (n - 1) << n;
+		}
+
+		return score - 4 * fours_spawned;
+	}
+
+	void play_rollout(const CounterRng& rng, uint64_t game, const RolloutPolicy& policy, RolloutStats& stats) {
+		uint64_t t = starting_board(rng, game);
+		uint32_t ply = 0;
+
+		for (AllMoves m = move_all(t); m.legal_mask; m = move_all(t)) {
+			Direction d = policy(t, m.legal_mask, rng(game, ply, 1));
+
+			// The nibble format can't hold the merge of two 32768s, so the game stops short of it
+			if (unlikely(ply >= MIN_OVERFLOW_PLY) && may_overflow(t) && ((overflowing_moves(t) >> d) & 1)) {
+				stats.overflowed++;
+				break;
+			}
+
+			uint64_t moved = m.moves[d];
+			assert(moved != t);
+
+			t = spawn_tile(moved, rng(game, ++ply));
+		}
+
+		record_game(stats, t, ply);
+	}
+
+	RolloutStats run_rollouts(const RolloutOptions& opts) {
+		ANALYSIS_PERF_REGION("rollouts");
+
+		int threads = opts.threads > 0 ? opts.threads : default_thread_count();
+		CounterRng rng{ opts.seed };
+
+		struct alignas(64) Worker {
+			RolloutStats stats;
+		};
+
+		std::unique_ptr<Worker[]> workers(new Worker[threads]);
+
+		work_stealing_for(opts.games, threads, [&] (int w, int64_t game) {
+			play_rollout(rng, game, opts.policy, workers[w].stats);
+		}, GAMES_PER_CHUNK);
+
+		RolloutStats total;
+		for (int t = 0; t < threads; ++t) total.merge(workers[t].stats);
+
+		return total;
+	}
+
+	RolloutStats run_rollouts_simd(const RolloutOptions& opts) {
+		ANALYSIS_PERF_REGION("rollouts/simd");
+
+		int threads = opts.threads > 0 ? opts.threads : default_thread_count();
+		CounterRng rng{ opts.seed };
+
+		struct alignas(64) Worker {
+			RolloutStats stats;
+		};
+
+		std::unique_ptr<Worker[]> workers(new Worker[threads]);
+		int64_t items = (opts.games + SIMD_GAMES_PER_ITEM - 1) / SIMD_GAMES_PER_ITEM;
+
+		work_stealing_for(items, threads, [&] (int w, int64_t item) {
+			uint64_t first = item * SIMD_GAMES_PER_ITEM;
+			uint64_t count = std::min<uint64_t>(SIMD_GAMES_PER_ITEM, opts.games - first);
+
+			play_rollouts_simd(rng, first, count, workers[w].stats);
+		});
+
+		RolloutStats total;
+		for (int t = 0; t < threads; ++t) total.merge(workers[t].stats);
+
+		return total;
+	}
+}
@@ -0,0 +1,79 @@
+/**
+ * Monte Carlo rollouts: play many games to the end with a simple policy and collect statistics. Games are spread over a
+ * work-stealing pool; each worker accumulates into its own RolloutStats, which are merged at the end. All randomness
+ * comes from a CounterRng keyed by the run seed and indexed by (game, ply), so for a fixed seed every game plays out
+ * the same whatever the thread count, and the same in both modes.
+ *
+ * The SIMD mode plays a whole vector of games in lockstep instead; lanes whose game has ended are compressed out and
+ * expanded back in with fresh games, so no lane idles while there are games left to play.
+ */
+#pragma once
+
+#include "defs.h"
+#include "move_lut.h"
+#include "position.h"
+#include "rng.h"
+
+#include <array>
+#include <functional>
+
+namespace Analysis {
+	// Picks a move in a position with at least one legal move, given the legal directions as bits of legal_mask (as
+	// in AllMoves) and 64 random bits. Must return a legal direction.
+	using RolloutPolicy = std::function<Direction(uint64_t tiles, uint8_t legal_mask, uint64_t random)>;
+
+	// The first legal move out of right, down, left, up
+	RolloutPolicy first_legal_policy();
+	// A uniformly random legal move
+	RolloutPolicy random_policy();
+
+	struct RolloutOptions {
+		int threads = 0;  // 0 = all cores
+		uint64_t games = 1'000'000;
+		uint64_t seed = -1;  // -1 = random
+		RolloutPolicy policy = first_legal_policy();
+	};
+
+	struct RolloutStats {
+		uint64_t games = 0;
+
+		// Game length in moves
+		uint64_t total_moves = 0;
+		uint64_t min_moves = UINT64_MAX;
+		uint64_t max_moves = 0;
+
+		// Usual 2048 score: the sum of the values of all merged tiles
+		uint64_t total_score = 0;
+		uint64_t max_score = 0;
+
+		// Number of games whose largest tile has representation i
+		std::array<uint64_t, 16> max_tile_counts{};
+
+		// Games stopped before a move which would merge two 32768s, whose 65536 the nibble format can't hold. They
+		// count in the statistics above as ending on the board before that move.
+		uint64_t overflowed = 0;
+
+		void add_game(uint64_t moves, uint64_t score, uint8_t max_tile);
+		void merge(const RolloutStats& s);
+
+		double mean_moves() const { return games ? (double)total_moves / games : 0; }
+		double mean_score() const { return games ? (double)total_score / games : 0; }
+	};
+
+	// Score of a finished board, given how many of its spawns were 4s
+	uint64_t game_score(uint64_t tiles, uint64_t fours_spawned);
+
+	// Play one game from two spawned tiles to the end. The start spawns with rng(game, 0) and rng(game, 0, 2); after
+	// that ply i spawns with rng(game, i), and each ply picks its move with rng(game, i, 1).
+	void play_rollout(const CounterRng& rng, uint64_t game, const RolloutPolicy& policy, RolloutStats& stats);
+
+	RolloutStats run_rollouts(const RolloutOptions& opts);
+
+	// Games played side by side in one PositionV by run_rollouts_simd
+	constexpr int ROLLOUT_LANES = can_vectorize<8> ? 8 : 4;
+
+	// Like run_rollouts, but each worker plays ROLLOUT_LANES games at once in the lanes of a PositionV, refilling a
+	// lane with a fresh game as soon as its game ends. Only the first-legal policy runs in lanes, so opts.policy is
+	// ignored; with the same seed the results are identical to run_rollouts' with first_legal_policy().
+	RolloutStats run_rollouts_simd(const RolloutOptions& opts);
+}
@@ -0,0 +1,177 @@
+#include "search.h"
+#include "parallel.h"
+#include "perf.h"
+#include "shuffle.h"
+#include "move_lut.h"
+#include "wide_position.h"
+
+#include <vector>
+
+namespace Analysis {
+	namespace {
+		constexpr float PROB_2 = 0.9f;
+		constexpr float PROB_4 = 0.1f;
+		constexpr float ILLEGAL_VALUE = -1.0f;
+
+		constexpr Direction all_directions[4] = { RIGHT, LEFT, UP, DOWN };
+	}
+
+	float default_leaf_eval(uint64_t tiles) {
+		return (float)(count_empty(tiles) + 1);
+	}
+
+	Direction MoveValues::best() const {
+		Direction best_dir = RIGHT;
+		float best_value = -1e30f;
+
+		for (Direction d : all_directions) {
+			if (is_legal(d) && values[d] > best_value) {
+				best_value = values[d];
+				best_dir = d;
+			}
+		}
+
+		return best_dir;
+	}
+
+	Searcher::Searcher(SearchOptions opts) : opts(opts) {
+		assert(opts.depth >= 1);
+		assert(opts.leaf_eval);
+	}
+
+	float Searcher::max_node(uint64_t tiles, int depth) const {
+		if (depth == 0) return opts.leaf_eval(tiles);
+
+		// Only reuse entries searched to exactly this depth, so a hit returns what we would have computed (up to rounding,
+		// as a symmetric variant sums its chance outcomes in a different order) no matter which thread stored it.
+		uint64_t key = 0;
+		if (opts.table) {
+			key = canonical_position(tiles);
+
+			TTEntry e;
+			if (opts.table->probe(key, &e) && e.depth == depth) return e.value;
+		}
+
+		float best = 0;  // dead positions are worth nothing
+		AllMoves m = move_all(tiles);
+		if (unlikely(may_overflow(tiles))) m.legal_mask &= ~overflowing_moves(tiles);
+
+		for (Direction d : all_directions) {
+			if (!((m.legal_mask >> d) & 1)) continue;
+
+			best = max(best, chance_node(m.moves[d], depth));
+		}
+
+		if (opts.table) opts.table->store(key, best, depth);
+
+		return best;
+	}
+
+	float Searcher::chance_node(uint64_t tiles, int depth) const {
+		Position pp2[16], pp4[16];
+		int pp2c, pp4c;
+
+		Position{ tiles }.gen_new_tiles(pp2, pp4, &pp2c, &pp4c);
+
+		// A legal move always leaves at least one empty cell
+		assert(pp2c > 0);
+
+		float sum = 0;
+
+		if (depth == 1 && opts.leaf_eval_batch) {
+			// Every child is a leaf; score them together, 2s then 4s
+			uint64_t leaves[32];
+			float values[32];
+
+			for (int i = 0; i < pp2c; ++i) {
+				leaves[i] = pp2[i].tiles;
+				leaves[pp2c + i] = pp4[i].tiles;
+			}
+
+			opts.leaf_eval_batch(leaves, 2 * pp2c, values);
+
+			for (int i = 0; i < pp2c; ++i) {
+				sum += PROB_2 * values[i];
+				sum += PROB_4 * values[pp2c + i];
+			}
+
+			return sum / pp2c;
+		}
+
+		for (int i = 0; i < pp2c; ++i) {
+			sum += PROB_2 * max_node(pp2[i].tiles, depth - 1);
+			sum += PROB_4 * max_node(pp4[i].tiles, depth - 1);
+		}
+
+		return sum / pp2c;
+	}
+
+	void Searcher::evaluate_batch(const Position* positions, int count, MoveValues* results) const {
+		ANALYSIS_PERF_REGION("search/evaluate_batch");
+
+		// Flatten every (position, root move, spawned tile) triple into one task list, so that the threads are balanced
+		// across the whole batch rather than per position
+		struct Task {
+			uint64_t child;
+			float weight;
+			int owner;  // index into results * 4 + direction
+		};
+
+		std::vector<Task> tasks;
+		tasks.reserve((size_t)count * 4 * 2 * 8);
+
+		for (int i = 0; i < count; ++i) {
+			MoveValues& r = results[i];
+			r.legal_mask = 0;
+			r.overflow_mask = overflowing_moves(positions[i].tiles);
+
+			AllMoves m = move_all(positions[i].tiles);
+			m.legal_mask &= ~r.overflow_mask;
+
+			for (Direction d : all_directions) {
+				if (!((m.legal_mask >> d) & 1)) {
+					r.values[d] = ILLEGAL_VALUE;
+					continue;
+				}
+
+				r.legal_mask |= 1 << d;
+				r.values[d] = 0;
+
+				Position pp2[16], pp4[16];
+				int pp2c, pp4c;
+
+				Position{ m.moves[d] }.gen_new_tiles(pp2, pp4, &pp2c, &pp4c);
+
+				for (int j = 0; j < pp2c; ++j) {
+					tasks.push_back(Task { pp2[j].tiles, PROB_2 / pp2c, i * 4 + d });
+					tasks.push_back(Task { pp4[j].tiles, PROB_4 / pp4c, i * 4 + d });
+				}
+			}
+		}
+
+		std::vector<float> task_values(tasks.size());
+
+		parallel_for((int64_t)tasks.size(), opts.threads, [&] (int64_t t) {
+			task_values[t] = max_node(tasks[t].child, opts.depth - 1);
+		});
+
+		// Sum serially, so that results don't depend on the thread count
+		for (size_t t = 0; t < tasks.size(); ++t) {
+			results[tasks[t].owner / 4].values[tasks[t].owner % 4] += tasks[t].weight * task_values[t];
+		}
+	}
+
+	MoveValues Searcher::evaluate(Position p) const {
+		MoveValues r;
+		evaluate_batch(&p, 1, &r);
+
+		return r;
+	}
+
+	Direction Searcher::best_move(Position p, bool* has_move) const {
+		MoveValues r = evaluate(p);
+		*has_move = r.has_legal();
+
+		return r.best();
+	}
+}
@@ -0,0 +1,75 @@
+/**
+ * Depth-limited expectimax search. Player nodes take the maximum over the four moves; chance nodes average over every
+ * empty cell receiving a 2 (probability 0.9) or a 4 (probability 0.1). The root moves and the chance outcomes directly
+ * below them are handed out to threads as independent tasks; everything deeper is searched serially by the thread that
+ * owns the task. Batches of positions share a single pool of such tasks.
+ *
+ * Positions are in the nibble format, which can't hold the 65536 from merging two 32768s, so the search leaves such
+ * moves out at every depth; at the root they're reported in MoveValues::overflow_mask.
+ */
+#pragma once
+
+#include "defs.h"
+#include "position.h"
+#include "transposition.h"
+
+#include <array>
+
+namespace Analysis {
+	// Heuristic value of a position at the search horizon
+	using LeafEvaluator = float (*)(uint64_t tiles);
+
+	// Optional batch version of a LeafEvaluator, which must give the same values
+	using LeafBatchEvaluator = void (*)(const uint64_t* tiles, int count, float* out);
+
+	// Number of empty cells plus one, so that any position at the horizon beats a dead one (value 0). See eval.h for a
+	// real heuristic.
+	float default_leaf_eval(uint64_t tiles);
+
+	struct SearchOptions {
+		int depth = 3;   // player moves to look ahead, including the root move. Must be at least 1
+		int threads = 0;   // 0 = all cores
+		LeafEvaluator leaf_eval = default_leaf_eval;
+		// If set, chance nodes just above the horizon score all their spawns with one call to this
+		LeafBatchEvaluator leaf_eval_batch = nullptr;
+		// Optional table shared by all threads (and by later searches) to merge symmetric and transposed positions
+		TranspositionTable* table = nullptr;
+	};
+
+	// Expected values of each root move, indexed by Direction. Moves which don't change the position are illegal; they
+	// get a value of -1 and a cleared bit in legal_mask. So do moves which merge two 32768s, which also get a bit in
+	// overflow_mask: to play one, promote the position to WidePosition (wide_position.h).
+	struct MoveValues {
+		std::array<float, 4> values;
+		uint8_t legal_mask;
+		uint8_t overflow_mask;
+
+		bool has_legal() const { return legal_mask != 0; }
+		bool is_legal(Direction d) const { return legal_mask & (1 << d); }
+
+		// Highest-valued legal move; ties go to the lower direction. Meaningless if there are no legal moves.
+		Direction best() const;
+	};
+
+	class Searcher {
+		SearchOptions opts;
+
+		float max_node(uint64_t tiles, int depth) const;
+		float chance_node(uint64_t tiles, int depth) const;
+
+		public:
+		Searcher(SearchOptions opts=SearchOptions{});
+
+		const SearchOptions& options() const { return opts; }
+
+		// Expected value of playing each move from the position
+		MoveValues evaluate(Position p) const;
+
+		// Evaluate count positions at once, writing count results. Root moves and chance outcomes of every position
+		// are distributed across threads together, so large batches keep all cores busy.
+		void evaluate_batch(const Position* positions, int count, MoveValues* results) const;
+
+		// Convenience wrapper around evaluate(); *has_move is false if the game is over
+		Direction best_move(Position p, bool* has_move) const;
+	};
+}
@@ -1,10 +1,19 @@
 #include "shuffle.h"
 #include "defs.h"
+#include "perf.h"
+
+#if defined(__SSSE3__) && !defined(USE_X86_VECTORIZE)
+#include <immintrin.h>
+#endif
 
 
 // Convention: (a & (0xf << (4 * i))) >> (4 * i) is the ith nibble of a (i.e., lowest-significant is 0)
 namespace Analysis {
 
+#ifdef USE_VBMI_VECTORIZE
+#define USE_NIBBLE_SHUFFLE_VBMI
+#endif
+
 #ifdef USE_NIBBLE_SHUFFLE_VBMI
 	// Given a shuffle, convert it to the indices of the high part and of the low part for a vpmultishiftqb lookup
 	void split_nibble_shuffle(__m128i shuf, __m128i* hi, __m128i* lo) {
@@ -30,46 +39,6 @@ namespace Analysis {
 		*lo = _mm512_slli_epi32(indices_lo, 2);
 		*hi = _mm512_srli_epi32(indices_hi, 2);
 	}
-
-	// Broadcast shuffle idx to both hi and lo. Probably use this sparingly, though, due to constant propagation
-	void split_nibble_shuffle(uint64_t shuf, __m128i* hi, __m128i* lo) {
-		uint64_t lo_s = a & LO_NIBBLES;
-		uint64_t hi_s = (a - lo_s) >> 2;
-		lo_s <<= 2;
-
-		*hi = _mm_set1_epi64(hi_s);
-		*lo = _mm_set1_epi64(lo_s);
-	}
-
-	void split_nibble_shuffle_scalar(uint64_t shuf, uint64_t* hi, uint64_t* lo) {
-		*lo = a & LO_NIBBLES;
-		*hi = (a - *lo) >> 2;
-		*lo <<= 2;
-	}
-	
-	void split_nibble_shuffle(uint64_t shuf, __m128i* hi, __m128i* lo) {
-		uint64_t hi_s, lo_s;
-		split_nibble_shuffle_scalar(shuf, &hi_s, &lo_s);
-		
-		*hi = _mm_set1_epi64x(hi_s);
-		*lo = _mm_set1_epi64x(lo_s);
-	}
-
-	void split_nibble_shuffle(uint64_t shuf, __m256i* hi, __m256i* lo) {
-		uint64_t hi_s, lo_s;
-		split_nibble_shuffle_scalar(shuf, &hi_s, &lo_s);
-		
-		*hi = _mm256_set1_epi64x(hi_s);
-		*lo = _mm256_set1_epi64x(lo_s);
-	}
-
-	void split_nibble_shuffle(uint64_t shuf, __m512i* hi, __m512i* lo) {
-		uint64_t hi_s, lo_s;
-		split_nibble_shuffle_scalar(shuf, &hi_s, &lo_s);
-		
-		*hi = _mm512_set1_epi64(hi_s);
-		*lo = _mm512_set1_epi64(lo_s);
-	}
 #endif
 
 	namespace fallback {
@@ -106,7 +75,7 @@ namespace Analysis {
 		__m128i lo_nibble_msk = _mm_set1_epi8(0x0f);
 
 		__m128i shuf_lo, shuf_hi;
-		split_nibble_shuffle_128(idx, &shuf_hi, &shuf_lo);
+		split_nibble_shuffle(idx, &shuf_hi, &shuf_lo);
 
 		__m128i shuffled_lo = _mm_multishift_epi64_epi8(shuf_lo, data);
 		__m128i shuffled_hi = _mm_multishift_epi64_epi8(shuf_hi, data);
@@ -118,7 +87,7 @@ namespace Analysis {
 		uint64_t s_data[2], s_idx[2], result[2];
 		_mm_storeu_si128((__m128i*) s_data, data);
 		_mm_storeu_si128((__m128i*) s_idx, idx);
-		shuffle_nibbles_arr(s_data, s_idx, result, 2);
+		fallback::shuffle_nibbles_arr(s_data, s_idx, result, 2);
 
 		return _mm_loadu_si128((const __m128i*) result);
 #endif
@@ -133,7 +102,7 @@ namespace Analysis {
 		__m256i lo_nibble_msk = _mm256_set1_epi8(0x0f);
 
 		__m256i shuf_lo, shuf_hi;
-		split_nibble_shuffle_256(idx, &shuf_hi, &shuf_lo);
+		split_nibble_shuffle(idx, &shuf_hi, &shuf_lo);
 
 		__m256i shuffled_lo = _mm256_multishift_epi64_epi8(shuf_lo, data);
 		__m256i shuffled_hi = _mm256_multishift_epi64_epi8(shuf_hi, data);
@@ -141,10 +110,10 @@ namespace Analysis {
 		shuffled_hi = _mm256_slli_epi32(shuffled_hi, 4);
 		return _mm256_ternarylogic_epi32(lo_nibble_msk, shuffled_lo, shuffled_hi, 202);
 #else
-		uint64_t s_data[2], s_idx[2], result[2];
+		uint64_t s_data[4], s_idx[4], result[4];
 		_mm256_storeu_si256((__m256i*) s_data, data);
 		_mm256_storeu_si256((__m256i*) s_idx, idx);
-		shuffle_nibbles_arr(s_data, s_idx, result, 2);
+		fallback::shuffle_nibbles_arr(s_data, s_idx, result, 4);
 
 		return _mm256_loadu_si256((const __m256i*) result);
 #endif
@@ -162,20 +131,21 @@ namespace Analysis {
 		__m512i lo_nibble_msk = _mm512_set1_epi8(0x0f);
 
 		__m512i shuf_lo, shuf_hi;
-		split_nibble_shuffle_512(idx, &shuf_hi, &shuf_lo);
+		split_nibble_shuffle(idx, &shuf_hi, &shuf_lo);
 
 		__m512i shuffled_lo = _mm512_multishift_epi64_epi8(shuf_lo, data);
 		__m512i shuffled_hi = _mm512_multishift_epi64_epi8(shuf_hi, data);
 
 		shuffled_hi = _mm512_slli_epi32(shuffled_hi, 4);
 		return _mm512_ternarylogic_epi32(lo_nibble_msk, shuffled_lo, shuffled_hi, 202);
-#endif
-		uint64_t s_data[2], s_idx[2], result[2];
-		_mm512_storeu_si512((__m512i*) s_data, data);
-		_mm512_storeu_si512((__m512i*) s_idx, idx);
-		shuffle_nibbles_arr(s_data, s_idx, result, 2);
+#else
+		uint64_t s_data[8], s_idx[8], result[8];
+		_mm512_storeu_si512(s_data, data);
+		_mm512_storeu_si512(s_idx, idx);
+		fallback::shuffle_nibbles_arr(s_data, s_idx, result, 8);
 
-		return _mm512_loadu_si512((const __m512i*) result);
+		return _mm512_loadu_si512(result);
+#endif
 	}
 
 	__m512i shuffle_nibbles_same(__m512i data, uint64_t idx) {
@@ -183,59 +153,55 @@ namespace Analysis {
 	}
 #endif  // USE_AVX512_VECTORIZE
 
+#if !defined(USE_NIBBLE_SHUFFLE_VBMI) && defined(__SSSE3__)
+	namespace {
+		// One nibble per byte, in order
+		inline __m128i unpack_nibbles(uint64_t x) {
+			__m128i v = _mm_cvtsi64_si128(x);
+			__m128i lo_msk = _mm_set1_epi8(0xf);
+
+			return _mm_unpacklo_epi8(_mm_and_si128(v, lo_msk), _mm_and_si128(_mm_srli_epi64(v, 4), lo_msk));
+		}
+	}
+#endif
+
 	uint64_t shuffle_nibbles(uint64_t a, uint64_t b) {
 #ifdef USE_NIBBLE_SHUFFLE_VBMI
 		return _mm_cvtsi128_si64(shuffle_nibbles(_mm_cvtsi64_si128(a), _mm_cvtsi64_si128(b)));
+#elif defined(__SSSE3__)
+		// Every x86-64-v2 CPU has pshufb; shuffle the bytes and pack pairs back with byte0 + 16 * byte1
+		__m128i shuffled = _mm_shuffle_epi8(unpack_nibbles(a), unpack_nibbles(b));
+		__m128i packed = _mm_maddubs_epi16(shuffled, _mm_set1_epi16(0x1001));
+
+		return _mm_cvtsi128_si64(_mm_packus_epi16(packed, packed));
 #else
 		return fallback::shuffle_nibbles(a, b);
 #endif
 	}
 
 
-#ifdef USE_NIBBLE_SHUFFLE_VBMI
-	// Prefer vpermi2q	
-	void load_8x64_split(const uint64_t values[8], __m256i* values1, __m256i* values2) {
-		*values1 = _mm256_loadu_si256((const __m256i*) values);	
-		*values2 = _mm256_loadu_si256((const __m256i*) (values + 4));	
-	}
-
-	__m128i shuffle_8x64(__m128i idx, const uint64_t values[8]) {
-		return _mm256_castsi256_si128(
-				shuffle_8x64(_mm256_castsi128_si256(idx), values)
-				);
-
-	}
+#ifdef USE_AVX512_VECTORIZE
+	// Prefer vpermi2q
 	__m256i shuffle_8x64(__m256i idx, const uint64_t values[8]) {
-		__m256i values1, values2;
-		load_8x64_split(&values1, &values2);
+		__m256i values1 = _mm256_loadu_si256((const __m256i*) values);
+		__m256i values2 = _mm256_loadu_si256((const __m256i*) (values + 4));
 
 		return _mm256_permutex2var_epi64(values1, idx, values2);
 	}
-#elif defined(USE_AVX512_VECTORIZE)			
-	__m256i shuffle_8x64(__m256i idx, const uint64_t values[8]) {
-		// vpermq followed by blend based on higher bit
-		__m256i values1, values2;
-		load_8x64_split(&values1, &values2);
 
-		__m256 shuffled1 = _mm256_castsi256_pd(_mm256_permutexvar_epi64(idx, values1));
-		__m256 shuffled2 = _mm256_castsi256_pd(_mm256_permutexvar_epi64(idx, values2));
-
-		__m256 blendv = _mm256_castsi256_pd(_mm256_slli_epi64(idx, 64));
-
-		return _mm256_castpd_si256(_mm256_blendv_pd(shuffled1, shuffled2, blendv));
+	// Prefer 512-bit vpermq for 512-bit vectors
+	__m512i shuffle_8x64(__m512i idx, const uint64_t values[8]) {
+		return _mm512_permutexvar_epi64(idx, _mm512_loadu_si512(values));
 	}
 #elif defined(USE_AVX2_VECTORIZE)
-#error Unimplemented
 	__m256i shuffle_8x64(__m256i idx, const uint64_t values[8]) {
-		// collapse values into two halves, then 2x vpermd
-		__m256i hi_half = _mm256_
-	}
-#endif
+		// A cross-lane 64-bit permute of two sources needs AVX-512, and this is rarely hot, so just index
+		uint64_t s_idx[4], result[4];
+		_mm256_storeu_si256((__m256i*) s_idx, idx);
 
-#ifdef USE_AVX512_VECTORIZE
-	// Prefer 512-bit vpermq for 512-bit vectors
-	__m512i shuffle_8x64(__m512i idx, const uint64_t values[8]) {
-		return _mm512_permutexvar_epi64(idx, values);
+		for (int i = 0; i < 4; ++i) result[i] = values[s_idx[i] & 7];
+
+		return _mm256_loadu_si256((const __m256i*) result);
 	}
 #endif
 
@@ -251,7 +217,7 @@ namespace Analysis {
 		return _mm_movepi16_mask(v);
 #else
 		int m = _mm_movemask_epi8(v);
-		return _pdep_u32(m, 0x5555);
+		return _pext_u32(m, 0x5555);
 #endif
 	}
 
@@ -260,12 +226,12 @@ namespace Analysis {
 		return _mm256_movepi16_mask(v);
 #else
 		int m = _mm256_movemask_epi8(v);
-		return _pdep_u32(m, 0x5555'5555);
+		return _pext_u32(m, 0x5555'5555);
 #endif
 	}
 
 	int detect_4x16_dup(__m128i data) {
-		__m128i xchg = _mm_shuffle_epi32(data, 0b00'01'02'03);
+		__m128i xchg = _mm_shuffle_epi32(data, 0b00'01'10'11);
 		__m128i cmp = _mm_cmpeq_epi16(data, xchg);
 
 		return movemask_epi16(cmp);
@@ -273,8 +239,8 @@ namespace Analysis {
 
 	int detect_4x16_dup(__m256i data) {
 		__m256i xchg1 = _mm256_permute4x64_epi64(data, 0b10'01'00'11);
-		__m256i xchg2 = _mm256_permute4x64_epi64(data, 0b11'10'01'00);
-		__m256i xchg2 = _mm256_permute4x64_epi64(data, 0b00'11'10'01);
+		__m256i xchg2 = _mm256_permute4x64_epi64(data, 0b01'00'11'10);
+		__m256i xchg3 = _mm256_permute4x64_epi64(data, 0b00'11'10'01);
 
 		__m256i cmp = _mm256_cmpeq_epi16(data, xchg1);
 		__m256i cmp2 = _mm256_cmpeq_epi16(data, xchg2);
@@ -335,8 +301,13 @@ namespace Analysis {
 	}
 
 	uint8_t nibble_max(uint64_t data) {
-		assert(0);
-		return 0;
+		uint8_t m = 0;
+		for (int i = 0; i < 16; ++i) {
+			m = max<uint8_t>(m, data & 0xf);
+			data >>= 4;
+		}
+
+		return m;
 	}
 
 	uint64_t nibble_row_max(uint64_t data) {
@@ -365,80 +336,91 @@ namespace Analysis {
 	}
 
 #ifdef USE_X86_VECTORIZE
+	// The vector nibble ops split each byte into its two nibbles with a mask and a 16-bit shift, and then work bytewise.
+	// Sums across the 16 nibbles of an element are done with vpsadbw against zero.
+
 	__m128i mask_zero_nibbles(__m128i data) {
-		// split into hi half and low half, followed by 2x pcmpeqb and then ternlogd
 		const __m128i zero = _mm_setzero_si128();
 		const __m128i low_nibbles = _mm_set1_epi8(0xf);
 
-		__m128i lo_half = _mm_and_si128(low_nibbles, data);
-		__m128i hi_half = _mm_andnot_si128(low_nibbles, data);
+		__m128i lo_zero = _mm_cmpeq_epi8(_mm_and_si128(low_nibbles, data), zero);
+		__m128i hi_zero = _mm_cmpeq_epi8(_mm_andnot_si128(low_nibbles, data), zero);
 
-#ifdef USE_AVX2_VECTORIZE
-		return _mm_or_si128(_mm_and_si128(lo_half, low_nibbles), _mm_andnot_si128(low_nibbles, hi_half));
-#else
-		return _mm_ternarylogic_epi32(low_nibbles, hi_half, lo_half, 172); // low_nibbles ? lo_half : hi_half
-#endif
+		return _mm_or_si128(_mm_and_si128(low_nibbles, lo_zero), _mm_andnot_si128(low_nibbles, hi_zero));
 	}
 
 	__m256i mask_zero_nibbles(__m256i data) {
-		// split into hi half and low half, followed by 2x pcmpeqb and then ternlogd
-		const __m256i zero = _mm256_setzero_si128();
+		const __m256i zero = _mm256_setzero_si256();
 		const __m256i low_nibbles = _mm256_set1_epi8(0xf);
 
-		__m256i lo_half = _mm256_and_si128(low_nibbles, data);
-		__m256i hi_half = _mm256_andnot_si128(low_nibbles, data);
+		__m256i lo_zero = _mm256_cmpeq_epi8(_mm256_and_si256(low_nibbles, data), zero);
+		__m256i hi_zero = _mm256_cmpeq_epi8(_mm256_andnot_si256(low_nibbles, data), zero);
 
-#ifdef USE_AVX2_VECTORIZE
-		return _mm256_or_si128(_mm256_and_si128(lo_half, low_nibbles), _mm256_andnot_si128(low_nibbles, hi_half));
-#else
-		return _mm256_ternarylogic_epi32(low_nibbles, hi_half, lo_half, 172); // low_nibbles ? lo_half : hi_half
-#endif
+		return _mm256_or_si256(_mm256_and_si256(low_nibbles, lo_zero), _mm256_andnot_si256(low_nibbles, hi_zero));
 	}
 
-	__m128i not_si128(__m128i a) {
-#ifdef USE_AVX2_VECTORIZE
-		return _mm_xor_si128(_mm_set1_epi32(1), a);
-#else
-		return _mm_ternarylogic_epi32(a, a, a, 0x55);
-#endif
+	// Count, in each 64-bit element, the number of nonzero nibbles
+	__m128i count_tiles(__m128i data) {
+		const __m128i low_nibbles = _mm_set1_epi8(0xf);
+		const __m128i one = _mm_set1_epi8(1);
+
+		__m128i lo = _mm_min_epu8(_mm_and_si128(low_nibbles, data), one);
+		__m128i hi = _mm_min_epu8(_mm_and_si128(low_nibbles, _mm_srli_epi16(data, 4)), one);
+
+		return _mm_sad_epu8(_mm_add_epi8(lo, hi), _mm_setzero_si128());
 	}
 
-	__m256i not_si256(__m256i a) {
-#ifdef USE_AVX2_VECTORIZE	
-		return _mm256_xor_si256(_mm256_set1_epi32(1), a);
-#else
-		return _mm256_ternarylogic_epi32(a, a, a, 0x55);
-#endif
+	__m256i count_tiles(__m256i data) {
+		const __m256i low_nibbles = _mm256_set1_epi8(0xf);
+		const __m256i one = _mm256_set1_epi8(1);
+
+		__m256i lo = _mm256_min_epu8(_mm256_and_si256(low_nibbles, data), one);
+		__m256i hi = _mm256_min_epu8(_mm256_and_si256(low_nibbles, _mm256_srli_epi16(data, 4)), one);
+
+		return _mm256_sad_epu8(_mm256_add_epi8(lo, hi), _mm256_setzero_si256());
 	}
 
-	// Count, in each 64-bit element, the number of nonzero nibbles
-	__m128i count_tiles(__m128i data) {
-#if defined(USE_AVX512_VECTORIZE) && defined(__AVX512VPOPCNTDQ__)
-		return _mm_srli_epi32(_mm_popcnt_epi64(not_si128(mask_zero_nibbles(data))), 2);
-#else // USE_AVX2_VECTORIZE
-		// No vectorized popcount, so split into 64-bit elements and enjoy
-		uint64_t d[2];
-		_mm_storeu_si128((__m128i*) d, data);
+	__m128i count_empty(__m128i data) {
+		return _mm_sub_epi64(_mm_set1_epi64x(16), count_tiles(data));
+	}
 
-		d[0] = count_tiles(d[0]);
-		d[1] = count_tiles(d[1]);
+	__m256i count_empty(__m256i data) {
+		return _mm256_sub_epi64(_mm256_set1_epi64x(16), count_tiles(data));
+	}
 
-		return _mm_loadu_si128((const __m128i*) d);
-#endif
+	// Low and high bytes of 1 << n for each nibble value n, with 0 for the empty square
+#define TILE_SUM_LO_BYTES 0, 2, 4, 8, 16, 32, 64, (char)128, 0, 0, 0, 0, 0, 0, 0, 0
+#define TILE_SUM_HI_BYTES 0, 0, 0, 0, 0, 0, 0, 0, 1, 2, 4, 8, 16, 32, 64, (char)128
+
+	__m128i tile_sum(__m128i data) {
+		const __m128i low_nibbles = _mm_set1_epi8(0xf);
+		const __m128i lo_bytes = _mm_setr_epi8(TILE_SUM_LO_BYTES);
+		const __m128i hi_bytes = _mm_setr_epi8(TILE_SUM_HI_BYTES);
+		const __m128i zero = _mm_setzero_si128();
+
+		__m128i lo = _mm_and_si128(low_nibbles, data);
+		__m128i hi = _mm_and_si128(low_nibbles, _mm_srli_epi16(data, 4));
+
+		// Each byte sum is at most 32 * 128, so the two halves can't collide
+		__m128i sum_lo = _mm_add_epi64(_mm_sad_epu8(_mm_shuffle_epi8(lo_bytes, lo), zero), _mm_sad_epu8(_mm_shuffle_epi8(lo_bytes, hi), zero));
+		__m128i sum_hi = _mm_add_epi64(_mm_sad_epu8(_mm_shuffle_epi8(hi_bytes, lo), zero), _mm_sad_epu8(_mm_shuffle_epi8(hi_bytes, hi), zero));
+
+		return _mm_add_epi64(sum_lo, _mm_slli_epi64(sum_hi, 8));
 	}
 
-	__m256i count_tiles(__m256i data) {
-#if defined(USE_AVX512_VECTORIZE) && defined(__AVX512VPOPCNTDQ__)
-		return _mm256_srli_epi32(_mm256_popcnt_epi64(not_si256(mask_zero_nibbles(data))), 2); // popcnt, then divide by 4
-#else // USE_AVX2_VECTORIZE
-		uint64_t d[4];
-		_mm256_storeu_si256((__m256i*) d, data);
+	__m256i tile_sum(__m256i data) {
+		const __m256i low_nibbles = _mm256_set1_epi8(0xf);
+		const __m256i lo_bytes = _mm256_setr_epi8(TILE_SUM_LO_BYTES, TILE_SUM_LO_BYTES);
+		const __m256i hi_bytes = _mm256_setr_epi8(TILE_SUM_HI_BYTES, TILE_SUM_HI_BYTES);
+		const __m256i zero = _mm256_setzero_si256();
 
-		for (int i = 0; i < 4; ++i)
-			d[i] = count_tiles(d[i]);
+		__m256i lo = _mm256_and_si256(low_nibbles, data);
+		__m256i hi = _mm256_and_si256(low_nibbles, _mm256_srli_epi16(data, 4));
 
-		return _mm256_loadu_si256((const __m256i*) d);
-#endif
+		__m256i sum_lo = _mm256_add_epi64(_mm256_sad_epu8(_mm256_shuffle_epi8(lo_bytes, lo), zero), _mm256_sad_epu8(_mm256_shuffle_epi8(lo_bytes, hi), zero));
+		__m256i sum_hi = _mm256_add_epi64(_mm256_sad_epu8(_mm256_shuffle_epi8(hi_bytes, lo), zero), _mm256_sad_epu8(_mm256_shuffle_epi8(hi_bytes, hi), zero));
+
+		return _mm256_add_epi64(sum_lo, _mm256_slli_epi64(sum_hi, 8));
 	}
 
 	uint8_t cmp64_to_mask(__m128i a, __m128i b) {
@@ -450,11 +432,51 @@ namespace Analysis {
 	}
 
 #ifdef USE_AVX512_VECTORIZE
+	__m512i mask_zero_nibbles(__m512i data) {
+		const __m512i low_nibbles = _mm512_set1_epi8(0xf);
+
+		__mmask64 lo_zero = _mm512_testn_epi8_mask(data, low_nibbles);
+		__mmask64 hi_zero = _mm512_testn_epi8_mask(data, _mm512_set1_epi8((char)0xf0));
+
+		return _mm512_ternarylogic_epi32(low_nibbles, _mm512_movm_epi8(lo_zero), _mm512_movm_epi8(hi_zero), 0xca);
+	}
+
+	__m512i count_tiles(__m512i data) {
+		const __m512i low_nibbles = _mm512_set1_epi8(0xf);
+		const __m512i one = _mm512_set1_epi8(1);
+
+		__m512i lo = _mm512_min_epu8(_mm512_and_si512(low_nibbles, data), one);
+		__m512i hi = _mm512_min_epu8(_mm512_and_si512(low_nibbles, _mm512_srli_epi16(data, 4)), one);
+
+		return _mm512_sad_epu8(_mm512_add_epi8(lo, hi), _mm512_setzero_si512());
+	}
+
+	__m512i count_empty(__m512i data) {
+		return _mm512_sub_epi64(_mm512_set1_epi64(16), count_tiles(data));
+	}
+
+	__m512i tile_sum(__m512i data) {
+		const __m512i low_nibbles = _mm512_set1_epi8(0xf);
+		const __m512i lo_bytes = _mm512_broadcast_i32x4(_mm_setr_epi8(TILE_SUM_LO_BYTES));
+		const __m512i hi_bytes = _mm512_broadcast_i32x4(_mm_setr_epi8(TILE_SUM_HI_BYTES));
+		const __m512i zero = _mm512_setzero_si512();
+
+		__m512i lo = _mm512_and_si512(low_nibbles, data);
+		__m512i hi = _mm512_and_si512(low_nibbles, _mm512_srli_epi16(data, 4));
+
+		__m512i sum_lo = _mm512_add_epi64(_mm512_sad_epu8(_mm512_shuffle_epi8(lo_bytes, lo), zero), _mm512_sad_epu8(_mm512_shuffle_epi8(lo_bytes, hi), zero));
+		__m512i sum_hi = _mm512_add_epi64(_mm512_sad_epu8(_mm512_shuffle_epi8(hi_bytes, lo), zero), _mm512_sad_epu8(_mm512_shuffle_epi8(hi_bytes, hi), zero));
+
+		return _mm512_add_epi64(sum_lo, _mm512_slli_epi64(sum_hi, 8));
+	}
+
 	uint8_t cmp64_to_mask(__m512i a, __m512i b) {
-		return _mm512_castsi512_pd(_mm512_cmpeq_epi64_mask(a, b));
+		return _mm512_cmpeq_epi64_mask(a, b);
 	}
 #endif
 
+#undef TILE_SUM_LO_BYTES
+#undef TILE_SUM_HI_BYTES
 
 #endif // USE_X86_VECTORIZE
 	void grab_empty_idxs(uint64_t data, uint8_t* idxs, int* count) {
@@ -470,6 +492,8 @@ namespace Analysis {
 	}
 
 	void dedup_positions_consecutive(const uint64_t* __restrict__ positions, int count, uint64_t* __restrict__ results, int* result_freqs, int* result_count) {
+		ANALYSIS_PERF_REGION("dedup/consecutive");
+
 		if (unlikely(count == 0)) {
 			*result_count = 0;
 			return;
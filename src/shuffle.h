@@ -33,7 +33,72 @@ namespace Analysis {
 #undef PERM_64
 	}
 
-	// Shuffle a 64-bit chunk of 16 nibbles by indices in idx, choosing the best implementation at run time
+	namespace detail {
+		// GCC vector types, for SWAR code written once for every width. Casts to and from __m128i etc. are free. They
+		// need no particular instruction set: GCC lowers them to whatever the function is compiled for.
+		typedef uint64_t u64x2 __attribute__((vector_size(16)));
+		typedef uint64_t u64x4 __attribute__((vector_size(32)));
+		typedef uint64_t u64x8 __attribute__((vector_size(64)));
+	}
+
+	namespace detail {
+		// Exchange the bits of x selected by msk with those shift bits above them
+		template <typename T>
+		FORCE_INLINE T delta_swap(T x, uint64_t msk, int shift) {
+			T t = (x ^ (x >> shift)) & msk;
+			return x ^ t ^ (t << shift);
+		}
+
+		template <typename T>
+		FORCE_INLINE T flip_h(T x) {
+			x = ((x & 0x0f0f'0f0f'0f0f'0f0f) << 4) | ((x >> 4) & 0x0f0f'0f0f'0f0f'0f0f);
+			return ((x & 0x00ff'00ff'00ff'00ff) << 8) | ((x >> 8) & 0x00ff'00ff'00ff'00ff);
+		}
+
+		template <typename T>
+		FORCE_INLINE T flip_v(T x) {
+			x = ((x & 0x0000'ffff'0000'ffff) << 16) | ((x >> 16) & 0x0000'ffff'0000'ffff);
+			return (x << 32) | (x >> 32);
+		}
+
+		template <typename T>
+		FORCE_INLINE T transpose(T x) {
+			x = delta_swap(x, 0x0000'f0f0'0000'f0f0, 12);
+			return delta_swap(x, 0x0000'0000'ff00'ff00, 24);
+		}
+	}
+
+	// The generating symmetries, equivalent to shuffle_nibbles by constants::reflect_h, reflect_v and reflect_tl but
+	// a handful of shifts and masks each. Every other symmetry is a composition of these; rotate_90 is
+	// transpose(flip_h(x)), for example.
+#define DEFINE_SYMMETRY(name) \
+	inline uint64_t name(uint64_t x) { return detail::name(x); }
+#define DEFINE_SYMMETRY_V(name, V, E) \
+	inline V name(V x) { return (V)detail::name((detail::E)x); }
+
+	DEFINE_SYMMETRY(flip_h)
+	DEFINE_SYMMETRY(flip_v)
+	DEFINE_SYMMETRY(transpose)
+
+#ifdef USE_X86_VECTORIZE
+	DEFINE_SYMMETRY_V(flip_h, __m128i, u64x2)
+	DEFINE_SYMMETRY_V(flip_v, __m128i, u64x2)
+	DEFINE_SYMMETRY_V(transpose, __m128i, u64x2)
+	DEFINE_SYMMETRY_V(flip_h, __m256i, u64x4)
+	DEFINE_SYMMETRY_V(flip_v, __m256i, u64x4)
+	DEFINE_SYMMETRY_V(transpose, __m256i, u64x4)
+#ifdef USE_AVX512_VECTORIZE
+	DEFINE_SYMMETRY_V(flip_h, __m512i, u64x8)
+	DEFINE_SYMMETRY_V(flip_v, __m512i, u64x8)
+	DEFINE_SYMMETRY_V(transpose, __m512i, u64x8)
+#endif
+#endif
+
+#undef DEFINE_SYMMETRY
+#undef DEFINE_SYMMETRY_V
+
+	// Shuffle a 64-bit chunk of 16 nibbles by indices in idx, with the best implementation the build targets: VBMI,
+	// else SSSE3 byte shuffles, else a loop
 	uint64_t shuffle_nibbles(uint64_t data, uint64_t idx);
 	// generate 4-bits one for each zero nibble, and 4-bits zero for each nonzero nibble
 	uint64_t mask_zero_nibbles(uint64_t data);	
@@ -58,7 +123,7 @@ namespace Analysis {
 	// Whether generated is a valid next-tile position from the base position
 	bool is_valid_gen_tile(uint64_t generated, uint64_t base);
 
-#if USE_X86_VECTORIZE
+#ifdef USE_X86_VECTORIZE
 	// Shuffle 64-bit chunks of nibbles in parallel
 	__m128i shuffle_nibbles(__m128i data, __m128i idx);
 	__m256i shuffle_nibbles(__m256i data, __m256i idx);
@@ -80,7 +145,7 @@ namespace Analysis {
 
 	// Return 4 bits indicating whether there are any 16-bit values duplicated across 2, 4, or 8 elements, in that position
 
-#if USE_X86_VECTORIZE
+#ifdef USE_X86_VECTORIZE
 	int detect_4x16_dup(__m128i data);
 	int detect_4x16_dup(__m256i data);
 #endif
@@ -91,8 +156,9 @@ namespace Analysis {
 	
 
 #ifdef USE_X86_VECTORIZE
-	__m128i mask_zero_nibbles(__m128i, __m128i);
-	__m256i mask_zero_nibbles(__m256i, __m256i);
+	// As the scalar versions, in each 64-bit element
+	__m128i mask_zero_nibbles(__m128i);
+	__m256i mask_zero_nibbles(__m256i);
 
 	__m128i count_tiles(__m128i);
 	__m256i count_tiles(__m256i);
@@ -100,9 +166,17 @@ namespace Analysis {
 	__m128i count_empty(__m128i);
 	__m256i count_empty(__m256i);
 
+	__m128i tile_sum(__m128i);
+	__m256i tile_sum(__m256i);
+
 	uint8_t cmp64_to_mask(__m128i, __m128i);
 	uint8_t cmp64_to_mask(__m256i, __m256i);
 #ifdef USE_AVX512_VECTORIZE
+	__m512i mask_zero_nibbles(__m512i);
+	__m512i count_tiles(__m512i);
+	__m512i count_empty(__m512i);
+	__m512i tile_sum(__m512i);
+
 	uint8_t cmp64_to_mask(__m512i, __m512i);
 #endif
 #endif
@@ -111,8 +185,8 @@ namespace Analysis {
 		uint64_t shuffle_nibbles(uint64_t data, uint64_t idx);
 
 		// Shuffle entries in array
-		void shuffle_nibbles_arr(uint64_t* result, const uint64_t* data, const uint64_t* idx, int len);
-		void shuffle_nibbles_arr_same(uint64_t* result, const uint64_t* data, int len, uint64_t idx);
+		void shuffle_nibbles_arr(const uint64_t* data, const uint64_t* idx, uint64_t* result, int len);
+		void shuffle_nibbles_arr_same(const uint64_t* data, uint64_t idx, uint64_t* result, int len);
 
 		template <int cnt>
 		std::array<uint64_t, cnt> shuffle_8x64(std::array<uint64_t, cnt> idxs, const uint64_t values[8]) {
@@ -0,0 +1,119 @@
+#include "transposition.h"
+
+#include <cstring>
+
+namespace Analysis {
+	namespace {
+		// data word layout: value in bits 0-31, depth in 32-39, bound in 40-41, and a valid bit at 63 so that a zeroed
+		// slot isn't mistaken for an entry of the empty board
+		constexpr uint64_t VALID_BIT = 1ULL << 63;
+
+		uint64_t pack_entry(float value, int depth, Bound bound) {
+			uint32_t value_bits;
+			memcpy(&value_bits, &value, sizeof(float));
+
+			return VALID_BIT | ((uint64_t)bound << 40) | ((uint64_t)(uint8_t)depth << 32) | value_bits;
+		}
+
+		TTEntry unpack_entry(uint64_t data) {
+			TTEntry e;
+			uint32_t value_bits = (uint32_t)data;
+
+			memcpy(&e.value, &value_bits, sizeof(float));
+			e.depth = (uint8_t)(data >> 32);
+			e.bound = (Bound)((data >> 40) & 0x3);
+
+			return e;
+		}
+
+		int entry_depth(uint64_t data) {
+			return (data & VALID_BIT) ? (int)(uint8_t)(data >> 32) : -1;
+		}
+	}
+
+	TranspositionTable::TranspositionTable(size_t memory_budget, ReplacementPolicy policy) : policy(policy) {
+		if (memory_budget < sizeof(Bucket)) {
+			fprintf(stderr, "Transposition table budget of %zu bytes is smaller than one bucket\n", memory_budget);
+			abort();
+		}
+
+		bucket_count = 1;
+		while (bucket_count * 2 * sizeof(Bucket) <= memory_budget) bucket_count *= 2;
+
+		buckets.reset(new Bucket[bucket_count]);
+		clear();
+	}
+
+	void TranspositionTable::clear() {
+		for (size_t i = 0; i < bucket_count; ++i) {
+			for (Slot& s : buckets[i].slots) {
+				s.check.store(0, std::memory_order_relaxed);
+				s.data.store(0, std::memory_order_relaxed);
+			}
+		}
+	}
+
+	bool TranspositionTable::probe(uint64_t canonical, TTEntry* entry) const {
+		const Bucket& b = buckets[hash_tiles(canonical) & (bucket_count - 1)];
+
+		for (const Slot& s : b.slots) {
+			uint64_t data = s.data.load(std::memory_order_relaxed);
+			uint64_t check = s.check.load(std::memory_order_relaxed);
+
+			if ((data & VALID_BIT) && (check ^ data) == canonical) {
+				*entry = unpack_entry(data);
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	void TranspositionTable::store(uint64_t canonical, float value, int depth, Bound bound) {
+		assert(depth >= 0 && depth < 256);
+
+		uint64_t hash = hash_tiles(canonical);
+		Bucket& b = buckets[hash & (bucket_count - 1)];
+
+		uint64_t data = pack_entry(value, depth, bound);
+		uint64_t old_data[2];
+		int match = -1;
+
+		for (int i = 0; i < 2; ++i) {
+			old_data[i] = b.slots[i].data.load(std::memory_order_relaxed);
+			uint64_t check = b.slots[i].check.load(std::memory_order_relaxed);
+
+			if ((old_data[i] & VALID_BIT) && (check ^ old_data[i]) == canonical) match = i;
+		}
+
+		int target;
+		switch (policy) {
+			case ReplacementPolicy::ALWAYS_REPLACE:
+				target = (match >= 0) ? match : (int)(hash >> 63);
+				break;
+			case ReplacementPolicy::DEPTH_PREFERRED:
+				if (match >= 0) {
+					target = match;
+				} else {
+					target = entry_depth(old_data[0]) <= entry_depth(old_data[1]) ? 0 : 1;
+				}
+
+				if (depth < entry_depth(old_data[target])) return;
+				break;
+			case ReplacementPolicy::TWO_TIER:
+			default:
+				target = (depth >= entry_depth(old_data[0]) || match == 0) ? 0 : 1;
+				break;
+		}
+
+		Slot& s = b.slots[target];
+		s.check.store(canonical ^ data, std::memory_order_relaxed);
+		s.data.store(data, std::memory_order_relaxed);
+
+		// An entry promoted to the depth-preferred slot leaves a stale copy behind
+		if (match >= 0 && match != target) {
+			b.slots[match].check.store(0, std::memory_order_relaxed);
+			b.slots[match].data.store(0, std::memory_order_relaxed);
+		}
+	}
+}
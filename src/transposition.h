@@ -0,0 +1,73 @@
+/**
+ * Fixed-size, open-addressed, lock-free transposition table keyed on canonical positions, so that all eight symmetric
+ * variants of a position share one entry.
+ *
+ * Each slot is two 64-bit words, data and key ^ data, written with relaxed atomic stores (Hyatt's "lockless hashing").
+ * Two threads storing to one slot at once can leave it holding one thread's key word and the other's data word, but then
+ * the XOR no longer matches the key and the probe reads a miss rather than a wrong value. Slots are grouped into 32-byte
+ * buckets of two, and the number of buckets is the largest power of two fitting in the memory budget.
+ */
+#pragma once
+
+#include "defs.h"
+#include "position.h"
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+namespace Analysis {
+	enum class Bound : uint8_t {
+		EXACT = 0,
+		LOWER = 1,   // true value is at least the stored value
+		UPPER = 2    // true value is at most the stored value
+	};
+
+	enum class ReplacementPolicy : uint8_t {
+		// Overwrite the shallower slot of the bucket, but never with a shallower entry
+		DEPTH_PREFERRED,
+		// Overwrite one slot of the bucket (chosen by hash) unconditionally
+		ALWAYS_REPLACE,
+		// First slot is depth-preferred, second slot takes whatever the first rejects
+		TWO_TIER
+	};
+
+	struct TTEntry {
+		float value;
+		uint8_t depth;
+		Bound bound;
+	};
+
+	class TranspositionTable {
+		struct Slot {
+			std::atomic<uint64_t> check;  // key ^ data
+			std::atomic<uint64_t> data;
+		};
+
+		struct alignas(32) Bucket {
+			Slot slots[2];
+		};
+
+		std::unique_ptr<Bucket[]> buckets;
+		size_t bucket_count;
+		ReplacementPolicy policy;
+
+		public:
+		// Allocates the largest table fitting in memory_budget bytes; the budget must fit at least one bucket
+		TranspositionTable(size_t memory_budget, ReplacementPolicy policy=ReplacementPolicy::TWO_TIER);
+
+		TranspositionTable(const TranspositionTable&) = delete;
+		TranspositionTable& operator=(const TranspositionTable&) = delete;
+
+		// canonical must be the output of canonical_position. Returns whether an entry was found.
+		bool probe(uint64_t canonical, TTEntry* entry) const;
+		void store(uint64_t canonical, float value, int depth, Bound bound=Bound::EXACT);
+
+		// Not safe to call concurrently with probe or store
+		void clear();
+
+		size_t capacity() const { return bucket_count * 2; }
+		size_t memory_usage() const { return bucket_count * sizeof(Bucket); }
+		ReplacementPolicy replacement_policy() const { return policy; }
+	};
+}
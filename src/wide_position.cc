@@ -0,0 +1,170 @@
+/**
+ * Implementation of the byte-per-square extended position format
+ */
+
+#include "wide_position.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace Analysis {
+	WidePosition::WidePosition(Position p) {
+		for (int i = 0; i < 16; ++i) tiles[i] = p.get_tile(i);
+	}
+
+	WidePosition::WidePosition(std::array<uint32_t, 16> values) {
+		for (int i = 0; i < 16; ++i) tiles[i] = tile_to_repr(values[i], true);
+	}
+
+	uint64_t WidePosition::tile_sum() const {
+		uint64_t sum = 0;
+		for (uint8_t t : tiles) sum += t ? 1ULL << t : 0;
+
+		return sum;
+	}
+
+	uint8_t WidePosition::max_tile() const {
+		return *std::max_element(tiles.begin(), tiles.end());
+	}
+
+	bool WidePosition::fits_nibbles() const {
+		return max_tile() <= 15;
+	}
+
+	Position WidePosition::narrow() const {
+		assert(fits_nibbles());
+
+		Position p;
+		for (int i = 0; i < 16; ++i) p.set_tile(i, tiles[i]);
+
+		return p;
+	}
+
+	WidePosition WidePosition::perm(uint64_t nibble_shuffle) const {
+		// Same convention as shuffle_nibbles: square i of the result is square (nibble i of the shuffle) of this
+		WidePosition p;
+		for (int i = 0; i < 16; ++i) p.tiles[i] = tiles[(nibble_shuffle >> (4 * i)) & 0xf];
+
+		return p;
+	}
+
+	WidePosition WidePosition::rotate_90() const { return perm(constants::rotate_90); }
+	WidePosition WidePosition::rotate_180() const { return perm(constants::rotate_180); }
+	WidePosition WidePosition::rotate_270() const { return perm(constants::rotate_270); }
+	WidePosition WidePosition::reflect_h() const { return perm(constants::reflect_h); }
+	WidePosition WidePosition::reflect_v() const { return perm(constants::reflect_v); }
+	WidePosition WidePosition::reflect_tl() const { return perm(constants::reflect_tl); }
+	WidePosition WidePosition::reflect_tr() const { return perm(constants::reflect_tr); }
+
+	WidePosition WidePosition::move_right(bool* successful) const {
+		WidePosition p;
+
+		for (int row = 0; row < 16; row += 4) {
+			// Walk from the right edge, merging each tile with the next one if they match and it hasn't merged yet
+			int w = row + 3;
+			uint8_t pending = 0;
+
+			for (int i = row + 3; i >= row; --i) {
+				uint8_t t = tiles[i];
+				if (!t) continue;
+
+				if (t == pending) {
+					p.tiles[w--] = t + 1;
+					pending = 0;
+				} else {
+					if (pending) p.tiles[w--] = pending;
+					pending = t;
+				}
+			}
+
+			if (pending) p.tiles[w] = pending;
+		}
+
+		*successful = p != *this;
+		return p;
+	}
+
+	WidePosition WidePosition::move_left(bool* successful) const {
+		return rotate_180().move_right(successful).rotate_180();
+	}
+
+	WidePosition WidePosition::move_up(bool* successful) const {
+		return rotate_270().move_right(successful).rotate_90();
+	}
+
+	WidePosition WidePosition::move_down(bool* successful) const {
+		return rotate_90().move_right(successful).rotate_270();
+	}
+
+	WidePosition WidePosition::move(Direction dir, bool* successful) const {
+		switch (dir) {
+			case RIGHT: return move_right(successful);
+			case LEFT: return move_left(successful);
+			case UP: return move_up(successful);
+			case DOWN: return move_down(successful);
+		}
+
+		*successful = false;
+		return *this;
+	}
+
+	WidePosition WidePosition::canonical() const {
+		if (fits_nibbles()) return WidePosition{ Position{ canonical_position(narrow().tiles) } };
+
+		auto greater = [] (const WidePosition& a, const WidePosition& b) {
+			return std::lexicographical_compare(b.tiles.rbegin(), b.tiles.rend(), a.tiles.rbegin(), a.tiles.rend());
+		};
+
+		WidePosition best = *this;
+		for (WidePosition p : { rotate_90(), rotate_180(), rotate_270(), reflect_h(), reflect_v(), reflect_tl(), reflect_tr() }) {
+			if (greater(p, best)) best = p;
+		}
+
+		return best;
+	}
+
+	char* WidePosition::to_string() const {
+		char out[400];
+		char* end = out;
+
+		for (int i = 0; i < 16; ++i) {
+			end += sprintf(end, "%llu", tiles[i] ? 1ULL << tiles[i] : 0ULL);
+			*end++ = (i % 4 == 3) ? '\n' : '\t';
+		}
+
+		*end++ = '\0';
+
+		int len;
+
+		char* s = (char*)malloc(len = end - out);
+		memcpy(s, out, len);
+
+		return s;
+	}
+
+	bool move_checked(uint64_t tiles, Direction dir, uint64_t* result) {
+		if (likely(!may_overflow(tiles))) {
+			*result = move_in_direction(tiles, dir);
+			return true;
+		}
+
+		bool s;
+		WidePosition w = WidePosition{ Position{ tiles } }.move(dir, &s);
+		if (!w.fits_nibbles()) return false;
+
+		*result = w.narrow().tiles;
+		return true;
+	}
+
+	uint8_t overflowing_moves(uint64_t tiles) {
+		if (likely(!may_overflow(tiles))) return 0;
+
+		uint8_t mask = 0;
+		for (Direction d : { RIGHT, LEFT, UP, DOWN }) {
+			uint64_t moved;
+			if (!move_checked(tiles, d, &moved)) mask |= 1 << d;
+		}
+
+		return mask;
+	}
+}
@@ -0,0 +1,77 @@
+/**
+ * Positions with tiles above 32768, which don't fit the nibble format. Each square gets a byte holding the tile's
+ * representation (log2, 0 = empty), in the same order as the nibbles of Position, so a board is 16 bytes and fits one
+ * SSE register. Only the rare boards which merge two 32768s need this: move_checked does nibble moves and reports when
+ * one would overflow, so callers can promote the board and carry on here.
+ *
+ * This is a reference implementation, much like Position: correct, not fast.
+ */
+#pragma once
+
+#include "defs.h"
+#include "position.h"
+#include "move_lut.h"
+
+#include <array>
+
+namespace Analysis {
+	struct WidePosition {
+		std::array<uint8_t, 16> tiles{};
+
+		WidePosition() = default;
+		explicit WidePosition(Position p);
+		// Takes in the powers of two, NOT the underlying representation
+		explicit WidePosition(std::array<uint32_t, 16> values);
+
+		uint8_t get_tile(int idx) const { return tiles[idx]; }
+		WidePosition& set_tile(int idx, uint8_t repr) { tiles[idx] = repr; return *this; }
+
+		uint64_t tile_sum() const;
+		uint8_t max_tile() const;
+
+		// Whether every tile is at most 32768, so that narrow() is lossless
+		bool fits_nibbles() const;
+		Position narrow() const;
+
+		WidePosition perm(uint64_t nibble_shuffle) const;
+
+		WidePosition identity() const { return *this; }
+		WidePosition rotate_90() const;
+		WidePosition rotate_180() const;
+		WidePosition rotate_270() const;
+		WidePosition reflect_h() const;
+		WidePosition reflect_v() const;
+		WidePosition reflect_tl() const;
+		WidePosition reflect_tr() const;
+
+		WidePosition move_right(bool* successful) const;
+		WidePosition move_up(bool* successful) const;
+		WidePosition move_left(bool* successful) const;
+		WidePosition move_down(bool* successful) const;
+		WidePosition move(Direction dir, bool* successful) const;
+
+		// The same representative as canonical_position when the board fits nibbles; otherwise the largest of the
+		// eight symmetries, comparing from square 15 down
+		WidePosition canonical() const;
+
+		char* to_string() const;
+
+		bool operator==(const WidePosition& b) const noexcept { return tiles == b.tiles; }
+		bool operator!=(const WidePosition& b) const noexcept { return tiles != b.tiles; }
+	};
+
+	// Whether the board holds two or more 32768s; without them no move can overflow
+	inline bool may_overflow(uint64_t tiles) {
+		uint64_t f = tiles & (tiles >> 1) & (tiles >> 2) & (tiles >> 3) & 0x1111'1111'1111'1111;  // a bit per 32768
+		return f & (f - 1);
+	}
+
+	// Move in the nibble format, unless that would merge two 32768s. Returns false in that case and leaves result
+	// alone; the caller should promote to WidePosition and move there. Costs a few bit operations unless the board
+	// holds two or more 32768s.
+	bool move_checked(uint64_t tiles, Direction dir, uint64_t* result);
+
+	// The directions in which move_checked would fail, as bits like AllMoves::legal_mask. Callers which already have
+	// the nibble moves can test may_overflow first and only then call this.
+	uint8_t overflowing_moves(uint64_t tiles);
+}
@@ -1,28 +1,58 @@
 #include "helper.h"
 
+#include <atomic>
+#include <filesystem>
+
+#include <unistd.h>
+
 namespace Analysis {
 	namespace Test {
 		Position random_positions[RANDOM_POSITIONS_CNT];
 
-		Position from_u32(uint32_t a) {
-			uint64_t v = 0;
+		void fill_random_test_positions() {
+			for (int i = 0; i < RANDOM_POSITIONS_CNT; ++i) {
+				uint64_t t = hash_tiles(i + 1);
+
+				// Full boards with every tile, boards without 32768s, sparse ones, and small tiles which merge a lot
+				switch (i % 4) {
+					case 0: break;
+					case 1: t &= 0x7777'7777'7777'7777; break;
+					case 2: t &= 0x0ff0'f00f'0f0f'f0f0; break;
+					case 3: t &= 0x3333'3333'3333'3333; break;
+				}
 
-			for (int i = 0; i < 16; ++i) {
-				v |= (a & (0x3 << (2 * i))) << (2 * i);
+				random_positions[i] = Position(t);
 			}
+		}
+
+		std::vector<uint64_t> random_boards(uint64_t seed, size_t count, std::initializer_list<uint64_t> masks) {
+			std::vector<uint64_t> boards(count);
+			uint64_t k = seed;
 
-			return Position(v);
+			for (size_t i = 0; i < count; ++i) {
+				k = lcg_next(k);
+				boards[i] = k & masks.begin()[i % masks.size()];
+			}
 
+			return boards;
 		}
 
-		void fill_random_test_positions() {
-			uint64_t kk = 0;
-			for (int i = 0; i < 10000; ++i) {
-				random_positions[i] = from_u32(kk >> 13);
+		TempPath::TempPath(const std::string& name) {
+			static std::atomic<int> next{ 0 };
 
-				kk *= 4029302011;
-				kk += 35021;
-			}
+			std::string unique = name + "_" + std::to_string(getpid()) + "_" + std::to_string(next++);
+			path = (std::filesystem::temp_directory_path() / unique).string();
+		}
+
+		TempPath::~TempPath() {
+			std::error_code ec;  // nothing may have been written there
+			std::filesystem::remove_all(path, ec);
+		}
+
+		namespace {
+			struct FillAtStartup {
+				FillAtStartup() { fill_random_test_positions(); }
+			} fill_at_startup;
 		}
 	}
 }
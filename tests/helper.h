@@ -3,11 +3,41 @@
 #include "../src/move_lut.h"
 #include "../src/position.h"
 
+#include <initializer_list>
+#include <string>
+#include <vector>
+
 namespace Analysis {
 
 	namespace Test {
 		const int RANDOM_POSITIONS_CNT = 10'000;
 
+		// A mix of dense, sparse and small-tile boards, filled before any test runs
 		extern Position random_positions[RANDOM_POSITIONS_CNT];
+
+		void fill_random_test_positions();
+
+		// A path of its own under the temporary directory, so concurrent runs don't share files. Whatever is there is
+		// removed when this goes out of scope.
+		class TempPath {
+			std::string path;
+
+			public:
+			explicit TempPath(const std::string& name);
+			~TempPath();
+
+			TempPath(const TempPath&) = delete;
+			TempPath& operator=(const TempPath&) = delete;
+
+			const std::string& str() const { return path; }
+		};
+
+		// The state after k of a 64-bit LCG (Knuth's MMIX constants), for tests which need many varied boards or keys
+		constexpr uint64_t lcg_next(uint64_t k) {
+			return k * 6364136223846793005ULL + 1442695040888963407ULL;
+		}
+
+		// count successive LCG states from seed, board i masked with masks[i % masks.size()] (~0ULL for a full board)
+		std::vector<uint64_t> random_boards(uint64_t seed, size_t count, std::initializer_list<uint64_t> masks);
 	}
 }
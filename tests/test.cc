@@ -1,11 +1,33 @@
 
 #include <catch2/catch_test_macros.hpp>
 #include <catch2/benchmark/catch_benchmark.hpp>
+#include <catch2/catch_approx.hpp>
 #include "../src/shuffle.h"
 #include "../src/move_lut.h"
 #include "../src/position.h"
+#include "../src/search.h"
+#include "../src/transposition.h"
+#include "../src/atlas.h"
+#include "../src/enumerate.h"
+#include "../src/radix_sort.h"
+#include "../src/position_batch.h"
+#include "../src/rollout.h"
+#include "../src/wide_position.h"
+#include "../src/eval.h"
+#include "../src/cpu_features.h"
+#include "../src/perf.h"
+#include "../src/perfect_hash.h"
+#include "../src/layer_rank.h"
+#include "../src/policy.h"
+#include "../src/parallel.h"
 #include "helper.h"
 
+#include <algorithm>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+
 #ifndef CATCH_CONFIG_ENABLE_BENCHMARKING
 #define ANALYSIS_BENCH(mm) [&] () -> auto 
 #else
@@ -55,12 +77,13 @@ TEST_CASE("Nibble shuffle is correct", "[nibble shuffle]") {
 }
 
 TEST_CASE("Moves", "[moves]") {
-	uint64_t tc[5][2] = {
+	uint64_t tc[6][2] = {
 		{ 0, 0 },
 		{ 0x0100, 0x1000 },
 		{ 0x0022'0100, 0x3000'1000 },
 		{ 0x2222'0100, 0x3300'1000 },
-		{ 0x4004'0102, 0x5000'1200 }
+		{ 0x4004'0102, 0x5000'1200 },
+		{ 0xff00'00ff, 0xf000'f000 }  // 32768s saturate
 
 	};
 	SECTION("Test move LUT") {
@@ -70,6 +93,111 @@ TEST_CASE("Moves", "[moves]") {
 		}
 	}
 
+	SECTION("Move LUT is built at compile time") {
+		static_assert(detail::move_right_row(0x0022) == 0x3000);
+		static_assert(detail::move_right_row(0x2222) == 0x3300);
+		static_assert(detail::move_right_row(0xff00) == 0xf000);
+
+		// Against the independent byte-per-square implementation, except where the LUT saturates
+		for (uint32_t row = 0; row < (1 << 16); ++row) {
+			bool s;
+			WidePosition w = WidePosition{ Position{ row } }.move_right(&s);
+			if (!w.fits_nibbles()) continue;
+
+			CAPTURE(row);
+			REQUIRE(detail::move_right_lut16[row] == w.narrow().tiles);
+		}
+	}
+
+	SECTION("Direct left, up and down match rotating around move right") {
+		for (const Position& p : random_positions) {
+			uint64_t t = p.tiles;
+			CAPTURE(t);
+
+			REQUIRE(move_left(t) == shuffle_nibbles(move_right(shuffle_nibbles(t, constants::rotate_180)), constants::rotate_180));
+			REQUIRE(move_up(t) == shuffle_nibbles(move_right(shuffle_nibbles(t, constants::rotate_270)), constants::rotate_90));
+			REQUIRE(move_down(t) == shuffle_nibbles(move_right(shuffle_nibbles(t, constants::rotate_90)), constants::rotate_270));
+		}
+	}
+
+	SECTION("move_all matches the single moves") {
+		uint32_t masks_seen = 0;
+
+		for (const Position& p : random_positions) {
+			uint64_t t = p.tiles;
+			AllMoves m = move_all(t);
+			masks_seen |= 1u << m.legal_mask;
+
+			CAPTURE(t);
+			for (Direction d : { RIGHT, LEFT, UP, DOWN }) {
+				REQUIRE(m.moves[d] == move_in_direction(t, d));
+				REQUIRE(((m.legal_mask >> d) & 1) == (m.moves[d] != t));
+			}
+
+#ifdef USE_X86_VECTORIZE
+			uint8_t legal;
+			uint64_t packed[4];
+			_mm256_storeu_si256((__m256i*) packed, move_all_packed(t, &legal));
+
+			REQUIRE(legal == m.legal_mask);
+			for (int d = 0; d < 4; ++d) REQUIRE(packed[d] == m.moves[d]);
+#endif
+		}
+
+		// The boards had no legal move, every move, and several sets in between
+		REQUIRE((masks_seen & 1));
+		REQUIRE((masks_seen >> 15) & 1);
+		REQUIRE(__builtin_popcount(masks_seen) > 8);
+
+		// Dead boards, and lanes of PositionV
+		REQUIRE(move_all(0x1212'2121'1212'2121).legal_mask == 0);
+
+		auto check_lanes = [&] <typename PV> () {
+			for (size_t i = 0; i + PV::count <= RANDOM_POSITIONS_CNT; i += PV::count) {
+				uint64_t lanes[PV::count];
+				for (int j = 0; j < PV::count; ++j) lanes[j] = j == 1 ? 0x1212'2121'1212'2121 : random_positions[i + j].tiles;
+
+				PV out[4];
+				uint64_t moved[4];
+				uint64_t any = PV::load(lanes).move_all(out, moved);
+
+				for (int j = 0; j < PV::count; ++j) {
+					AllMoves m = move_all(lanes[j]);
+
+					REQUIRE(((any >> j) & 1) == (m.legal_mask != 0));
+					for (int d = 0; d < 4; ++d) {
+						REQUIRE(out[d].get_idx(j).tiles == m.moves[d]);
+						REQUIRE(((moved[d] >> j) & 1) == ((m.legal_mask >> d) & 1));
+					}
+				}
+			}
+		};
+
+		check_lanes.template operator()<PositionV<2>>();
+		check_lanes.template operator()<PositionV<4>>();
+		check_lanes.template operator()<PositionV<8>>();
+		check_lanes.template operator()<PositionV<3>>();
+	}
+
+	ANALYSIS_BENCH("Random position move_all (10000 cases)") {
+		uint64_t sum = 0;
+
+		for (const Position& p : random_positions) sum += move_all(p.tiles).legal_mask;
+
+		return sum;
+	};
+
+	ANALYSIS_BENCH("Random position move up (10000 cases)") {
+		uint64_t sum = 0;
+
+		for (const Position& p : random_positions) {
+			bool s;
+			sum += p.move_up(&s).tiles;
+		}
+
+		return sum;
+	};
+
 	ANALYSIS_BENCH("Random position move right (10000 cases)") {
 		uint64_t sum = 0;
 
@@ -86,15 +214,190 @@ TEST_CASE("Moves", "[moves]") {
 		for (uint64_t* k : tc) {
 			CAPTURE(k[0], k[1]);
 
-			REQUIRE(_mm_cvtsi128_si64x(move_right(_mm_cvtsi64x_si128(k[0]))) == k[1]);
-			REQUIRE(_mm_cvtsi128_si64x(move_right(_mm_cvtsi64x_si128(k[0]))) == k[1]);
-			REQUIRE(_mm_cvtsi128_si64x(move_right(_mm_cvtsi64x_si128(k[0]))) == k[1]);
+			REQUIRE((uint64_t)_m128_to_64(move_right(_64_to_m128(k[0]))) == k[1]);
+			REQUIRE((uint64_t)_m256_to_64(move_right(_64_to_m256(k[0]))) == k[1]);
+#ifdef USE_AVX512_VECTORIZE
+			REQUIRE((uint64_t)_m512_to_64(move_right(_64_to_m512(k[0]))) == k[1]);
+#endif
+		}
+	}
+
+	SECTION("x86 move matches the LUT on every row") {
+		for (uint64_t row = 0; row < (1 << 16); row += 4) {
+			// Each lane holds four rows
+			uint64_t lanes[4];
+			for (int i = 0; i < 4; ++i) lanes[i] = (row + i) * 0x0001'0001'0001'0001;
+
+			uint64_t moved[4];
+			_mm256_storeu_si256((__m256i*) moved, move_right(_mm256_loadu_si256((const __m256i*) lanes)));
+
+			for (int i = 0; i < 4; ++i) {
+				CAPTURE(lanes[i]);
+				REQUIRE(moved[i] == move_right(lanes[i]));
+			}
 		}
 	}
 #endif
 
 }
 
+TEST_CASE("CPU dispatch", "[dispatch]") {
+	// The startup check would have exited otherwise
+	REQUIRE(detect_cpu_level() >= COMPILED_CPU_LEVEL);
+
+	std::vector<uint64_t> tiles;
+	for (const Position& p : random_positions) tiles.push_back(p.tiles);
+
+	// Centers of mass on an axis, on the diagonal, and at the center
+	for (uint64_t t : { 0x0000'0000'0000'0000ULL, 0x1001'0000'0000'1001ULL, 0x0000'0110'0110'0000ULL, 0x0001'0010'0100'1000ULL,
+		0x0000'0000'0000'0012ULL, 0x2100'0000'0000'0012ULL, 0x0000'0000'0000'0021ULL }) {
+		tiles.push_back(t);
+		tiles.push_back(flip_h(t));
+		tiles.push_back(transpose(t));
+	}
+
+	tiles.push_back(0x1);  // an odd count leaves a scalar tail
+
+	SECTION("Dispatched moves match scalar") {
+		std::vector<uint64_t> out(tiles.size());
+
+		for (Direction d : { RIGHT, LEFT, UP, DOWN }) {
+			dispatch::move_positions(tiles.data(), out.data(), tiles.size(), d);
+
+			size_t moved = 0;
+			for (size_t i = 0; i < tiles.size(); ++i) {
+				CAPTURE(tiles[i], d);
+				REQUIRE(out[i] == move_in_direction(tiles[i], d));
+				moved += out[i] != tiles[i];
+			}
+
+			REQUIRE(moved > tiles.size() / 2);
+		}
+	}
+
+	SECTION("Dispatched canonicalization matches scalar") {
+		std::vector<uint64_t> out = tiles;
+		dispatch::canonical_positions(out.data(), out.size());
+
+		size_t changed = 0;
+		for (size_t i = 0; i < tiles.size(); ++i) {
+			CAPTURE(tiles[i]);
+			REQUIRE(out[i] == canonical_position(tiles[i]));
+			changed += out[i] != tiles[i];
+		}
+
+		REQUIRE(changed > tiles.size() / 2);
+	}
+
+	SECTION("Dispatched nibble shuffles match scalar") {
+		std::vector<uint64_t> out(tiles.size());
+		const uint64_t indices[] = { constants::rotate_90, constants::rotate_180, constants::reflect_tr,
+			0xfedc'ba98'7654'3210ULL, 0x0000'0000'ffff'ffffULL, 0x2d9c'b046'a17e'58f3ULL };
+
+		for (uint64_t idx : indices) {
+			dispatch::shuffle_positions(tiles.data(), out.data(), tiles.size(), idx);
+
+			for (size_t i = 0; i < tiles.size(); ++i) {
+				CAPTURE(tiles[i], idx);
+				REQUIRE(out[i] == shuffle_nibbles(tiles[i], idx));
+			}
+		}
+	}
+
+	SECTION("Scalar nibble shuffle matches the fallback") {
+		for (size_t i = 0; i + 1 < tiles.size(); ++i) {
+			REQUIRE(shuffle_nibbles(tiles[i], tiles[i + 1]) == fallback::shuffle_nibbles(tiles[i], tiles[i + 1]));
+		}
+	}
+}
+
+TEST_CASE("Performance counters", "[perf]") {
+	auto canonicalize = [] () {
+		PositionBatch b;
+		for (const Position& p : random_positions) b.push_back(p);
+
+		b.canonicalize();
+		return b;
+	};
+
+	SECTION("Regions compile either way") {
+		{
+			ANALYSIS_PERF_REGION("test/block");
+			REQUIRE(canonicalize().size() == RANDOM_POSITIONS_CNT);
+		}
+
+		REQUIRE(std::string(perf_counter_name(PERF_TASK_CLOCK)) == "task_clock_ns");
+	}
+
+#ifdef ANALYSIS_PERF
+	SECTION("Regions accumulate") {
+		perf_reset();
+
+		for (int i = 0; i < 3; ++i) canonicalize();
+
+		PerfTotals t = perf_region_totals("batch/canonicalize");
+		REQUIRE(t.calls == 3);
+
+		// The software clock works without a PMU
+		REQUIRE(perf_counter_available(PERF_TASK_CLOCK));
+		REQUIRE(t.counters[PERF_TASK_CLOCK] > 0);
+
+		if (perf_counter_available(PERF_INSTRUCTIONS)) REQUIRE(t.counters[PERF_INSTRUCTIONS] > RANDOM_POSITIONS_CNT);
+
+		REQUIRE(perf_region_totals("no such region").calls == 0);
+	}
+
+	SECTION("Regions count the workers started inside them") {
+		perf_reset();
+
+		// Each worker burns 20 ms of its own CPU time
+		auto spin = [] (int64_t) {
+			timespec start, now;
+			clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start);
+
+			do clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+			while ((now.tv_sec - start.tv_sec) * 1000000000LL + (now.tv_nsec - start.tv_nsec) < 20000000);
+		};
+
+		{
+			ANALYSIS_PERF_REGION("test/parallel");
+			parallel_for(4, 4, spin);
+			work_stealing_for(4, 4, [&] (int, int64_t i) { spin(i); });
+		}
+
+		PerfTotals t = perf_region_totals("test/parallel");
+		REQUIRE(t.calls == 1);
+		REQUIRE(t.counters[PERF_TASK_CLOCK] >= 8 * 20000000ULL * 9 / 10);
+		REQUIRE(perf_open_regions().empty());
+	}
+
+	SECTION("Regions past the first block") {
+		for (int i = 0; i < 1000; ++i) {
+			ANALYSIS_PERF_REGION_DYNAMIC("test/region " + std::to_string(i));
+		}
+
+		REQUIRE(perf_region_totals("test/region 999").calls == 1);
+	}
+
+	SECTION("JSON report") {
+		perf_reset();
+		canonicalize();
+
+		char* buf;
+		size_t len;
+		FILE* f = open_memstream(&buf, &len);
+		write_perf_json(f);
+		fclose(f);
+
+		std::string json{ buf, len };
+		free(buf);
+
+		REQUIRE(json.find("\"name\": \"batch/canonicalize\", \"calls\": 1,") != std::string::npos);
+		REQUIRE(json.find("\"task_clock_ns\": null") == std::string::npos);
+	}
+#endif
+}
+
 TEST_CASE("Gen next", "[gen next]") {
 	// Given a base position, generate all possible next base positions when moving right, optionally with a probability attached to them.
 	// That is, compute all possible next base positions after a move right has been committed. There are also four extra values: The
@@ -131,7 +434,51 @@ TEST_CASE("Deduplicate entries", "[dedup entries]") {
 
 		REQUIRE(result_count == 7);
 		REQUIRE(memcmp(correct_result, result, sizeof(correct_result)) == 0);
-		REQUIRE(memcmp(correct_freqs, freqs, sizeof(correct_result)) == 0);
+		REQUIRE(memcmp(correct_freqs, freqs, sizeof(correct_freqs)) == 0);
+	}
+
+	SECTION("Parallel radix sort with counts") {
+		for (size_t count : { (size_t)0, (size_t)1000, (size_t)300'000 }) {
+			std::vector<uint64_t> input(count);
+			uint64_t kk = 1;
+
+			for (size_t i = 0; i < count; ++i) {
+				kk = lcg_next(kk);
+				input[i] = (kk >> 40) % 50'000 * 0x9e3779b97f4a7c15ULL;  // plenty of duplicates, all bytes varying
+			}
+
+			std::vector<uint64_t> expected = input;
+			std::sort(expected.begin(), expected.end());
+
+			std::vector<uint64_t> expected_unique = expected;
+			expected_unique.erase(std::unique(expected_unique.begin(), expected_unique.end()), expected_unique.end());
+
+			for (int threads : { 1, 4 }) {
+				std::vector<uint64_t> sorted = input, scratch(count);
+				radix_sort_positions(sorted.data(), count, scratch.data(), threads);
+
+				REQUIRE(sorted == expected);
+
+				std::vector<uint64_t> positions = input;
+				std::vector<uint32_t> freqs(count);
+				size_t distinct = sort_dedup_positions(positions.data(), count, scratch.data(), freqs.data(), threads);
+
+				size_t j = 0;
+				for (size_t i = 0; i < distinct; ++i) {
+					REQUIRE(positions[i] == expected[j]);
+					auto run = std::equal_range(expected.begin(), expected.end(), positions[i]);
+					REQUIRE(run.second - run.first == freqs[i]);
+
+					j += freqs[i];
+				}
+
+				REQUIRE(j == count);
+
+				std::vector<uint64_t> unique = input;
+				sort_unique_positions(unique, threads);
+				REQUIRE(unique == expected_unique);
+			}
+		}
 	}
 }
 
@@ -210,6 +557,62 @@ TEST_CASE("Canonical hashing", "[canonical]") {
 			REQUIRE(p.reflect_tl().canonical() == q);
 		}
 	}
+
+	SECTION("Positions with a zero or diagonal center of mass") {
+		for (uint64_t tiles : { 0x0010'0000'0000'0100ULL, 0x1000'0000'0000'0001ULL, 0x0000'0110'0110'0000ULL,
+				0x0000'0000'0010'0001ULL, 0x0001'0000'0020'0001ULL }) {
+			Position p{ tiles };
+			Position q = p.canonical();
+
+			REQUIRE(q.canonical() == q);
+			REQUIRE(p.rotate_90().canonical() == q);
+			REQUIRE(p.rotate_180().canonical() == q);
+			REQUIRE(p.rotate_270().canonical() == q);
+			REQUIRE(p.reflect_h().canonical() == q);
+			REQUIRE(p.reflect_v().canonical() == q);
+			REQUIRE(p.reflect_tr().canonical() == q);
+			REQUIRE(p.reflect_tl().canonical() == q);
+		}
+	}
+
+	SECTION("Symmetries map canonical moves back") {
+		for (uint64_t tiles : random_boards(1, 10'000, { 0x0f30'0f03'30f0'0f30, 0x3333'3333'3333'3333 })) {
+			uint64_t canonical;
+			int sym = canonical_symmetry(tiles, &canonical);
+
+			REQUIRE(canonical == canonical_position(tiles));
+			REQUIRE(apply_symmetry(tiles, sym) == canonical);
+
+			for (int s = 0; s < 8; ++s) {
+				uint64_t q = apply_symmetry(tiles, s);
+
+				for (Direction d : { RIGHT, LEFT, UP, DOWN }) {
+					REQUIRE(apply_symmetry(move_in_direction(tiles, unapply_symmetry(d, s)), s) == move_in_direction(q, d));
+				}
+			}
+		}
+	}
+
+	SECTION("Batch matches scalar") {
+		// Mix in sparse and mirrored positions so that every tie case shows up in some vector
+		std::vector<uint64_t> tiles =
+			random_boards(1, 20'000, { ~0ULL, 0x0ff0'0ff0'0ff0'0ff0, 0x0000'000f'000f'0f00, 0xffff });
+		for (size_t i = 3; i < tiles.size(); i += 4) tiles[i] *= 0x0001'0000'0000'0001;  // row 0 repeated as row 3
+
+		std::vector<uint64_t> canonical = tiles;
+		canonical_positions(canonical.data(), canonical.size());
+
+		for (size_t i = 0; i < tiles.size(); ++i) {
+			CAPTURE(tiles[i]);
+			REQUIRE(canonical[i] == canonical_position(tiles[i]));
+		}
+
+#ifdef USE_X86_VECTORIZE
+		__m256i v = _mm256_loadu_si256((const __m256i*) tiles.data());
+		REQUIRE((uint64_t)_m256_to_64(canonical_position(v)) == canonical_position(tiles[0]));
+		REQUIRE((uint64_t)_m128_to_64(canonical_position(_mm256_castsi256_si128(v))) == canonical_position(tiles[0]));
+#endif
+	}
 }
 
 TEST_CASE("Tile sum", "[tile sum]") {
@@ -299,13 +702,740 @@ TEST_CASE("Nibble ops", "[nibble ops]") {
 #ifdef USE_X86_VECTORIZE
 	SECTION("x86 cmp") {
 		for (uint64_t *a : tc) {
-			REQUIRE(_mm_cvtsi128_si64x(mask_zero_nibbles(_mm_cvtsi64_si128(a[0]))) == a[1]);
-			REQUIRE(_mm256_cvtsi256_si64x(mask_zero_nibbles(_mm256_cvtsi64_si256(a[0]))) == a[1]);
+			REQUIRE((uint64_t)_mm_cvtsi128_si64x(mask_zero_nibbles(_mm_cvtsi64_si128(a[0]))) == a[1]);
+			REQUIRE((uint64_t)_m256_to_64(mask_zero_nibbles(_64_to_m256(a[0]))) == a[1]);
+		}
+	}
+
+	SECTION("x86 count and tile sum") {
+		for (uint64_t *a : tc2) {
+			REQUIRE((uint64_t)_m128_to_64(count_tiles(_64_to_m128(a[0]))) == a[1]);
+			REQUIRE((uint64_t)_m256_to_64(count_empty(_64_to_m256(a[0]))) == 16 - a[1]);
+		}
+
+		for (uint64_t *a : tc5) {
+			REQUIRE((uint64_t)_m128_to_64(tile_sum(_64_to_m128(a[0]))) == a[1]);
+			REQUIRE((uint64_t)_m256_to_64(tile_sum(_64_to_m256(a[0]))) == a[1]);
 		}
 	}
 #endif
 }
 
+namespace {
+	template <typename PV>
+	void check_position_v(const std::vector<uint64_t>& tiles) {
+		constexpr int N = PV::count;
+
+		auto lanes = [] (const typename PV::VEC_TYPE& v) {
+			std::array<uint64_t, N> a;
+			memcpy(&a[0], &v, sizeof(a));
+			return a;
+		};
+
+		for (size_t base = 0; base + N <= tiles.size(); base += N) {
+			const uint64_t* t = &tiles[base];
+			PV v = PV::load(t);
+
+			uint64_t m[4];
+			PV moves[4] = { v.move_right(&m[0]), v.move_left(&m[1]), v.move_up(&m[2]), v.move_down(&m[3]) };
+
+			PV syms[8] = { v.identity(), v.rotate_90(), v.rotate_180(), v.rotate_270(),
+				v.reflect_h(), v.reflect_v(), v.reflect_tl(), v.reflect_tr() };
+
+			PV can = v.canonical();
+			auto sums = lanes(v.tile_sum());
+			auto empty = lanes(v.count_empty());
+
+			for (int i = 0; i < N; ++i) {
+				Position p{ t[i] };
+				CAPTURE(p.tiles);
+
+				REQUIRE(v.get_idx(i) == p);
+
+				bool ok[4];
+				Position pm[4] = { p.move_right(&ok[0]), p.move_left(&ok[1]), p.move_up(&ok[2]), p.move_down(&ok[3]) };
+
+				for (int d = 0; d < 4; ++d) {
+					REQUIRE(moves[d].get_idx(i) == pm[d]);
+					REQUIRE((bool)((m[d] >> i) & 1) == ok[d]);
+				}
+
+				Position ps[8] = { p.identity(), p.rotate_90(), p.rotate_180(), p.rotate_270(),
+					p.reflect_h(), p.reflect_v(), p.reflect_tl(), p.reflect_tr() };
+
+				for (int s = 0; s < 8; ++s) REQUIRE(syms[s].get_idx(i) == ps[s]);
+
+				REQUIRE(can.get_idx(i) == p.canonical());
+				REQUIRE(sums[i] == p.tile_sum());
+				REQUIRE(empty[i] == (uint64_t)(16 - count_tiles(p.tiles)));
+			}
+
+			uint64_t rand[N];
+			for (int i = 0; i < N; ++i) rand[i] = hash_tiles(t[i] + base);
+
+			uint64_t spawn_ok;
+			PV spawned_with = v.spawn(PV::load(rand).tiles, &spawn_ok);
+
+			for (int i = 0; i < N; ++i) {
+				REQUIRE(spawned_with.get_idx(i).tiles == spawn_tile(t[i], rand[i]));
+				REQUIRE((bool)((spawn_ok >> i) & 1) == (count_tiles(t[i]) < 16));
+			}
+
+			// Lanes picked by a mask; the mask has bits above count, which must be ignored
+			uint64_t mask = hash_tiles(base) | ~PV::ALL;
+			uint64_t packed[N], fill[N];
+			for (int i = 0; i < N; ++i) fill[i] = ~t[i];
+
+			PV blended = PV::blend(mask, spawned_with, v);
+			PV expanded = v.expand(mask, fill);
+			int written = v.compress(mask, packed);
+
+			REQUIRE(written == __builtin_popcountll(mask & PV::ALL));
+
+			for (int i = 0, e = 0, c = 0; i < N; ++i) {
+				bool in = (mask >> i) & 1;
+
+				REQUIRE(blended.get_idx(i) == (in ? spawned_with : v).get_idx(i));
+				REQUIRE(expanded.get_idx(i).tiles == (in ? fill[e++] : t[i]));
+				if (in) REQUIRE(packed[c++] == t[i]);
+			}
+
+			uint64_t ok;
+			PV spawned = v.get_next_random(&ok);
+
+			for (int i = 0; i < N; ++i) {
+				REQUIRE((bool)((ok >> i) & 1) == (count_tiles(t[i]) < 16));
+				if ((ok >> i) & 1) REQUIRE(is_valid_gen_tile(spawned.get_idx(i).tiles, t[i]));
+			}
+
+			// Round trip through store, and lane-wise comparison after changing one lane
+			uint64_t out[N];
+			v.store(out);
+			REQUIRE(std::equal(out, out + N, t));
+
+			PV w = v;
+			REQUIRE(w == v);
+			w.set_idx(N - 1, Position{ t[N - 1] ^ 1 });
+			REQUIRE(w != v);
+			REQUIRE(PV::cmp_mask(v, w) == (PV::ALL >> 1));
+		}
+	}
+}
+
+TEST_CASE("Vectorized positions", "[position v]") {
+	// Sparse boards make lots of lanes with no legal move in some direction, and full ones can't spawn
+	std::vector<uint64_t> tiles = random_boards(7, 8'000, { ~0ULL, 0x00f0'0f00'f000'000f, ~0ULL, 0x3333'3333'3333'3333 });
+	for (size_t i = 2; i < tiles.size(); i += 4) tiles[i] |= 0x1111'1111'1111'1111;
+
+	SECTION("PositionV<2>") { check_position_v<PositionV<2>>(tiles); }
+	SECTION("PositionV<4>") { check_position_v<PositionV<4>>(tiles); }
+	SECTION("PositionV<8>") { check_position_v<PositionV<8>>(tiles); }
+	SECTION("Scalar PositionV<3>") { check_position_v<PositionV<3>>(tiles); }
+}
+
+
+TEST_CASE("Expectimax search", "[search]") {
+	SECTION("Dead position has no legal moves") {
+		Searcher s{ SearchOptions { .depth = 2 } };
+		MoveValues r = s.evaluate(Position{ 0x1212'2121'1212'2121 });
+
+		REQUIRE(!r.has_legal());
+	}
+
+	SECTION("Depth 1 with the default evaluator") {
+		// A lone 2 in the top left corner can only move right or down; either way, 14 cells are empty after the spawn
+		Searcher s{ SearchOptions { .depth = 1 } };
+		MoveValues r = s.evaluate(Position{ 0x1 });
+
+		REQUIRE(r.legal_mask == ((1 << RIGHT) | (1 << DOWN)));
+		REQUIRE(r.values[RIGHT] == Catch::Approx(15.0f));
+		REQUIRE(r.values[DOWN] == Catch::Approx(15.0f));
+	}
+
+	SECTION("Moves merging two 32768s are left out and reported") {
+		// 32768 32768 in the top right merge horizontally, and stay side by side after vertical moves
+		Searcher s{ SearchOptions { .depth = 2 } };
+		MoveValues r = s.evaluate(Position{ 0x000f'0000'0000'ff00 });
+
+		REQUIRE(r.overflow_mask == ((1 << RIGHT) | (1 << LEFT)));
+		REQUIRE(r.legal_mask == ((1 << UP) | (1 << DOWN)));
+		REQUIRE(r.values[RIGHT] == -1);
+		REQUIRE(r.values[UP] > 0);
+
+		REQUIRE(s.evaluate(Position{ 0x1 }).overflow_mask == 0);
+	}
+
+	SECTION("Batch matches single evaluation regardless of thread count") {
+		Position ps[3] = { Position{ 0x0012'0001'0120'1000 }, Position{ 0x1 }, Position{ 0x2231'0000'0010'0001 } };
+
+		Searcher serial{ SearchOptions { .depth = 2, .threads = 1 } };
+		Searcher threaded{ SearchOptions { .depth = 2, .threads = 4 } };
+
+		MoveValues batch[3];
+		threaded.evaluate_batch(ps, 3, batch);
+
+		for (int i = 0; i < 3; ++i) {
+			MoveValues single = serial.evaluate(ps[i]);
+
+			REQUIRE(single.legal_mask == batch[i].legal_mask);
+			for (int d = 0; d < 4; ++d) {
+				REQUIRE(single.values[d] == batch[i].values[d]);
+			}
+		}
+	}
+}
+
+TEST_CASE("Heuristic evaluation", "[eval]") {
+	HeuristicEval eval;
+	EvalWeights w;
+
+	std::vector<uint64_t> tiles = random_boards(5, 3'001, { 0x3330'0333'0033'3003, ~0ULL });
+
+	SECTION("Row features") {
+		// 2 2 4 empty: one merge, one empty square, not monotonic
+		RowFeatures f = eval.features(0x0211);
+		REQUIRE(f.empty == 1);
+		REQUIRE(f.merges == 1);
+		REQUIRE(f.sum == Catch::Approx(2 + std::pow(2.0f, 3.5f)));
+		REQUIRE(f.monotonicity == Catch::Approx(std::pow(2.0f, 4.0f) - 1));
+
+		// 2 4 8 16: monotonic, no merges
+		f = eval.features(0x4321);
+		REQUIRE(f.empty == 0);
+		REQUIRE(f.merges == 0);
+		REQUIRE(f.monotonicity == 0);
+
+		// Four 32768s merge twice, even though the LUT saturates
+		REQUIRE(eval.features(0xffff).merges == 2);
+		REQUIRE(eval.features(0).empty == 4);
+	}
+
+	SECTION("Scores rows and columns") {
+		for (uint64_t t : tiles) {
+			float expected = 0;
+			for (uint64_t x : { t, transpose(t) }) {
+				for (int r = 0; r < 4; ++r) {
+					RowFeatures f = row_features((x >> (16 * r)) & 0xffff, w);
+					expected += w.base + w.empty * f.empty + w.merges * f.merges - w.monotonicity * f.monotonicity - w.sum * f.sum;
+				}
+			}
+
+			CAPTURE(t);
+			REQUIRE(eval.evaluate(t) == Catch::Approx(std::max(expected, 1.0f)).epsilon(1e-5));
+
+			// Every feature is symmetric under reversing a line, and rows swap with columns under transposition
+			float v = eval.evaluate(t);
+			for (uint64_t s : { flip_h(t), flip_v(t), transpose(t) }) {
+				REQUIRE(eval.evaluate(s) == Catch::Approx(v).epsilon(1e-5));
+			}
+		}
+	}
+
+	SECTION("Batch and lanes match scalar") {
+		std::vector<float> batch(tiles.size());
+		eval.evaluate_batch(tiles.data(), tiles.size(), batch.data());
+
+		for (size_t i = 0; i < tiles.size(); ++i) REQUIRE(batch[i] == eval.evaluate(tiles[i]));
+
+		float lanes[8];
+		eval.evaluate(PositionV<2>::load(tiles.data()), lanes);
+		for (int i = 0; i < 2; ++i) REQUIRE(lanes[i] == batch[i]);
+
+		eval.evaluate(PositionV<4>::load(tiles.data() + 8), lanes);
+		for (int i = 0; i < 4; ++i) REQUIRE(lanes[i] == batch[8 + i]);
+
+		eval.evaluate(PositionV<3>::load(tiles.data() + 16), lanes);
+		for (int i = 0; i < 3; ++i) REQUIRE(lanes[i] == batch[16 + i]);
+	}
+
+	SECTION("Search gives the same values with batched leaves") {
+		Searcher single{ SearchOptions { .depth = 2, .threads = 1, .leaf_eval = heuristic_leaf_eval } };
+		Searcher batched{ SearchOptions { .depth = 2, .threads = 1, .leaf_eval = heuristic_leaf_eval,
+			.leaf_eval_batch = heuristic_leaf_eval_batch } };
+
+		for (int i = 0; i < 20; ++i) {
+			Position p{ tiles[2 * i] };
+			MoveValues a = single.evaluate(p), b = batched.evaluate(p);
+
+			REQUIRE(a.legal_mask == b.legal_mask);
+			for (int d = 0; d < 4; ++d) REQUIRE(a.values[d] == b.values[d]);
+		}
+	}
+}
+
+TEST_CASE("Perfect hash", "[perfect hash]") {
+	auto random_keys = [] (size_t count, uint64_t seed) {
+		std::vector<uint64_t> keys = random_boards(seed, count, { 0x3333'3333'3333'3333 });
+		for (uint64_t& key : keys) key = canonical_position(key);
+
+		std::sort(keys.begin(), keys.end());
+		keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+		return keys;
+	};
+
+	SECTION("Keys map one to one onto the range") {
+		for (size_t count : { 0, 1, 2, 3, 100, 1000, 200'000 }) {
+			std::vector<uint64_t> keys = random_keys(count, count + 1);
+			PerfectHash h{ keys.data(), keys.size(), 4 };
+
+			REQUIRE(h.size() == keys.size());
+
+			std::vector<bool> hit(keys.size());
+			for (uint64_t k : keys) {
+				uint64_t i = h(k);
+				REQUIRE(i < keys.size());
+				REQUIRE(!hit[i]);
+
+				hit[i] = true;
+			}
+		}
+	}
+
+	SECTION("Independent of key order and threads") {
+		std::vector<uint64_t> keys = random_keys(50'000, 5);
+		PerfectHash a{ keys.data(), keys.size(), 1 };
+
+		std::reverse(keys.begin(), keys.end());
+		PerfectHash b{ keys.data(), keys.size(), 4 };
+
+		for (uint64_t k : keys) REQUIRE(a(k) == b(k));
+	}
+
+	SECTION("A few bits per key") {
+		std::vector<uint64_t> keys = random_keys(200'000, 7);
+		PerfectHash h{ keys.data(), keys.size() };
+
+		REQUIRE(h.bytes() * 8 < 4 * keys.size());
+	}
+}
+
+TEST_CASE("Layer ranking", "[layer rank]") {
+	SECTION("Counts") {
+		LayerRanking r{ 15, 1024 };
+
+		REQUIRE(r.count(0) == 1);
+		REQUIRE(r.count(2) == 16);
+		REQUIRE(r.count(3) == 0);
+		REQUIRE(r.count(4) == 16 * 15 / 2 + 16);  // two 2s or one 4
+		REQUIRE(r.count(2048) == 0);  // beyond max_sum
+
+		// Capping the tile only removes boards
+		LayerRanking capped{ 2, 1024 };
+		REQUIRE(capped.count(8) < r.count(8));
+		REQUIRE(capped.count(8) > 0);
+	}
+
+	SECTION("Every board of a small layer, in order") {
+		const uint32_t sum = 10;
+		LayerRanking r{ 15, sum };
+
+		// All boards of the sum, by filling squares from the top with what's left
+		std::vector<uint64_t> boards;
+		std::function<void(int, uint32_t, uint64_t)> fill = [&] (int square, uint32_t left, uint64_t tiles) {
+			if (square < 0) {
+				if (left == 0) boards.push_back(tiles);
+				return;
+			}
+
+			for (int t = 0; t < 16 && (t == 0 || (1u << t) <= left); ++t) {
+				fill(square - 1, left - (t ? 1u << t : 0), tiles | (uint64_t)t << (4 * square));
+			}
+		};
+		fill(15, sum, 0);
+
+		std::sort(boards.begin(), boards.end());
+		REQUIRE(boards.size() == r.count(sum));
+
+		std::vector<uint64_t> ranks(boards.size());
+		r.rank_batch(boards.data(), ranks.data(), boards.size());
+
+		for (size_t i = 0; i < boards.size(); ++i) {
+			REQUIRE(r.rank(boards[i]) == i);
+			REQUIRE(ranks[i] == i);
+			REQUIRE(r.unrank(sum, i) == boards[i]);
+		}
+	}
+
+	SECTION("Random boards round trip") {
+		LayerRanking r{ 11, 1 << 15 };
+
+		std::vector<uint64_t> boards;
+		uint64_t k = 3;
+		for (int i = 0; i < 20'000; ++i) {
+			k = lcg_next(k);
+
+			// Tiles up to 2048, at most half of the squares filled
+			uint64_t tiles = 0;
+			for (int sq = 0; sq < 16; ++sq) {
+				uint64_t t = (k >> (4 * sq)) & 0xf;
+				if (t <= 11 && ((k >> sq) & 1)) tiles |= t << (4 * sq);
+			}
+
+			boards.push_back(tiles);
+		}
+
+		std::vector<uint64_t> ranks(boards.size());
+		r.rank_batch(boards.data(), ranks.data(), boards.size());
+
+		for (size_t i = 0; i < boards.size(); ++i) {
+			uint32_t sum = tile_sum(boards[i]);
+
+			REQUIRE(ranks[i] == r.rank(boards[i]));
+			REQUIRE(ranks[i] < r.count(sum));
+			REQUIRE(r.unrank(sum, ranks[i]) == boards[i]);
+		}
+
+		// Ranks follow the numeric order within a layer
+		for (size_t i = 0; i + 1 < boards.size(); ++i) {
+			if (tile_sum(boards[i]) == tile_sum(boards[i + 1])) {
+				REQUIRE((boards[i] < boards[i + 1]) == (ranks[i] < ranks[i + 1]));
+			}
+		}
+	}
+}
+
+TEST_CASE("Transposition table", "[transposition]") {
+	SECTION("Respects the memory budget") {
+		TranspositionTable tt{ 1000 };
+
+		REQUIRE(tt.memory_usage() <= 1000);
+		REQUIRE(tt.memory_usage() * 2 > 1000);
+		REQUIRE(tt.capacity() == tt.memory_usage() / 16);
+	}
+
+	SECTION("Store and probe") {
+		TranspositionTable tt{ 1 << 16 };
+		TTEntry e;
+
+		REQUIRE(!tt.probe(0, &e));  // zeroed slots are not entries for the empty board
+
+		for (const Position& p : random_positions) {
+			tt.store(p.canonical().tiles, (float)(p.tiles & 0xffff), 3, Bound::LOWER);
+		}
+
+		uint64_t key = Position{ 0x0123'0021'0001'0000 }.canonical().tiles;
+		tt.store(key, 2.5f, 4);
+
+		REQUIRE(tt.probe(Position{ 0x0123'0021'0001'0000 }.rotate_90().canonical().tiles, &e));
+		REQUIRE(e.value == 2.5f);
+		REQUIRE(e.depth == 4);
+		REQUIRE(e.bound == Bound::EXACT);
+	}
+
+	SECTION("Depth-preferred keeps deeper entries") {
+		TranspositionTable tt{ 32, ReplacementPolicy::DEPTH_PREFERRED };  // a single bucket of two slots
+		TTEntry e;
+
+		tt.store(0x1, 1.0f, 5);
+		tt.store(0x2, 2.0f, 5);
+		tt.store(0x3, 3.0f, 2);
+
+		REQUIRE(!tt.probe(0x3, &e));
+		REQUIRE(tt.probe(0x1, &e));
+		REQUIRE(tt.probe(0x2, &e));
+
+		tt.store(0x1, 1.5f, 6);
+		REQUIRE(tt.probe(0x1, &e));
+		REQUIRE(e.value == 1.5f);
+	}
+
+	SECTION("Two-tier and always-replace accept new entries") {
+		for (ReplacementPolicy policy : { ReplacementPolicy::TWO_TIER, ReplacementPolicy::ALWAYS_REPLACE }) {
+			TranspositionTable tt{ 32, policy };
+			TTEntry e;
+
+			tt.store(0x1, 1.0f, 5);
+			tt.store(0x2, 2.0f, 1);
+
+			REQUIRE(tt.probe(0x2, &e));
+			REQUIRE(e.value == 2.0f);
+		}
+	}
+
+	SECTION("Two-tier promotion leaves no stale copy") {
+		TranspositionTable tt{ 32, ReplacementPolicy::TWO_TIER };
+		TTEntry e;
+
+		tt.store(0x1, 1.0f, 5);
+		tt.store(0x2, 2.0f, 1);  // second slot
+		tt.store(0x2, 2.5f, 6);  // promoted to the first
+		tt.store(0x3, 3.0f, 9);  // evicts it from there
+
+		REQUIRE(!tt.probe(0x2, &e));
+		REQUIRE(tt.probe(0x3, &e));
+	}
+
+	SECTION("Search gives the same values with a table") {
+		TranspositionTable tt{ 1 << 20 };
+		Position p{ 0x0012'0001'0120'1000 };
+
+		MoveValues plain = Searcher{ SearchOptions { .depth = 3, .threads = 4 } }.evaluate(p);
+		MoveValues cached = Searcher{ SearchOptions { .depth = 3, .threads = 4, .table = &tt } }.evaluate(p);
+
+		REQUIRE(plain.legal_mask == cached.legal_mask);
+		for (int d = 0; d < 4; ++d) {
+			REQUIRE(plain.values[d] == Catch::Approx(cached.values[d]));
+		}
+	}
+}
+
+namespace {
+	// Plain memoized recursion for the probability of making the target tile, to check the Atlas against
+	double exact_win_probability(uint64_t tiles, uint8_t target, std::unordered_map<uint64_t, double>& memo) {
+		tiles = canonical_position(tiles);
+		if (nibble_max(tiles) >= target) return 1;
+
+		auto it = memo.find(tiles);
+		if (it != memo.end()) return it->second;
+
+		double best = 0;
+		for (Direction d : { RIGHT, LEFT, UP, DOWN }) {
+			uint64_t moved = move_in_direction(tiles, d);
+			if (moved == tiles) continue;
+
+			Position pp2[16], pp4[16];
+			int pp2c, pp4c;
+			Position{ moved }.gen_new_tiles(pp2, pp4, &pp2c, &pp4c);
+
+			double ev = 0;
+			for (int i = 0; i < pp2c; ++i) {
+				ev += 0.9 * exact_win_probability(pp2[i].tiles, target, memo);
+				ev += 0.1 * exact_win_probability(pp4[i].tiles, target, memo);
+			}
+
+			best = std::max(best, ev / pp2c);
+		}
+
+		return memo[tiles] = best;
+	}
+}
+
+TEST_CASE("Atlas", "[atlas]") {
+	const uint8_t target = 3;  // make an 8
+	Position root{ 0x0000'0121'1212'2121 };
+
+	Atlas<1> atlas{ AtlasOptions { .target = target, .threads = 4 } };
+	atlas.init(&root, 1);
+
+	SECTION("Layers") {
+		REQUIRE(atlas.layer_size(root.tile_sum()) == 1);
+		REQUIRE(atlas.layer_size(root.tile_sum() + 1) == 0);
+		REQUIRE(atlas.layer_size(root.tile_sum() + 2) > 0);
+
+		size_t total = 0;
+		for (uint32_t s = 0; s <= atlas.max_tile_sum(); s += 2) total += atlas.layer_size(s);
+
+		REQUIRE(total == atlas.size());
+	}
+
+	SECTION("Values match brute force") {
+		atlas.solve();
+
+		std::unordered_map<uint64_t, double> memo;
+		exact_win_probability(root.tiles, target, memo);
+
+		for (auto& [tiles, expected] : memo) {
+			float value;
+
+			REQUIRE(atlas.lookup(Position{ tiles }.reflect_h(), &value));
+			REQUIRE(value == Catch::Approx(expected).margin(1e-5));
+
+			MoveValues mv = atlas.evaluate(Position{ tiles });
+			if (mv.has_legal()) {
+				REQUIRE(mv.values[mv.best()] == Catch::Approx(value).margin(1e-5));
+			} else {
+				REQUIRE(value == 0);
+			}
+		}
+	}
+
+	SECTION("Vector widths match scalar") {
+		atlas.solve();
+
+		Atlas<4> wide{ AtlasOptions { .target = target, .threads = 4 } };
+		wide.init(&root, 1);
+		wide.solve();
+
+		std::unordered_map<uint64_t, double> memo;
+		exact_win_probability(root.tiles, target, memo);
+
+		for (auto& [tiles, expected] : memo) {
+			float a, b;
+
+			REQUIRE(atlas.lookup(Position{ tiles }, &a));
+			REQUIRE(wide.lookup(Position{ tiles }, &b));
+			REQUIRE(a == b);
+		}
+	}
+
+	SECTION("Sliding window matches fully resident") {
+		atlas.solve();
+
+		TempPath dir{ "atlas_window_test" };
+		auto windowed = std::make_unique<Atlas<1>>(AtlasOptions { .target = target, .threads = 4, .spill_dir = dir.str() });
+		windowed->init(&root, 1);
+		windowed->solve();
+
+		// Peak memory is bounded by the largest three adjacent layers, each with a perfect hash of under a byte per
+		// position and a few cache lines
+		size_t bound = 0;
+		for (uint32_t s = 0; s <= atlas.max_tile_sum(); s += 2) {
+			size_t window = 0;
+			for (uint32_t t = s; t <= s + 4; t += 2) {
+				window += atlas.layer_size(t) * (sizeof(uint64_t) + sizeof(float) + 1) + 1024;
+			}
+
+			bound = std::max(bound, window);
+		}
+
+		REQUIRE(windowed->size() == atlas.size());
+		REQUIRE(windowed->peak_resident_bytes() <= bound);
+		REQUIRE(windowed->peak_resident_bytes() < atlas.peak_resident_bytes());
+
+		for (uint32_t s = 0; s <= windowed->max_tile_sum(); s += 2) {
+			windowed->load_layer(s);
+		}
+
+		std::unordered_map<uint64_t, double> memo;
+		exact_win_probability(root.tiles, target, memo);
+
+		for (auto& [tiles, expected] : memo) {
+			float a, b;
+
+			REQUIRE(atlas.lookup(Position{ tiles }, &a));
+			REQUIRE(windowed->lookup(Position{ tiles }, &b));
+			REQUIRE(a == b);
+		}
+
+		// The spill files go with the Atlas
+		REQUIRE(!std::filesystem::is_empty(dir.str()));
+		windowed.reset();
+		REQUIRE(std::filesystem::is_empty(dir.str()));
+	}
+
+	SECTION("Dropping keys keeps values") {
+		atlas.solve();
+
+		Atlas<1> compact{ AtlasOptions { .target = target, .threads = 4, .drop_keys = true } };
+		compact.init(&root, 1);
+		compact.solve();
+
+		REQUIRE(compact.peak_resident_bytes() < atlas.peak_resident_bytes());
+
+		std::unordered_map<uint64_t, double> memo;
+		exact_win_probability(root.tiles, target, memo);
+
+		for (auto& [tiles, expected] : memo) {
+			float a, b;
+
+			REQUIRE(atlas.lookup(Position{ tiles }, &a));
+			REQUIRE(compact.lookup(Position{ tiles }.rotate_90(), &b));
+			REQUIRE(a == b);
+
+			MoveValues ma = atlas.evaluate(Position{ tiles }), mb = compact.evaluate(Position{ tiles });
+			REQUIRE(ma.legal_mask == mb.legal_mask);
+			for (int d = 0; d < 4; ++d) REQUIRE(ma.values[d] == mb.values[d]);
+		}
+	}
+
+	SECTION("Policy file") {
+		atlas.solve();
+
+		TempPath policy_dir{ "atlas_policy_test" };
+		std::filesystem::create_directories(policy_dir.str());
+
+		std::string path = policy_dir.str() + "/policy.bin";
+		atlas.export_policy(path);
+
+		PolicyReader policy{ path };
+		REQUIRE(policy.size() == atlas.size());
+		REQUIRE(policy.has_values());
+		REQUIRE(policy.target() == target);
+
+		std::unordered_map<uint64_t, double> memo;
+		exact_win_probability(root.tiles, target, memo);
+
+		for (auto& [tiles, expected] : memo) {
+			for (Position p : { Position{ tiles }, Position{ tiles }.rotate_90(), Position{ tiles }.reflect_tr() }) {
+				Direction d;
+				float value;
+
+				REQUIRE(policy.lookup(p, &d, &value));
+				REQUIRE(value == Catch::Approx(expected).margin(1.0 / 65535));
+
+				// The move is optimal in p's own orientation
+				MoveValues mv = atlas.evaluate(p);
+				if (mv.has_legal() && nibble_max(tiles) < target) {
+					REQUIRE(mv.values[d] == Catch::Approx(mv.values[mv.best()]).margin(1e-6));
+				} else if (mv.has_legal()) {
+					REQUIRE(move_in_direction(p.tiles, d) != p.tiles);
+				}
+			}
+		}
+
+		Direction d;
+		REQUIRE(!policy.lookup(Position{ 0x0000'0000'0000'f001 }, &d));
+		REQUIRE(!policy.lookup(Position{ 0x1 }, &d));
+
+		// A windowed Atlas writes the same file, and one can be written without values
+		TempPath dir{ "atlas_policy_window_test" };
+		Atlas<1> windowed{ AtlasOptions { .target = target, .threads = 4, .spill_dir = dir.str() } };
+		windowed.init(&root, 1);
+		windowed.solve();
+
+		// Exporting goes through the same three-layer windows as solving
+		size_t solve_peak = windowed.peak_resident_bytes();
+
+		std::string windowed_path = path + ".windowed";
+		windowed.export_policy(windowed_path, false);
+		REQUIRE(windowed.peak_resident_bytes() <= solve_peak);
+
+		PolicyReader moves_only{ windowed_path, true };
+		REQUIRE(!moves_only.has_values());
+		REQUIRE(moves_only.size() == policy.size());
+
+		for (auto& [tiles, expected] : memo) {
+			Direction a, b;
+			REQUIRE(policy.lookup(Position{ tiles }, &a));
+			REQUIRE(moves_only.lookup(Position{ tiles }, &b));
+			REQUIRE(a == b);
+		}
+
+	}
+}
+
+TEST_CASE("Layer enumeration", "[enumerate]") {
+	SECTION("Cardinalities from the starting positions") {
+		// Checked against a serial std::set-based BFS; layer 4 is the 21 classes of two 2s under the 8 symmetries
+		std::vector<size_t> expected = { 0, 0, 21, 68, 170, 386, 838, 1659, 3141, 5524, 9116, 14119, 20477 };
+
+		for (int threads : { 1, 4 }) {
+			std::vector<size_t> sizes = count_layers(EnumerateOptions { .threads = threads, .target = 3, .max_tile_sum = 24 });
+			REQUIRE(sizes == expected);
+		}
+	}
+
+	SECTION("Layers are sorted, unique and canonical") {
+		std::vector<Position> roots = starting_roots();
+		uint32_t last_sum = 0;
+
+		EnumerateStats stats = enumerate_layers(roots.data(), roots.size(), EnumerateOptions { .threads = 3, .max_tile_sum = 16 },
+			[&] (uint32_t sum, std::vector<uint64_t>& positions) {
+				REQUIRE(sum > last_sum);
+				last_sum = sum;
+
+				for (size_t i = 0; i < positions.size(); ++i) {
+					REQUIRE(canonical_position(positions[i]) == positions[i]);
+					REQUIRE(Position{ positions[i] }.tile_sum() == sum);
+					if (i > 0) REQUIRE(positions[i - 1] < positions[i]);
+				}
+			});
+
+		REQUIRE(last_sum == 16);
+		REQUIRE(stats.positions > 0);
+	}
+}
 
 #if 0
 uint64_t test_canonical_2() {
@@ -329,3 +1459,317 @@ uint64_t test_canonical_2() {
 }
 
 #endif
+
+TEST_CASE("Position batch", "[position batch]") {
+	// An odd count, so every operation has tail lanes left over after the vector blocks
+	std::vector<uint64_t> tiles = random_boards(3, 4'099, { ~0ULL, 0x0f00'f0f0'00f0'0f0f, 0x0f00'f0f0'00f0'0f0f });
+
+	PositionBatch batch(tiles.data(), tiles.size());
+	REQUIRE((uintptr_t)batch.data() % 64 == 0);
+
+	SECTION("Moves and masks match scalar") {
+		for (Direction d : { RIGHT, LEFT, UP, DOWN }) {
+			std::vector<uint64_t> moved;
+			PositionBatch out = batch.move(d, &moved);
+
+			REQUIRE(out.size() == tiles.size());
+			REQUIRE(moved.size() == batch_mask_words(tiles.size()));
+
+			for (size_t i = 0; i < tiles.size(); ++i) {
+				uint64_t m = move_in_direction(tiles[i], d);
+
+				REQUIRE(out.get_idx(i).tiles == m);
+				REQUIRE(batch_mask_test(moved.data(), i) == (m != tiles[i]));
+			}
+		}
+	}
+
+	SECTION("Canonicalize, tile sums and empty counts match scalar") {
+		std::vector<uint32_t> sums(tiles.size());
+		std::vector<uint8_t> empty(tiles.size());
+		batch.tile_sums(sums.data());
+		batch.count_empty(empty.data());
+		batch.canonicalize();
+
+		for (size_t i = 0; i < tiles.size(); ++i) {
+			REQUIRE(batch.get_idx(i).tiles == canonical_position(tiles[i]));
+			REQUIRE(sums[i] == tile_sum(tiles[i]));
+			REQUIRE(empty[i] == count_empty(tiles[i]));
+		}
+	}
+
+	SECTION("Spawns match gen_new_tiles") {
+		PositionBatch twos, fours;
+		std::vector<size_t> offsets;
+		batch.spawns(twos, fours, offsets);
+
+		REQUIRE(offsets.size() == tiles.size() + 1);
+		REQUIRE(twos.size() == offsets.back());
+		REQUIRE(fours.size() == offsets.back());
+
+		for (size_t i = 0; i < tiles.size(); ++i) {
+			Position pp2[16], pp4[16];
+			int pp2c, pp4c;
+			Position{ tiles[i] }.gen_new_tiles(pp2, pp4, &pp2c, &pp4c);
+
+			REQUIRE(offsets[i + 1] - offsets[i] == (size_t)pp2c);
+			for (int j = 0; j < pp2c; ++j) {
+				REQUIRE(twos.get_idx(offsets[i] + j) == pp2[j]);
+				REQUIRE(fours.get_idx(offsets[i] + j) == pp4[j]);
+			}
+		}
+	}
+}
+
+TEST_CASE("Random number generators", "[rng]") {
+	SECTION("Philox matches the reference") {
+		// Known answers from the Random123 distribution
+		uint64_t c[4] = { 0, 0, 0, 0 };
+		detail::philox4x32(c[0], c[1], c[2], c[3], 0, 0);
+		REQUIRE(c[0] == 0x6627e8d5);
+		REQUIRE(c[1] == 0xe169c58d);
+		REQUIRE(c[2] == 0xbc57ac4c);
+		REQUIRE(c[3] == 0x9b00dbd8);
+
+		uint64_t d[4] = { 0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344 };
+		detail::philox4x32(d[0], d[1], d[2], d[3], 0xa4093822, 0x299f31d0);
+		REQUIRE(d[0] == 0xd16cfe09);
+		REQUIRE(d[1] == 0x94fdcceb);
+		REQUIRE(d[2] == 0x5001e420);
+		REQUIRE(d[3] == 0x24126ea1);
+	}
+
+	SECTION("Counter lanes match scalar draws") {
+		CounterRng rng{ 99 };
+		uint64_t games[8] = { 0, 1, 2, 3, 1ULL << 32, (1ULL << 40) + 5, 77, ~0ULL };
+		uint64_t plies[8] = { 0, 0, 1, 7, 3, 1000, 0xffff'ffff, 12 };
+
+		auto v8 = rng.operator()<std::array<uint64_t, 8>>(games, plies, 1);
+		auto v4 = rng.operator()<std::array<uint64_t, 4>>(games + 4, plies + 4);
+
+		for (int i = 0; i < 8; ++i) REQUIRE(v8[i] == rng(games[i], plies[i], 1));
+		for (int i = 0; i < 4; ++i) REQUIRE(v4[i] == rng(games[4 + i], plies[4 + i]));
+
+		REQUIRE(rng(1, 2) != rng(2, 1));
+		REQUIRE(rng(1, 2) != rng(1, 2, 1));
+		REQUIRE(CounterRng{ 98 }(1, 2) != rng(1, 2));
+	}
+
+	SECTION("LCG skip jumps ahead") {
+		for (uint64_t n : { 0, 1, 2, 3, 1000, 123'457 }) {
+			Rng a{ 17 }, b{ 17 };
+			for (uint64_t i = 0; i < n; ++i) a.next();
+			b.skip(n);
+
+			REQUIRE(a.next() == b.next());
+		}
+	}
+}
+
+TEST_CASE("Rollouts", "[rollout]") {
+	SECTION("Work stealing visits every index once") {
+		std::vector<std::atomic<int>> seen(10'007);
+		std::vector<std::atomic<int>> per_worker(4);
+
+		work_stealing_for(seen.size(), 4, [&] (int w, int64_t i) {
+			seen[i]++;
+			per_worker[w]++;
+		}, 16);
+
+		for (auto& s : seen) REQUIRE(s == 1);
+
+		int total = 0;
+		for (auto& c : per_worker) total += c;
+		REQUIRE(total == (int)seen.size());
+	}
+
+	SECTION("Scores") {
+		REQUIRE(game_score(0x1, 0) == 0);
+		REQUIRE(game_score(0x2, 0) == 4);
+		REQUIRE(game_score(0x2, 1) == 0);
+		REQUIRE(game_score(0x3, 0) == 16);
+		REQUIRE(game_score(0xb, 0) == 10 * 2048);
+	}
+
+	SECTION("Spawns pick every empty square and 4s a tenth of the time") {
+		uint64_t tiles = 0x0102'0030'0400'5006;
+		int hits[16] = {}, fours = 0;
+
+		CounterRng rng{ 5 };
+		for (int i = 0; i < 100'000; ++i) {
+			uint64_t s = spawn_tile(tiles, rng(i, 0)) ^ tiles;
+			int idx = __builtin_ctzll(s) / 4;
+
+			REQUIRE(get_tile(tiles, idx) == 0);
+			hits[idx]++;
+			fours += (s >> (4 * idx)) == 2;
+		}
+
+		// 100'000 spawns over 10 empty squares
+		for (int i = 0; i < 16; ++i) {
+			if (get_tile(tiles, i) == 0) {
+				REQUIRE(hits[i] > 9'400);
+				REQUIRE(hits[i] < 10'600);
+			}
+		}
+
+		REQUIRE(fours > 9'500);
+		REQUIRE(fours < 10'500);
+		REQUIRE(spawn_tile(0x1234'1234'1234'1234, 0) == 0x1234'1234'1234'1234);
+	}
+
+	SECTION("Games start with two tiles") {
+		CounterRng rng{ 3 };
+		RolloutPolicy first = first_legal_policy();
+
+		for (uint64_t game = 0; game < 100; ++game) {
+			int plies = 0;
+			RolloutStats stats;
+
+			play_rollout(rng, game, [&] (uint64_t tiles, uint8_t legal_mask, uint64_t random) {
+				if (plies++ == 0) REQUIRE(count_tiles(tiles) == 2);
+				return first(tiles, legal_mask, random);
+			}, stats);
+
+			REQUIRE(stats.games == 1);
+		}
+	}
+
+	SECTION("Lane-parallel games match scalar ones") {
+		RolloutOptions opts;
+		opts.games = 10'001;  // not a multiple of anything
+		opts.seed = 777;
+
+		opts.threads = 1;
+		RolloutStats a = run_rollouts_simd(opts);
+		opts.threads = 3;
+		RolloutStats b = run_rollouts_simd(opts);
+		RolloutStats scalar = run_rollouts(opts);
+
+		// Games draw from the same (game, ply) counters wherever they're played, so everything matches exactly
+		REQUIRE(a.overflowed == 0);
+		for (RolloutStats* s : { &b, &scalar }) {
+			REQUIRE(s->games == opts.games);
+			REQUIRE(s->total_moves == a.total_moves);
+			REQUIRE(s->min_moves == a.min_moves);
+			REQUIRE(s->max_moves == a.max_moves);
+			REQUIRE(s->total_score == a.total_score);
+			REQUIRE(s->max_score == a.max_score);
+			REQUIRE(s->max_tile_counts == a.max_tile_counts);
+			REQUIRE(s->overflowed == a.overflowed);
+		}
+	}
+
+	SECTION("Results don't depend on the thread count") {
+		for (bool random : { false, true }) {
+			RolloutOptions opts;
+			opts.games = 2'000;
+			opts.seed = 12345;
+			opts.policy = random ? random_policy() : first_legal_policy();
+
+			opts.threads = 1;
+			RolloutStats a = run_rollouts(opts);
+			opts.threads = 3;
+			RolloutStats b = run_rollouts(opts);
+
+			REQUIRE(a.games == 2'000);
+			REQUIRE(a.games == b.games);
+			REQUIRE(a.total_moves == b.total_moves);
+			REQUIRE(a.min_moves == b.min_moves);
+			REQUIRE(a.max_moves == b.max_moves);
+			REQUIRE(a.total_score == b.total_score);
+			REQUIRE(a.max_tile_counts == b.max_tile_counts);
+
+			uint64_t games = 0;
+			for (uint64_t c : a.max_tile_counts) games += c;
+			REQUIRE(games == a.games);
+			REQUIRE(a.min_moves > 0);
+			REQUIRE(a.total_score > 0);
+		}
+	}
+}
+
+TEST_CASE("Wide positions", "[wide]") {
+	// Random boards without 32768s, so the nibble moves can't saturate
+	std::vector<uint64_t> tiles = random_boards(11, 5'000, { 0x3333'3333'3333'3333, 0x0707'0707'0707'0707 });
+
+	SECTION("Matches the nibble format") {
+		for (uint64_t t : tiles) {
+			Position p{ t };
+			WidePosition w{ p };
+			CAPTURE(t);
+
+			REQUIRE(w.fits_nibbles());
+			REQUIRE(w.narrow() == p);
+			REQUIRE(w.tile_sum() == p.tile_sum());
+			REQUIRE(w.canonical().narrow() == p.canonical());
+
+			REQUIRE(w.rotate_90().narrow() == p.rotate_90());
+			REQUIRE(w.rotate_180().narrow() == p.rotate_180());
+			REQUIRE(w.rotate_270().narrow() == p.rotate_270());
+			REQUIRE(w.reflect_h().narrow() == p.reflect_h());
+			REQUIRE(w.reflect_v().narrow() == p.reflect_v());
+			REQUIRE(w.reflect_tl().narrow() == p.reflect_tl());
+			REQUIRE(w.reflect_tr().narrow() == p.reflect_tr());
+
+			for (Direction d : { RIGHT, LEFT, UP, DOWN }) {
+				bool s;
+				WidePosition m = w.move(d, &s);
+				uint64_t checked;
+
+				REQUIRE(m.narrow().tiles == move_in_direction(t, d));
+				REQUIRE(s == (move_in_direction(t, d) != t));
+				REQUIRE(move_checked(t, d, &checked));
+				REQUIRE(checked == move_in_direction(t, d));
+			}
+
+			REQUIRE(!may_overflow(t));
+			REQUIRE(overflowing_moves(t) == 0);
+		}
+	}
+
+	SECTION("Merging two 32768s overflows into the wide format") {
+		// 32768 32768 in the top right, and a lone 32768 in the bottom left
+		uint64_t t = 0x000f'0000'0000'ff00;
+		uint64_t result = 0;
+
+		REQUIRE(!move_checked(t, RIGHT, &result));
+		REQUIRE(!move_checked(t, LEFT, &result));
+		REQUIRE(result == 0);
+		REQUIRE(may_overflow(t));
+		REQUIRE(overflowing_moves(t) == ((1 << RIGHT) | (1 << LEFT)));
+
+		// Vertically the two don't meet
+		REQUIRE(move_checked(t, UP, &result));
+		REQUIRE(result == move_up(t));
+		REQUIRE(move_checked(t, DOWN, &result));
+		REQUIRE(result == move_down(t));
+
+		bool s;
+		WidePosition w = WidePosition{ Position{ t } }.move_right(&s);
+		REQUIRE(s);
+		REQUIRE(!w.fits_nibbles());
+		REQUIRE(w.get_tile(3) == 16);
+		REQUIRE(w.get_tile(12) == 0);
+		REQUIRE(w.get_tile(15) == 15);
+		REQUIRE(w.tile_sum() == 65536 + 32768);
+
+		// And on to 131072
+		WidePosition big = w;
+		big.set_tile(2, 16);
+		big = big.move_right(&s);
+		REQUIRE(big.get_tile(3) == 17);
+		REQUIRE(big.max_tile() == 17);
+		REQUIRE(big.tile_sum() == 131072 + 32768);
+	}
+
+	SECTION("Canonical form of wide boards") {
+		WidePosition w{ std::array<uint32_t, 16>{ 65536, 2, 0, 0, 4, 0, 0, 0, 0, 0, 8, 0, 0, 0, 0, 131072 } };
+		REQUIRE(w.max_tile() == 17);
+
+		WidePosition c = w.canonical();
+		for (WidePosition p : { w.rotate_90(), w.rotate_180(), w.rotate_270(), w.reflect_h(), w.reflect_v(), w.reflect_tl(), w.reflect_tr() }) {
+			REQUIRE(p.canonical() == c);
+		}
+	}
+}